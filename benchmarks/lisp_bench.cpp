@@ -0,0 +1,199 @@
+#include <benchmark/benchmark.h>
+
+#include <lisp/default_stack.hpp>
+#include <lisp/evaluate.hpp>
+#include <lisp/parser.hpp>
+#include <lisp/tokenizer.hpp>
+
+namespace
+{
+
+// A quoted flat list: '(0 1 2 ...).
+std::string generate_list(int size)
+{
+    std::string result = "'(";
+    for (int i = 0; i < size; ++i)
+    {
+        result += str(i, " ");
+    }
+    return result + ")";
+}
+
+// Arithmetic nested `depth` levels deep: (+ 1 (* 2 (+ 1 ... 0))).
+std::string generate_nested(int depth)
+{
+    std::string result;
+    for (int i = 0; i < depth; ++i)
+    {
+        result += i % 2 == 0 ? "(+ 1 " : "(* 2 ";
+    }
+    return result + "0" + std::string(depth, ')');
+}
+
+// A program of `count` function definitions, each calling the previous one.
+std::string generate_program(int count)
+{
+    std::string result = "(begin (defun f0 (x) (+ x 1))";
+    for (int i = 1; i < count; ++i)
+    {
+        result += str(" (defun f", i, " (x) (if (< x 0) \"negative\" (f", i - 1, " (+ x 1))))");
+    }
+    return result + str(" (f", count - 1, " 1))");
+}
+
+// Evaluates `setup` once and then `expr` on every iteration, in the same stack.
+void run_program(benchmark::State& state, std::string_view setup, std::string_view expr)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::evaluate(lisp::parse(setup), &stack);
+    const lisp::value program = lisp::parse(expr);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(lisp::evaluate(program, &stack));
+    }
+}
+
+void BM_tokenize(benchmark::State& state)
+{
+    const std::string text = generate_program(static_cast<int>(state.range(0)));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(lisp::tokenize(text));
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_tokenize)->Arg(10)->Arg(1000);
+
+void BM_parse_program(benchmark::State& state)
+{
+    const std::string text = generate_program(static_cast<int>(state.range(0)));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(lisp::parse(text));
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_parse_program)->Arg(10)->Arg(1000);
+
+void BM_parse_list(benchmark::State& state)
+{
+    const std::string text = generate_list(static_cast<int>(state.range(0)));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(lisp::parse(text));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_parse_list)->Arg(100)->Arg(10000);
+
+void BM_evaluate_fib(benchmark::State& state)
+{
+    run_program(
+        state,
+        "(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))",
+        str("(fib ", state.range(0), ")"));
+}
+BENCHMARK(BM_evaluate_fib)->Arg(10)->Arg(20)->Unit(benchmark::kMicrosecond);
+
+void BM_evaluate_nested(benchmark::State& state)
+{
+    run_program(state, "(begin)", generate_nested(static_cast<int>(state.range(0))));
+}
+BENCHMARK(BM_evaluate_nested)->Arg(10)->Arg(500);
+
+void BM_evaluate_program(benchmark::State& state)
+{
+    run_program(state, "(begin)", generate_program(static_cast<int>(state.range(0))));
+}
+BENCHMARK(BM_evaluate_program)->Arg(10)->Arg(200);
+
+void BM_evaluate_seq_pipeline(benchmark::State& state)
+{
+    run_program(
+        state,
+        str("(let xs ", generate_list(static_cast<int>(state.range(0))), ")"),
+        "(seq.rev (seq.map (lambda (x) (* x x)) (seq.filter (lambda (x) (== (% x 3) 0)) xs)))");
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_evaluate_seq_pipeline)->Arg(100)->Arg(10000);
+
+void BM_evaluate_string_building(benchmark::State& state)
+{
+    run_program(
+        state,
+        "(defun build (n acc) (if (< n 1) acc (build (- n 1) (str.cat acc \"ab\" n))))",
+        str("(build ", state.range(0), " \"\")"));
+}
+BENCHMARK(BM_evaluate_string_building)->Arg(10)->Arg(500);
+
+void BM_evaluate_partial(benchmark::State& state)
+{
+    run_program(
+        state,
+        "(let add3 (lambda (a b c) (+ a (+ b c))))",
+        "(seq.map (partial add3 1 2) '(1 2 3 4 5 6 7 8))");
+}
+BENCHMARK(BM_evaluate_partial);
+
+lisp::value sample_value(int kind)
+{
+    switch (kind)
+    {
+        case 0: return 42;
+        case 1: return std::string(64, 'x');
+        case 2: return lisp::parse(generate_list(100));
+        default: return lisp::prelude().get(lisp::symbol{ "+" });
+    }
+}
+
+void BM_value_copy(benchmark::State& state)
+{
+    const lisp::value v = sample_value(static_cast<int>(state.range(0)));
+    for (auto _ : state)
+    {
+        lisp::value copy = v;
+        benchmark::DoNotOptimize(copy);
+    }
+}
+BENCHMARK(BM_value_copy)->ArgName("kind")->DenseRange(0, 3);
+
+void BM_value_compare(benchmark::State& state)
+{
+    // Separate parses, so that equal arrays and strings do not share storage.
+    const int kind = static_cast<int>(state.range(0));
+    const lisp::value lhs = sample_value(kind);
+    const lisp::value rhs = sample_value(kind);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(lhs == rhs);
+    }
+}
+BENCHMARK(BM_value_compare)->ArgName("kind")->DenseRange(0, 2);
+
+// Looks up a builtin from under `depth` nested frames holding a few bindings each.
+void BM_lookup(benchmark::State& state)
+{
+    const int depth = static_cast<int>(state.range(0));
+    std::vector<std::unique_ptr<lisp::stack_type>> frames;
+    const lisp::stack_type* outer = &lisp::prelude();
+    for (int i = 0; i < depth; ++i)
+    {
+        lisp::stack_type::frame_type frame;
+        for (const char* name : { "x", "y", "acc" })
+        {
+            frame.emplace(lisp::symbol{ str(name, i) }, i);
+        }
+        frames.push_back(std::make_unique<lisp::stack_type>(std::move(frame), outer));
+        outer = frames.back().get();
+    }
+    const lisp::symbol s{ "seq.map" };
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(outer->find(s));
+    }
+}
+BENCHMARK(BM_lookup)->Arg(0)->Arg(1)->Arg(8)->Arg(32);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <lisp/memory.hpp>
+#include <memory_resource>
+#include <vector>
+
+namespace lisp
+{
+
+// Memory for the short-lived containers of one evaluation: argument lists and lambda frames. Blocks freed during the
+// evaluation are pooled for reuse, and everything is handed back at once when the evaluation ends.
+class arena
+{
+public:
+    explicit arena(std::size_t initial_size = 64 * 1024);
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    std::pmr::memory_resource* resource();
+
+    // Frees everything allocated so far. Nothing allocated from the arena may still be alive.
+    void release();
+
+private:
+    // Gets chunks from the heap once the initial buffer is used up, charging each to the account that was current
+    // when it was requested and refunding the same account when it is returned.
+    class accounted_heap : public std::pmr::memory_resource
+    {
+    private:
+        struct chunk
+        {
+            void* ptr;
+            std::size_t bytes;
+            std::shared_ptr<memory_account> account;
+        };
+
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+        void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+        std::vector<chunk> m_chunks;
+    };
+
+    std::vector<std::byte> m_buffer;
+    accounted_heap m_heap;
+    std::pmr::monotonic_buffer_resource m_upstream;
+    std::pmr::unsynchronized_pool_resource m_pool;
+};
+
+// Activates the calling thread's arena for its lifetime. Nested scopes share the outermost one, which releases the
+// arena when it ends; containers allocated from it must not outlive that scope, so anything that escapes is copied
+// out (copies of pmr containers use the default resource).
+class arena_scope
+{
+public:
+    arena_scope();
+    ~arena_scope();
+
+    arena_scope(const arena_scope&) = delete;
+    arena_scope& operator=(const arena_scope&) = delete;
+
+    // Whether this is the outermost scope on the thread, i.e. a top-level evaluation.
+    bool outermost() const;
+
+private:
+    bool m_owner;
+};
+
+// The active arena of the calling thread, or the default resource outside of any evaluation.
+std::pmr::memory_resource* current_resource();
+
+}  // namespace lisp
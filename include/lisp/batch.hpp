@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <lisp/default_stack.hpp>
+#include <lisp/value.hpp>
+#include <variant>
+
+namespace lisp
+{
+
+// One value per row. Rows of a single numeric or boolean type are stored unboxed so that kernels can run over plain
+// vectors; anything else is kept as values. A column of size one stands for the same value in every row.
+class column
+{
+public:
+    using integer_vector = std::vector<value::integer_type>;
+    using floating_point_vector = std::vector<value::floating_point_type>;
+    // One byte per row rather than std::vector<bool>, so kernels write whole elements.
+    using boolean_vector = std::vector<std::uint8_t>;
+    using value_vector = std::vector<value>;
+    using data_type = std::variant<integer_vector, floating_point_vector, boolean_vector, value_vector>;
+
+    column();
+    column(integer_vector v);
+    column(floating_point_vector v);
+    column(boolean_vector v);
+    column(value_vector v);
+
+    // Stores the rows unboxed if they all have the same integer, floating point or boolean type.
+    static column from_values(value_vector v);
+    static column scalar(const value& v);
+
+    std::size_t size() const;
+    value at(std::size_t row) const;
+    array to_array() const;
+
+    const data_type& data() const;
+    data_type& data();
+
+private:
+    data_type m_data;
+};
+
+// Evaluates the expression once for a whole batch of rows, with each parameter bound to a column. Arithmetic and
+// comparisons between columns run as typed loops, if and cond partition the rows and evaluate each branch only on
+// the rows that take it, and any other call is applied row by row. Forms that bind names (let, lambda, begin, ...)
+// fall back to evaluating their rows one at a time.
+column evaluate_batch(
+    const value& expr,
+    const std::vector<symbol>& params,
+    const std::vector<column>& columns,
+    const stack_type* globals = &prelude());
+
+}  // namespace lisp
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace lisp
+{
+
+using bench_clock = std::chrono::steady_clock;
+
+struct bench_options
+{
+    // Runs before measuring, to warm caches and to estimate the time of one run.
+    bench_clock::duration warmup = std::chrono::milliseconds{ 50 };
+    // Measuring goes on until both of these are reached...
+    bench_clock::duration min_time = std::chrono::milliseconds{ 200 };
+    std::uint64_t min_samples = 30;
+    // ...or until this much time has passed, for work that takes long per run.
+    bench_clock::duration max_time = std::chrono::seconds{ 5 };
+};
+
+// Times per run; the distribution is over samples, each the mean of a batch of runs.
+struct bench_result
+{
+    std::uint64_t runs;
+    std::uint64_t samples;
+    bench_clock::duration median;
+    bench_clock::duration p99;
+    bench_clock::duration mean;
+    bench_clock::duration min;
+    // New string and array storage per run, and its bytes (see runtime_stats).
+    double allocations;
+    double allocated_bytes;
+};
+
+// Calls `run` repeatedly on the calling thread. Runs are timed in batches long enough for the clock to resolve, so
+// that quick runs are not dominated by the cost of reading it.
+bench_result bench(const std::function<void()>& run, const bench_options& options = {});
+
+struct time_result
+{
+    bench_clock::duration wall;
+    // CPU time of the calling thread, where the OS reports it, and of the process otherwise.
+    std::chrono::nanoseconds cpu;
+};
+
+// Times a single call of `run`.
+time_result time_once(const std::function<void()>& run);
+
+}  // namespace lisp
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <lisp/errors.hpp>
+#include <optional>
+
+namespace lisp
+{
+
+// Steps and wall-clock time that an evaluation may use; running out of either throws budget_exceeded. Every call
+// and every loop iteration is one step. The hot path only decrements a countdown; the fuel and the clock are
+// checked when it reaches zero, which happens at most every `check_interval` steps.
+class budget
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr std::uint64_t check_interval = 1024;
+
+    explicit budget(std::optional<std::uint64_t> steps = {}, std::optional<clock::duration> timeout = {});
+
+    void tick()
+    {
+        if (--m_countdown == 0)
+        {
+            check();
+        }
+    }
+
+    // Steps left, if the number of steps is limited.
+    std::optional<std::uint64_t> remaining() const;
+    std::uint64_t used() const;
+    std::optional<clock::time_point> deadline() const;
+
+private:
+    void check();
+
+    std::optional<std::uint64_t> m_fuel;
+    std::optional<clock::time_point> m_deadline;
+    std::uint64_t m_used;
+    std::uint64_t m_chunk;
+    std::uint64_t m_countdown;
+};
+
+// Makes `limits` the budget charged by evaluations on the calling thread for the scope's lifetime.
+class budget_scope
+{
+public:
+    explicit budget_scope(budget& limits);
+    ~budget_scope();
+
+    budget_scope(const budget_scope&) = delete;
+    budget_scope& operator=(const budget_scope&) = delete;
+
+private:
+    budget* m_previous;
+};
+
+budget* current_budget();
+
+}  // namespace lisp
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <lisp/value.hpp>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+namespace lisp
+{
+
+// Bounded multi-producer, multi-consumer queue of values. Values are moved in and out, so strings and arrays cross
+// threads as shared references rather than copies; closures that keep frames are sent with copies of them (see
+// transfer()).
+class channel
+{
+public:
+    explicit channel(std::size_t capacity);
+
+    channel(const channel&) = delete;
+    channel& operator=(const channel&) = delete;
+
+    ~channel();
+
+    // Blocks while the channel is full. Throws if the channel has been closed.
+    void send(value v);
+
+    // Blocks while the channel is empty. Returns nothing once the channel is closed and drained.
+    std::optional<value> recv();
+
+    void close();
+
+    // Closes every channel, which wakes the threads waiting on them; for exit, when nothing would send or receive
+    // any more.
+    static void close_all();
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_not_full;
+    std::condition_variable m_not_empty;
+    std::deque<value> m_queue;
+    std::size_t m_capacity;
+    bool m_closed;
+};
+
+// Callable stored in a channel value: calling it receives.
+struct channel_handle
+{
+    std::shared_ptr<channel> chan;
+
+    value operator()(const arg_list&) const;
+};
+
+}  // namespace lisp
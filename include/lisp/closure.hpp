@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <lisp/symbol.hpp>
+#include <vector>
+
+namespace lisp
+{
+
+class value;
+
+// What a lambda form's body refers to and binds, which decides what its closures capture (see make_lambda in
+// evaluate.cpp). A closure copies the variables it uses, except those the frame they are in may still bind with let,
+// such as a local function that calls itself; for these it keeps the frame, which is then made on the heap.
+struct closure_info
+{
+    // Names the body uses other than its parameters, sorted.
+    std::vector<symbol> free;
+    // Names the body binds with let in the lambda's own frame, sorted.
+    std::vector<symbol> assigned;
+    // Names the lambdas made in the body use from outside them, sorted.
+    std::vector<symbol> closed;
+    // Whether closures made in the body may keep the frame of a call, so that it is to be made on the heap: they use a
+    // name the body binds with let, or a lambda applied in place or a loop in the body needs such a frame over this one.
+    bool shared = false;
+
+    // The analysis of the lambda or loop form `form`, made on first use and kept with the form.
+    static const closure_info& of(const value& form);
+};
+
+// Holds the analysis of a lambda form once some thread made it.
+class closure_slot
+{
+public:
+    closure_slot() = default;
+
+    // Copies of an array start without an analysis.
+    closure_slot(const closure_slot&);
+    closure_slot& operator=(const closure_slot&) = delete;
+
+    ~closure_slot();
+
+private:
+    friend struct closure_info;
+
+    mutable std::atomic<const closure_info*> m_info = nullptr;
+};
+
+}  // namespace lisp
@@ -0,0 +1,78 @@
+#pragma once
+
+// Support for the code generated by compile_to_cpp (see compiler.hpp).
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <limits>
+#include <lisp/default_stack.hpp>
+#include <lisp/evaluate.hpp>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace lisp
+{
+
+// Calls a value that is not known when compiling.
+inline value call_dynamic(const value& op, std::initializer_list<value> args)
+{
+    return op.as_callable()(arg_list(args));
+}
+
+// Evaluates a form left to the interpreter in `frame`, after binding the locals it mentions there.
+inline value interpret_form(
+    const value& expr, stack_type& frame, std::initializer_list<std::pair<symbol, value>> locals)
+{
+    for (const auto& [name, v] : locals)
+    {
+        frame.insert(name, v);
+    }
+    return evaluate(expr, &frame);
+}
+
+// `names` sorted, as frames list the names that may be bound in them.
+inline std::vector<symbol> sorted_names(std::vector<symbol> names)
+{
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    return names;
+}
+
+// The frame a compiled function runs the forms it leaves to the interpreter in. Locals are bound there again before
+// each form, so every name the forms mention is listed as one that may be bound later, and closures they make refer to
+// the frame rather than copy from it; it is on the heap, for them to keep after the function returns.
+class function_frame
+{
+public:
+    function_frame(stack_type& globals, const std::vector<symbol>& names) : m_frame{ make_shared_frame(&globals, nullptr) }
+    {
+        m_frame->assigned = &names;
+    }
+
+    ~function_frame()
+    {
+        release_cycles(m_frame);
+    }
+
+    function_frame(const function_frame&) = delete;
+    function_frame& operator=(const function_frame&) = delete;
+
+    stack_type& operator*() const
+    {
+        return *m_frame;
+    }
+
+private:
+    std::shared_ptr<stack_type> m_frame;
+};
+
+template <class T>
+[[noreturn]] T cond_no_match()
+{
+    throw std::runtime_error{ "cond: no match found" };
+}
+
+}  // namespace lisp
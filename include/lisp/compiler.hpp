@@ -0,0 +1,32 @@
+#pragma once
+
+#include <lisp/default_stack.hpp>
+#include <lisp/value.hpp>
+#include <string>
+
+namespace lisp
+{
+
+struct compile_options
+{
+    // The generated entry point: lisp::value <entry>(lisp::stack_type& globals).
+    std::string entry = "lisp_program";
+    // Also generate a main() that runs the program on a default_stack() and prints its result.
+    bool main = false;
+};
+
+// Translates a program into a C++17 translation unit that links against this library and, when run, binds and returns
+// what evaluating the program in `globals` would. Functions defined once at the top level with defun or let become C++
+// functions that call each other directly; their parameters and results are unboxed ints, doubles and bools where every
+// call within the program agrees on the type, and they are registered in the globals as callables as well. Arithmetic
+// and comparisons that are builtins of `globals` when compiling run natively, if, cond and begin become C++ control
+// flow, and other calls go through the callables at run time. Forms the translator does not handle (lambdas, bench,
+// time, ...) are left to the interpreter, with the locals they mention bound in a frame of the enclosing function,
+// which closures they make keep; names they bind are not seen by the compiled code. Macros are expanded when compiling;
+// those the program defines are not bound at run time.
+//
+// Compiled calls are not charged to budgets and do not show up in profiles or traces.
+std::string compile_to_cpp(
+    const value& program, const compile_options& options = {}, const stack_type& globals = prelude());
+
+}  // namespace lisp
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <lisp/functions.hpp>
+#include <lisp/isolate.hpp>
 #include <lisp/value.hpp>
 
 namespace lisp
@@ -35,12 +36,31 @@ inline stack_type::frame_type default_frame()
         { "str.cat"_s, callable{ str_cat{}, "str.cat" } },
         { "str.has_prefix"_s, callable{ str_has_prefix{}, "str.has_prefix", 2 } },
         { "str.has_suffix"_s, callable{ str_has_suffix{}, "str.has_suffix", 2 } },
+        { "sys.stats"_s, callable{ sys_stats{}, "sys.stats", 0 } },
+        { "spawn"_s, callable{ spawn{}, "spawn" } },
+        { "await"_s, callable{ await{}, "await", 1 } },
+        { "yield"_s, callable{ yield{}, "yield", 0 } },
+        { "isolate"_s, callable{ isolate{}, "isolate" } },
+        { "chan.make"_s, callable{ chan_make{}, "chan.make", 1 } },
+        { "chan.send"_s, callable{ chan_send{}, "chan.send", 2 } },
+        { "chan.recv"_s, callable{ chan_recv{}, "chan.recv", 1 } },
+        { "chan.recv-ok"_s, callable{ chan_recv_ok{}, "chan.recv-ok", 1 } },
+        { "chan.close"_s, callable{ chan_close{}, "chan.close", 1 } },
     };
 }
 
+// Builtins are shared read-only by every interpreter in the process; the table is built once, on first use.
+inline const stack_type& prelude()
+{
+    static const stack_type instance{ default_frame(), nullptr, true };
+    return instance;
+}
+
+// Each interpreter gets its own empty global frame layered on top of the prelude. The bindings it gains are charged to
+// the account current when it grows.
 inline stack_type default_stack()
 {
-    return { { default_frame() } };
+    return { stack_type::frame_type(accounted_resource()), &prelude(), true };
 }
 
 }  // namespace lisp
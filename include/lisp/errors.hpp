@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdexcept>
+
+namespace lisp
+{
+
+// Raised when an evaluation runs out of something it was granted. Unlike other errors it is not rewrapped with call
+// context on its way out, so embedders can catch the specific type.
+class limit_exceeded : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+class memory_limit_exceeded : public limit_exceeded
+{
+public:
+    using limit_exceeded::limit_exceeded;
+};
+
+class budget_exceeded : public limit_exceeded
+{
+public:
+    using limit_exceeded::limit_exceeded;
+};
+
+}  // namespace lisp
@@ -1,8 +1,45 @@
+#pragma once
+
+#include <lisp/budget.hpp>
 #include <lisp/value.hpp>
 
 namespace lisp
 {
 
+// Expands the expression with the macros visible in `stack` (see expand()) and evaluates the result.
 value evaluate(const value& expr, stack_type* stack);
 
+// Evaluates within the given step and time budget; throws budget_exceeded when it runs out.
+value evaluate(const value& expr, stack_type* stack, budget& limits);
+
+// Evaluates an expression that expand() returned, skipping the expansion phase.
+value evaluate_expanded(const value& expr, stack_type* stack);
+
+// Calls the expanded lambda form `form` as a closure of it made in `globals` would be called, without making one.
+value apply_lambda(const value& form, const arg_list& args, const stack_type* globals);
+
+// Lets go of what a frame made by make_shared_frame binds if no closure looks names up in it, or if only closures bound
+// in it keep it, such as local functions that call each other, so that they do not keep each other alive. For code
+// that evaluates forms in such a frame, once it is done with it.
+void release_cycles(const std::shared_ptr<stack_type>& frame);
+
+// A copy of `v` for another thread to use while this one goes on. Closures in it that keep frames, which the code
+// running in them may still bind names in, get copies of those frames as they are now, and of the closures bound in
+// them; the thread then has the copies to itself. Values without such closures, strings and arrays among them, are
+// shared as they are.
+value transfer(const value& v);
+
+// The expansion phase: applies defun and the macros bound in `globals` throughout the expression, leaving quoted data
+// untouched. (defmacro name (params...) body) defines a macro for the rest of the expression and is replaced by a let
+// that binds it, so that expressions evaluated later in the same frame can use it too. A macro is called with the
+// unevaluated forms of its arguments, and the form it returns is expanded in place of the call. Parts of the
+// expression without macros are returned as they are, not copied.
+value expand(const value& expr, const stack_type& globals);
+
+// Expands with the builtin macros only.
+value expand(const value& expr);
+
+// Whether `v` is a macro bound by defmacro.
+bool is_macro(const value& v);
+
 }  // namespace lisp
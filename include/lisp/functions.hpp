@@ -1,8 +1,14 @@
 #pragma once
 
+#include <lisp/arena.hpp>
+#include <lisp/channel.hpp>
+#include <lisp/evaluate.hpp>
+#include <lisp/scheduler.hpp>
+#include <lisp/stats.hpp>
 #include <lisp/utils/container_utils.hpp>
 #include <lisp/utils/iterator_range.hpp>
 #include <lisp/value.hpp>
+#include <limits>
 
 namespace lisp
 {
@@ -12,7 +18,7 @@ struct binary
 {
     Op op;
 
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
         return op(args.at(0), args.at(1));
     }
@@ -23,7 +29,7 @@ binary(Op) -> binary<Op>;
 
 struct print
 {
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
         std::cout << delimit(args, " ") << "\n";
         return {};
@@ -32,7 +38,7 @@ struct print
 
 struct car
 {
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
         return args.at(0).as_array().at(0);
     }
@@ -40,7 +46,7 @@ struct car
 
 struct cdr
 {
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
         const auto& a = args.at(0).as_array();
         return value::array_type{ std::next(std::begin(a)), std::end(a) };
@@ -49,7 +55,7 @@ struct cdr
 
 struct cons
 {
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
         return concat(vec(args.at(0)), args.at(1).is_array() ? args.at(1).as_array() : vec(args.at(1)));
     }
@@ -57,37 +63,34 @@ struct cons
 
 struct list
 {
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
-        return args;
+        return array(std::begin(args), std::end(args));
     }
 };
 
 struct partial
 {
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
-        auto fn = args.at(0).as_callable();
-        std::vector<value> bound_args = iterator_range{ args } |= drop(1);
-        auto func = [=](const std::vector<value>& call_args)
-        {
-            const std::vector<value> all_args = concat(bound_args, call_args);
-            return fn(all_args);
-        };
-        return value::callable_type{ func, str("partial func=", args[0], ", bound_args=[", delimit(bound_args, ", "), "]") };
+        const callable& fn = args.at(0).as_callable();
+        std::vector<value> bound_args = fn.bound_args();
+        bound_args.insert(bound_args.end(), std::next(std::begin(args)), std::end(args));
+        return callable{ fn, std::move(bound_args) };
     }
 };
 
 struct pipe
 {
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
-        auto func = [=](const std::vector<value>& call_args)
+        const std::vector<value> fns(std::begin(args), std::end(args));
+        auto func = [=](const arg_list& call_args)
         {
-            value result = args.at(0).as_callable()(call_args);
-            for (const auto& fn : iterator_range{ args } |= drop(1))
+            value result = fns.at(0).as_callable()(call_args);
+            for (const auto& fn : iterator_range{ fns } |= drop(1))
             {
-                result = fn.as_callable()({ result });
+                result = fn.as_callable()(arg_list({ result }, call_args.get_allocator()));
             }
             return result;
         };
@@ -101,15 +104,15 @@ struct callable_wrapper
 
     value operator()(value arg) const
     {
-        return callable({ std::move(arg) });
+        return callable(arg_list({ std::move(arg) }, current_resource()));
     }
 };
 
 struct seq_map
 {
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
-        const auto func = args.at(0).as_callable();
+        const callable& func = args.at(0).as_callable();
         const auto& a = args.at(1).as_array();
         array result;
         result.reserve(a.size());
@@ -120,9 +123,9 @@ struct seq_map
 
 struct seq_filter
 {
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
-        const auto func = args.at(0).as_callable();
+        const callable& func = args.at(0).as_callable();
         const auto& a = args.at(1).as_array();
         array result;
         result.reserve(a.size());
@@ -133,7 +136,7 @@ struct seq_filter
 
 struct seq_rev
 {
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
         array a = args.at(0).as_array();
         std::reverse(std::begin(a), std::end(a));
@@ -143,7 +146,7 @@ struct seq_rev
 
 struct seq_at
 {
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
         const auto n = args.at(0).as_integer();
         const auto& a = args.at(1).as_array();
@@ -161,7 +164,7 @@ struct seq_at
 
 struct str_cat
 {
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
         std::stringstream ss;
         for (const value& a : args)
@@ -174,7 +177,7 @@ struct str_cat
 
 struct str_has_prefix
 {
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
         const auto prefix = std::string_view{ args.at(0).as_string() };
         const auto text = std::string_view{ args.at(1).as_string() };
@@ -184,7 +187,7 @@ struct str_has_prefix
 
 struct str_has_suffix
 {
-    value operator()(const std::vector<value>& args) const
+    value operator()(const arg_list& args) const
     {
         const auto suffix = std::string_view{ args.at(0).as_string() };
         const auto text = std::string_view{ args.at(1).as_string() };
@@ -192,4 +195,147 @@ struct str_has_suffix
     }
 };
 
+// The calling thread's counters (see stats.hpp) as a list of (name count) pairs.
+struct sys_stats
+{
+    static value count(std::uint64_t n)
+    {
+        // Counts past the integer range are reported as floating point rather than wrapped.
+        if (n <= static_cast<std::uint64_t>(std::numeric_limits<value::integer_type>::max()))
+        {
+            return static_cast<value::integer_type>(n);
+        }
+        return static_cast<value::floating_point_type>(n);
+    }
+
+    value operator()(const arg_list&) const
+    {
+        const runtime_stats s = stats_snapshot();
+        return array{ array{ symbol{ "values" }, count(s.values) },
+                      array{ symbol{ "value_copies" }, count(s.value_copies) },
+                      array{ symbol{ "strings" }, count(s.strings) },
+                      array{ symbol{ "arrays" }, count(s.arrays) },
+                      array{ symbol{ "payload_bytes" }, count(s.payload_bytes) },
+                      array{ symbol{ "frames" }, count(s.frames) },
+                      array{ symbol{ "calls" }, count(s.calls) },
+                      array{ symbol{ "lookups" }, count(s.lookups) },
+                      array{ symbol{ "cached_lookups" }, count(s.cached_lookups) } };
+    }
+};
+
+// The task gets copies of the frames that the closure and its arguments keep, as they are when it is spawned (see
+// transfer()), so it neither sees names bound in them later nor races with the code that binds them. Global frames
+// are shared without locking: nothing may bind a global that a running task can see until the task has been awaited.
+struct spawn
+{
+    value operator()(const arg_list& args) const
+    {
+        // Checked here rather than when the task runs.
+        args.at(0).as_callable();
+        // Copied out of the arena in one piece, so that closures sharing a frame share its copy: the task may run after
+        // this evaluation has ended.
+        value sent = transfer(array(std::begin(args), std::end(args)));
+        auto state = std::make_shared<task_state>();
+        scheduler::instance().submit(
+            [sent = std::move(sent), state]()
+            {
+                try
+                {
+                    const array& a = sent.as_array();
+                    state->set_value(a.at(0).as_callable()(arg_list(std::begin(a) + 1, std::end(a))));
+                }
+                catch (...)
+                {
+                    state->set_exception(std::current_exception());
+                }
+            });
+        return value::callable_type{ task_handle{ state }, "task", 0 };
+    }
+};
+
+struct await
+{
+    value operator()(const arg_list& args) const
+    {
+        const auto handle = args.at(0).as_callable().fn().target<task_handle>();
+        if (!handle)
+        {
+            throw std::runtime_error{ str("expected a task, got ", args.at(0)) };
+        }
+        return handle->state->get();
+    }
+};
+
+struct yield
+{
+    value operator()(const arg_list& args) const
+    {
+        if (!scheduler::instance().run_one())
+        {
+            std::this_thread::yield();
+        }
+        return {};
+    }
+};
+
+inline channel& as_channel(const value& v)
+{
+    const auto handle = v.as_callable().fn().target<channel_handle>();
+    if (!handle)
+    {
+        throw std::runtime_error{ str("expected a channel, got ", v) };
+    }
+    return *handle->chan;
+}
+
+struct chan_make
+{
+    value operator()(const arg_list& args) const
+    {
+        const auto capacity = args.at(0).as_integer();
+        if (capacity <= 0)
+        {
+            throw std::runtime_error{ "channel capacity must be positive" };
+        }
+        return value::callable_type{ channel_handle{ std::make_shared<channel>(capacity) }, "channel", 0 };
+    }
+};
+
+struct chan_send
+{
+    value operator()(const arg_list& args) const
+    {
+        as_channel(args.at(0)).send(args.at(1));
+        return {};
+    }
+};
+
+struct chan_recv
+{
+    value operator()(const arg_list& args) const
+    {
+        return as_channel(args.at(0)).recv().value_or(value{});
+    }
+};
+
+// (chan.recv-ok ch): like chan.recv, but tells a sent null from the end of the channel: returns (true value), or
+// (false null) once the channel is closed and drained.
+struct chan_recv_ok
+{
+    value operator()(const arg_list& args) const
+    {
+        std::optional<value> v = as_channel(args.at(0)).recv();
+        return v ? array{ true, std::move(*v) } : array{ false, value{} };
+    }
+};
+
+struct chan_close
+{
+    value operator()(const arg_list& args) const
+    {
+        as_channel(args.at(0)).close();
+        return {};
+    }
+};
+
 }  // namespace lisp
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <lisp/closure.hpp>
+#include <lisp/value.hpp>
+#include <memory>
+
+namespace lisp
+{
+
+// Remembers, for each name in a call form, the global frame it was last found in and its binding there, so that
+// evaluating the form again does not search the frames for it. An entry holds while that frame and the global frame
+// passed on the way to it, if any, keep their versions (see stack.hpp), and no frame between the call and it was
+// extended; rebinding a global assigns in place, so the entry sees the new value. Other interpreters coming and going
+// leave it be. Forms are shared between threads: the first thread to evaluate one owns its cache, and the others look
+// names up as before.
+class site_cache
+{
+public:
+    site_cache() = default;
+
+    // Copies of an array start without a cache.
+    site_cache(const site_cache&);
+    site_cache& operator=(const site_cache&) = delete;
+
+    // The cache of the call form `form` for the calling thread, or null if another thread owns it.
+    static site_cache* of(const value& form);
+
+    // The binding of `s`, at position `index` of a form of `size` elements, as `stack.get(s)` finds it.
+    const value& lookup(const symbol& s, std::size_t index, std::size_t size, const stack_type& stack);
+
+private:
+    struct entry
+    {
+        const stack_type* home = nullptr;
+        std::uint64_t home_version = 0;
+        // 0 if no global frame was passed on the way to home.
+        std::uint64_t passed_version = 0;
+        const value* binding = nullptr;
+        std::size_t hops = 0;
+    };
+
+    std::atomic<const void*> m_owner = nullptr;
+    std::unique_ptr<entry[]> m_entries;
+};
+
+// The storage of every array value, so that call forms carry their cache and lambda forms the analysis of their body.
+struct array_storage : array
+{
+    explicit array_storage(array items) : array(std::move(items))
+    {
+    }
+
+    mutable site_cache cache;
+    closure_slot closure;
+};
+
+}  // namespace lisp
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <lisp/value.hpp>
+
+namespace lisp
+{
+
+// Runs a program on its own OS thread, in a fresh interpreter that shares nothing with the caller but the prelude.
+// The program is passed as data and must evaluate to a callable, which is then applied to the given arguments;
+// pass channels as arguments to talk to it. Returns a task that can be awaited for the callable's result. When the
+// process exits, every channel is closed and the isolates still running are waited for, for up to a second; isolates
+// cannot be started from then on.
+value spawn_isolate(value program, std::vector<value> args);
+
+struct isolate
+{
+    value operator()(const arg_list& args) const;
+};
+
+}  // namespace lisp
@@ -1,9 +1,17 @@
 #pragma once
 
+#include <lisp/batch.hpp>
+#include <lisp/compiler.hpp>
 #include <lisp/default_stack.hpp>
 #include <lisp/evaluate.hpp>
+#include <lisp/optimize.hpp>
 #include <lisp/parser.hpp>
+#include <lisp/prepare.hpp>
+#include <lisp/profiler.hpp>
+#include <lisp/server.hpp>
+#include <lisp/stats.hpp>
 #include <lisp/tokenizer.hpp>
+#include <lisp/tracer.hpp>
 #include <lisp/value.hpp>
 
 namespace lisp
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <lisp/errors.hpp>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace lisp
+{
+
+// Bytes held by the strings, arrays and frames that one interpreter creates. An account is charged by the thread
+// evaluating under its memory_scope, but values charged to it may be released on any thread, e.g. after being sent
+// over a channel or returned from a task, so the counters are atomic.
+class memory_account
+{
+public:
+    explicit memory_account(std::optional<std::size_t> quota = {});
+
+    // Throws memory_limit_exceeded, without charging, if the quota would be exceeded.
+    void allocate(std::size_t bytes);
+    void deallocate(std::size_t bytes) noexcept;
+
+    std::size_t live() const;
+    std::size_t peak() const;
+    const std::optional<std::size_t>& quota() const;
+
+private:
+    std::optional<std::size_t> m_quota;
+    std::atomic<std::size_t> m_live;
+    std::atomic<std::size_t> m_peak;
+};
+
+// Charges allocations made on the calling thread to `account` for the scope's lifetime.
+class memory_scope
+{
+public:
+    explicit memory_scope(std::shared_ptr<memory_account> account);
+    ~memory_scope();
+
+    memory_scope(const memory_scope&) = delete;
+    memory_scope& operator=(const memory_scope&) = delete;
+
+private:
+    std::shared_ptr<memory_account> m_previous;
+};
+
+// The account charged on the calling thread, or null when nothing is being accounted.
+const std::shared_ptr<memory_account>& current_account();
+
+// Heap memory charged to the account current on the thread that allocates it, if any, and refunded to the same
+// account when it is freed, on whichever thread. For containers that outlive an evaluation, such as the bindings of
+// global frames and of the frames closures keep.
+std::pmr::memory_resource* accounted_resource();
+
+// Allocator for the shared storage of strings and arrays. Each allocation is charged to the account, together with
+// `extra` bytes owned by the stored object (an immutable string or array never resizes its buffer). Holding the
+// account keeps it alive until the last value charged to it is gone.
+template <class T>
+struct accounting_allocator
+{
+    using value_type = T;
+
+    std::shared_ptr<memory_account> account;
+    std::size_t extra;
+
+    accounting_allocator(std::shared_ptr<memory_account> account, std::size_t extra)
+        : account{ std::move(account) }
+        , extra{ extra }
+    {
+    }
+
+    template <class U>
+    accounting_allocator(const accounting_allocator<U>& other) : account{ other.account }
+                                                               , extra{ other.extra }
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        account->allocate(n * sizeof(T) + extra);
+        return std::allocator<T>{}.allocate(n);
+    }
+
+    void deallocate(T* ptr, std::size_t n) noexcept
+    {
+        std::allocator<T>{}.deallocate(ptr, n);
+        account->deallocate(n * sizeof(T) + extra);
+    }
+
+    template <class U>
+    friend bool operator==(const accounting_allocator& lhs, const accounting_allocator<U>& rhs)
+    {
+        return lhs.account == rhs.account;
+    }
+
+    template <class U>
+    friend bool operator!=(const accounting_allocator& lhs, const accounting_allocator<U>& rhs)
+    {
+        return !(lhs == rhs);
+    }
+};
+
+inline std::size_t payload_bytes(const std::string& v)
+{
+    return v.capacity();
+}
+
+template <class T>
+std::size_t payload_bytes(const std::vector<T>& v)
+{
+    return v.capacity() * sizeof(T);
+}
+
+// Shared immutable storage for `v`, charged to the current account if there is one.
+template <class T>
+std::shared_ptr<const T> make_shared_storage(T v)
+{
+    if (const auto& account = current_account())
+    {
+        const std::size_t extra = payload_bytes(v);
+        return std::allocate_shared<const T>(accounting_allocator<T>{ account, extra }, std::move(v));
+    }
+    return std::make_shared<const T>(std::move(v));
+}
+
+}  // namespace lisp
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <lisp/default_stack.hpp>
+#include <lisp/value.hpp>
+
+namespace lisp
+{
+
+// Rewrites an expression into one that evaluates to the same result in `globals` with less work:
+// - names of builtins that nothing in the expression rebinds are replaced by the builtins themselves, and calls of
+//   side-effect free builtins (arithmetic, comparisons, list and string functions) with constant arguments are
+//   evaluated once here;
+// - if and cond with constant tests keep only the branch that is taken, and nested begin forms are flattened;
+// - calls of small non-recursive lambdas, bound once at the top level or applied in place, are replaced by their
+//   bodies when the arguments are constants or names.
+// Calls that are bound to fail are reported by throwing the error evaluating them would raise: those with more
+// arguments than the builtin or lambda called takes, with an argument of a category the builtin does not take where
+// that category is known (constants, lambdas, results of builtins), or of pure builtins on constants. Builtins called
+// with exactly as many arguments as they take are called unchecked (see callable_base::unchecked()).
+// Builtins are recognized by their binding in prelude(), so `globals` should be layered on it (see default_stack());
+// as with prepare(), rebinding them after optimizing does not affect the result.
+value optimize(const value& expr, const stack_type& globals = prelude());
+
+}  // namespace lisp
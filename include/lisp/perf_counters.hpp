@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace lisp
+{
+
+struct hardware_counts
+{
+    std::uint64_t cycles;
+    std::uint64_t instructions;
+    std::uint64_t cache_misses;
+    std::uint64_t branch_misses;
+
+    // Instructions per cycle, or 0 if no cycles were counted.
+    double ipc() const;
+
+    hardware_counts& operator+=(const hardware_counts& other);
+};
+
+hardware_counts operator-(const hardware_counts& lhs, const hardware_counts& rhs);
+
+// CPU cycles, instructions, cache misses and branch misses of the calling thread, in user space, read through Linux
+// perf_event_open. The counters are opened for the thread that constructs this object. Where they cannot be opened
+// (another OS, no PMU in a VM, or a restrictive kernel.perf_event_paranoid) the object is unavailable and every read
+// returns zeros.
+class perf_counters
+{
+public:
+    perf_counters();
+    ~perf_counters();
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    bool available() const;
+
+    // Why the counters are unavailable; empty when they are available.
+    const std::string& error() const;
+
+    // Totals since construction; a system call per read.
+    hardware_counts read() const;
+
+private:
+    void close();
+
+    std::array<int, 4> m_fds;
+    std::string m_error;
+};
+
+}  // namespace lisp
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <lisp/closure.hpp>
+#include <lisp/default_stack.hpp>
+#include <lisp/value.hpp>
+#include <memory>
+
+namespace lisp
+{
+
+// An expression analyzed once for repeated evaluation with different arguments. Macros are expanded and every free
+// name visible in `globals` is resolved when the expression is prepared, so later rebinding of a global does not
+// affect it. Calls only read the shared state and bind arguments in a frame reused per thread, unless closures the
+// expression makes may keep the frame, so one instance can be called concurrently from many threads as long as
+// `globals` outlives it and is not modified meanwhile.
+class prepared
+{
+public:
+    prepared(const value& expr, std::vector<symbol> params, const stack_type* globals = &prelude());
+
+    value call(const std::vector<value>& args) const;
+
+    template <class... Args>
+    value operator()(Args&&... args) const
+    {
+        return call(std::vector<value>{ value(std::forward<Args>(args))... });
+    }
+
+    const value& expr() const;
+    const std::vector<symbol>& params() const;
+
+private:
+    struct state
+    {
+        // The expression as the body of a lambda of the parameters.
+        value lambda;
+        const closure_info* info;
+        std::vector<symbol> params;
+        const stack_type* globals;
+    };
+
+    std::shared_ptr<const state> m_state;
+};
+
+prepared prepare(const value& expr, std::vector<symbol> params, const stack_type* globals = &prelude());
+
+}  // namespace lisp
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <lisp/perf_counters.hpp>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lisp
+{
+
+// Records every call made by evaluations on the thread where it is active (see profiler_scope): call counts and
+// inclusive and exclusive time per function, and the tree of call paths for flame graphs. Functions are reported
+// under their names; a lambda bound with let or defun is named after its symbol, and top-level forms are reported as
+// well. With hardware counters, cycles, instructions, cache misses and branch misses are attributed the same way as
+// time; they are read on the thread that constructs the profiler.
+class profiler
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct function_stats
+    {
+        std::string name;
+        std::uint64_t calls;
+        clock::duration inclusive;
+        clock::duration exclusive;
+        hardware_counts inclusive_counts;
+        hardware_counts exclusive_counts;
+    };
+
+    // Without hardware counters, or where they are unavailable, the counts stay zero.
+    explicit profiler(bool hardware_counters = false);
+    ~profiler();
+
+    profiler(const profiler&) = delete;
+    profiler& operator=(const profiler&) = delete;
+
+    // Starts a call of the function identified by `fn`. Functions are recorded by name, so that closures made by the
+    // same lambda are one function however many of them there are; `describe` produces the name and is only called
+    // for callables that are not in the cache of recently seen ones. The cache keeps its callables alive, so that their
+    // addresses are not reused, and is emptied when it grows past a limit.
+    template <class Describe>
+    void enter(const std::shared_ptr<const void>& fn, Describe&& describe)
+    {
+        const auto iter = m_index.find(fn.get());
+        if (iter != m_index.end())
+        {
+            push(*iter->second.second);
+            return;
+        }
+        function& entry = named(describe());
+        if (m_index.size() >= max_cached_callables)
+        {
+            m_index.clear();
+        }
+        m_index.emplace(fn.get(), std::make_pair(fn, &entry));
+        push(entry);
+    }
+
+    // Starts a top-level form, or anything else identified by its name alone.
+    void enter(const std::string& name);
+
+    void exit();
+
+    // Whether hardware counts are being collected.
+    bool hardware_counters() const;
+
+    // Why hardware counters were requested but are unavailable; empty otherwise.
+    std::string hardware_counters_error() const;
+
+    // Totals per name, sorted by exclusive time.
+    std::vector<function_stats> stats() const;
+
+    // A table of stats() with each function's share of the total time.
+    void write_report(std::ostream& os) const;
+
+    // One line per call path: the names from the outermost call down, separated by ';', and the exclusive time
+    // spent there in microseconds. This is the input format of flamegraph.pl and compatible viewers.
+    void write_folded(std::ostream& os) const;
+
+private:
+    static constexpr std::size_t max_cached_callables = 4096;
+
+    struct function
+    {
+        std::string name;
+        std::uint64_t calls;
+        std::uint64_t active;
+        clock::duration inclusive;
+        clock::duration exclusive;
+        hardware_counts inclusive_counts;
+        hardware_counts exclusive_counts;
+    };
+
+    struct node
+    {
+        const function* fn;
+        node* parent;
+        clock::duration exclusive;
+        std::map<const function*, std::unique_ptr<node>> children;
+    };
+
+    struct frame
+    {
+        function* fn;
+        node* path;
+        clock::time_point start;
+        clock::duration children;
+        hardware_counts start_counts;
+        hardware_counts children_counts;
+    };
+
+    function& named(const std::string& name);
+    void push(function& fn);
+
+    std::vector<std::unique_ptr<function>> m_functions;
+    std::unordered_map<const void*, std::pair<std::shared_ptr<const void>, function*>> m_index;
+    std::unordered_map<std::string, function*> m_named;
+    std::unique_ptr<perf_counters> m_counters;
+    node m_root;
+    std::vector<frame> m_stack;
+};
+
+// Makes `p` record the calls made on the calling thread for the scope's lifetime.
+class profiler_scope
+{
+public:
+    explicit profiler_scope(profiler& p);
+    ~profiler_scope();
+
+    profiler_scope(const profiler_scope&) = delete;
+    profiler_scope& operator=(const profiler_scope&) = delete;
+
+private:
+    profiler* m_previous;
+};
+
+profiler* current_profiler();
+
+// Ends the call started on `p`, if any, when it goes out of scope.
+struct profiler_exit
+{
+    profiler* p;
+
+    ~profiler_exit()
+    {
+        if (p)
+        {
+            p->exit();
+        }
+    }
+};
+
+}  // namespace lisp
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <lisp/value.hpp>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace lisp
+{
+
+// Fixed pool of OS threads multiplexing many short tasks. Every worker owns a deque: it pushes and pops its own
+// work at the back and steals from the front of the others when it runs dry.
+class scheduler
+{
+public:
+    using task_type = std::function<void()>;
+
+    explicit scheduler(std::size_t worker_count);
+    ~scheduler();
+
+    scheduler(const scheduler&) = delete;
+    scheduler& operator=(const scheduler&) = delete;
+
+    void submit(task_type task);
+
+    // Runs one pending task on the calling thread. Returns false if there was nothing to run.
+    bool run_one();
+
+    std::size_t worker_count() const;
+
+    static scheduler& instance();
+
+private:
+    struct worker
+    {
+        std::mutex mutex;
+        std::deque<task_type> queue;
+    };
+
+    std::optional<task_type> pop(std::size_t index);
+    std::optional<task_type> steal(std::size_t index);
+    void run(std::size_t index);
+
+    std::vector<std::unique_ptr<worker>> m_workers;
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::atomic<std::size_t> m_pending;
+    std::atomic<std::size_t> m_next;
+    bool m_stop;
+};
+
+// Shared result slot of a spawned evaluation.
+class task_state
+{
+public:
+    void set_value(value v);
+    void set_exception(std::exception_ptr ex);
+    bool ready() const;
+    // Blocks until the result is available. A scheduler worker keeps running other tasks while it waits. Each caller
+    // gets its own copy of the frames that closures in the result keep (see transfer()).
+    value get();
+
+private:
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::optional<value> m_result;
+    std::exception_ptr m_error;
+    bool m_ready = false;
+};
+
+// Callable stored in a task value: calling it awaits the task.
+struct task_handle
+{
+    std::shared_ptr<task_state> state;
+
+    value operator()(const arg_list&) const;
+};
+
+}  // namespace lisp
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <lisp/value.hpp>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace lisp
+{
+
+// Requests and responses travel as frames: a 4-byte big-endian payload length followed by the payload. A request
+// payload is program text; a response payload is a status byte (0 on success, 1 on error) followed by the printed
+// result or the error message.
+struct response
+{
+    bool ok;
+    std::string text;
+};
+
+// Keeps a warm interpreter behind a Unix domain socket. An epoll loop accepts connections and reads request frames;
+// each request is evaluated on the scheduler's workers in its own empty frame on top of `globals`, which is shared
+// read-only and must not change while the server runs. A connection's requests are answered in order, one at a time;
+// open more connections to have requests evaluated in parallel.
+class server
+{
+public:
+    server(const stack_type* globals, const std::string& socket_path);
+    ~server();
+
+    server(const server&) = delete;
+    server& operator=(const server&) = delete;
+
+    // Serves requests until stop() is called, then waits for requests still being evaluated.
+    void run();
+
+    // Safe to call from any thread and from a signal handler.
+    void stop();
+
+private:
+    struct connection
+    {
+        int fd;
+        std::string input;
+        std::string output;
+        std::deque<std::string> pending;
+        bool busy;
+    };
+
+    struct completion
+    {
+        std::uint64_t id;
+        std::string frame;
+    };
+
+    void accept_all();
+    void on_readable(std::uint64_t id);
+    void on_writable(std::uint64_t id);
+    void dispatch(std::uint64_t id);
+    void drain_completions();
+    void close(std::uint64_t id);
+    void watch(std::uint64_t id, bool want_write);
+    value parse_cached(const std::string& code);
+
+    const stack_type* m_globals;
+    std::string m_path;
+    int m_listen_fd;
+    int m_epoll_fd;
+    int m_event_fd;
+    std::atomic<bool> m_stopping;
+    std::atomic<std::size_t> m_in_flight;
+    std::uint64_t m_next_id;
+    std::map<std::uint64_t, connection> m_connections;
+    std::mutex m_completions_mutex;
+    std::vector<completion> m_completions;
+    std::mutex m_cache_mutex;
+    std::unordered_map<std::string, value> m_cache;
+};
+
+// Sends one request to a server and waits for its response.
+response request(const std::string& socket_path, std::string_view code);
+
+}  // namespace lisp
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <lisp/symbol.hpp>
+
+namespace lisp
+{
+
+inline const auto sym_defun = symbol{ "defun" };
+inline const auto sym_defmacro = symbol{ "defmacro" };
+inline const auto sym_lambda = symbol{ "lambda" };
+inline const auto sym_let = symbol{ "let" };
+inline const auto sym_if = symbol{ "if" };
+inline const auto sym_begin = symbol{ "begin" };
+inline const auto sym_cond = symbol{ "cond" };
+inline const auto sym_quote = symbol{ "quote" };
+inline const auto sym_bench = symbol{ "bench" };
+inline const auto sym_time = symbol{ "time" };
+inline const auto sym_loop = symbol{ "loop" };
+inline const auto sym_recur = symbol{ "recur" };
+inline const auto sym_while = symbol{ "while" };
+inline const auto sym_dotimes = symbol{ "dotimes" };
+inline const auto sym_doseq = symbol{ "doseq" };
+
+// Forms that repeat their body without a call, and so without a new frame, per iteration.
+inline bool is_iteration_form(const symbol& s)
+{
+    return s == sym_loop || s == sym_while || s == sym_dotimes || s == sym_doseq;
+}
+
+inline bool is_special_form(const symbol& s)
+{
+    return s == sym_defun || s == sym_defmacro || s == sym_lambda || s == sym_let || s == sym_if || s == sym_begin
+           || s == sym_cond || s == sym_quote || s == sym_bench || s == sym_time || s == sym_recur || is_iteration_form(s);
+}
+
+}  // namespace lisp
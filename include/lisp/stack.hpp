@@ -1,41 +1,125 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <lisp/memory.hpp>
+#include <lisp/utils/flat_map.hpp>
+#include <lisp/utils/small_vector.hpp>
 #include <lisp/utils/string_utils.hpp>
-#include <map>
+#include <memory>
 #include <vector>
 
 namespace lisp
 {
 
+// A version for a global frame that no other frame has had, so that call sites that remember the version of a frame
+// do not take another one made at the same address for it (see inline_cache.hpp). Threads take them in blocks, so
+// making frames does not write to memory shared between threads.
+inline std::uint64_t next_binding_version()
+{
+    constexpr std::uint64_t block = 4096;
+    static std::atomic<std::uint64_t> next_block{ 1 };
+    thread_local std::uint64_t next = 0;
+    thread_local std::uint64_t end = 0;
+    if (next == end)
+    {
+        next = next_block.fetch_add(1, std::memory_order_relaxed) * block;
+        end = next + block;
+    }
+    return next++;
+}
+
 template <class S, class V>
 struct stack_base
 {
     using symbol_type = S;
     using value_type = V;
-    using frame_type = std::map<symbol_type, value_type>;
+    // Lambda frames hold a few parameters, which fit inline.
+    using frame_type = flat_map<symbol_type, value_type, small_vector<std::pair<symbol_type, value_type>, 4>>;
     frame_type frame;
-    stack_base* outer;
+    const stack_base* outer;
+    // Call sites may remember bindings they find in a global frame, along with its version, which changes whenever the
+    // frame gains a name, as the bindings may then move; rebinding a name assigns in place. 0 for other frames.
+    bool global;
+    std::uint64_t version;
+    // Whether names were added to this frame after it was set up, e.g. by let in a lambda body. Call sites do not rely
+    // on what they remembered about frames further out, as a name added here may hide it.
+    bool extended;
+    // The names code running in this frame may bind with let, sorted, where that is known, as for lambda frames. A
+    // closure copies the variables it uses out of such frames instead of referring to them (see closure.hpp).
+    const std::vector<symbol_type>* assigned;
+    // Set for frames made by make_shared_frame, which closures may keep.
+    std::weak_ptr<stack_base> self;
+    // Whether a closure may look names up in this frame, which then keeps its bindings once the code running in it
+    // returns (see release_cycles).
+    mutable bool referenced = false;
+
+    stack_base(frame_type frame, const stack_base* outer = {}, bool global = false)
+        : frame{ std::move(frame) }
+        , outer{ outer }
+        , global{ global }
+        , version{ global ? next_binding_version() : 0 }
+        , extended{ !global && !this->frame.empty() }
+        , assigned{ nullptr }
+    {
+    }
+
+    stack_base(const stack_base& other)
+        : frame{ other.frame }
+        , outer{ other.outer }
+        , global{ other.global }
+        , version{ global ? next_binding_version() : 0 }
+        , extended{ other.extended }
+        , assigned{ other.assigned }
+    {
+    }
 
-    stack_base(frame_type frame, stack_base* outer = {}) : frame{ std::move(frame) }, outer{ outer }
+    // The bindings of `other` move here, so call sites that found them there look again.
+    stack_base(stack_base&& other) noexcept
+        : frame{ std::move(other.frame) }
+        , outer{ other.outer }
+        , global{ other.global }
+        , version{ global ? next_binding_version() : 0 }
+        , extended{ other.extended }
+        , assigned{ other.assigned }
     {
+        other.version = other.global ? next_binding_version() : 0;
     }
 
+    stack_base& operator=(const stack_base&) = delete;
+
     const value_type& insert(const symbol_type& s, const value_type& v)
     {
-        frame[s] = v;
+        if (frame.insert_or_assign(s, v).second)
+        {
+            extended = extended || !global;
+            if (global)
+            {
+                version = next_binding_version();
+            }
+        }
         return v;
     }
 
-    const value_type& get(const symbol_type& s) const
+    const value_type* find(const symbol_type& s) const
     {
         const auto iter = frame.find(s);
         if (iter != frame.end())
         {
-            return iter->second;
+            return &iter->second;
         }
         if (outer)
         {
-            return outer->get(s);
+            return outer->find(s);
+        }
+        return nullptr;
+    }
+
+    const value_type& get(const symbol_type& s) const
+    {
+        if (const value_type* result = find(s))
+        {
+            return *result;
         }
 
         throw std::runtime_error{ str("Unrecognized symbol '", s, "'") };
@@ -47,4 +131,24 @@ struct stack_base
     }
 };
 
+// Makes a frame on the heap, for code whose closures may keep its frame after it returns. The frame keeps `keep`
+// alive, which owns `outer` unless that is a frame closures do not keep, such as a global one. The frame and its
+// bindings are charged to the current account, as closures that keep frames can grow without bound.
+template <class S, class V>
+std::shared_ptr<stack_base<S, V>> make_shared_frame(const stack_base<S, V>* outer, std::shared_ptr<const void> keep)
+{
+    struct holder
+    {
+        stack_base<S, V> frame;
+        std::shared_ptr<const void> keep;
+    };
+    holder made{ stack_base<S, V>{ typename stack_base<S, V>::frame_type(accounted_resource()), outer }, std::move(keep) };
+    const std::shared_ptr<memory_account>& account = current_account();
+    auto h = account ? std::allocate_shared<holder>(accounting_allocator<holder>{ account, 0 }, std::move(made))
+                     : std::make_shared<holder>(std::move(made));
+    std::shared_ptr<stack_base<S, V>> frame{ h, &h->frame };
+    frame->self = frame;
+    return frame;
+}
+
 }  // namespace lisp
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+namespace lisp
+{
+
+// Counts of the work done by evaluations on one thread. Each thread only touches its own counters, so the hot paths
+// increment them without synchronization.
+struct runtime_stats
+{
+    // Values built from a payload, and copies of existing values.
+    std::uint64_t values;
+    std::uint64_t value_copies;
+    // New string and array storage, and the bytes in it; copying a value shares its storage instead.
+    std::uint64_t strings;
+    std::uint64_t arrays;
+    std::uint64_t payload_bytes;
+    // Frames created for lambda calls.
+    std::uint64_t frames;
+    // Calls of builtins and lambdas.
+    std::uint64_t calls;
+    // Names in call forms looked up in the frames, and those found through the form's cache instead.
+    std::uint64_t lookups;
+    std::uint64_t cached_lookups;
+};
+
+runtime_stats operator-(const runtime_stats& lhs, const runtime_stats& rhs);
+
+// The calling thread's counters, for the instrumented code to increment.
+inline runtime_stats& thread_stats()
+{
+    thread_local runtime_stats instance = {};
+    return instance;
+}
+
+// A copy of the calling thread's counters; subtract two snapshots to measure a piece of work.
+runtime_stats stats_snapshot();
+
+void reset_stats();
+
+}  // namespace lisp
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace lisp
+{
+
+// Records spans of top-level evaluations and of calls that last at least `threshold`, for viewing as a timeline in
+// Perfetto or chrome://tracing. Each thread tracing into a tracer gets its own ring buffer of `capacity` spans, which
+// only that thread writes and which keeps the most recent spans once it is full. Call write_json once the traced work
+// has finished.
+class tracer
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    enum class span_kind
+    {
+        // A top-level evaluation; always recorded.
+        eval,
+        // A call of a builtin or lambda; recorded if it lasted at least the threshold.
+        call,
+    };
+
+    explicit tracer(clock::duration threshold = {}, std::size_t capacity = 16 * 1024);
+    ~tracer();
+
+    tracer(const tracer&) = delete;
+    tracer& operator=(const tracer&) = delete;
+
+    // Ends a span that started at `start`; `describe` produces its name and is only called if it is recorded.
+    template <class Describe>
+    void end(span_kind kind, clock::time_point start, Describe&& describe)
+    {
+        const clock::time_point finish = clock::now();
+        if (kind == span_kind::call && finish - start < m_threshold)
+        {
+            return;
+        }
+        record(kind, start, finish, describe());
+    }
+
+    // Writes the recorded spans as Chrome trace-event JSON.
+    void write_json(std::ostream& os) const;
+
+private:
+    static constexpr std::size_t max_name_size = 47;
+
+    // Fixed-size, so that recording a span does not allocate.
+    struct event
+    {
+        span_kind kind;
+        clock::time_point start;
+        clock::duration duration;
+        char name[max_name_size + 1];
+    };
+
+    struct ring
+    {
+        std::size_t thread;
+        std::vector<event> events;
+        // Published after the event is written, so a reader sees complete events.
+        std::atomic<std::uint64_t> written;
+    };
+
+    friend class tracer_scope;
+
+    void record(span_kind kind, clock::time_point start, clock::time_point finish, std::string_view name);
+    ring& thread_ring();
+    // The ring of the tracer in the innermost tracer_scope on this thread.
+    static ring*& scoped_ring();
+
+    clock::duration m_threshold;
+    std::size_t m_capacity;
+    clock::time_point m_origin;
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<ring>> m_rings;
+    std::unordered_map<std::thread::id, ring*> m_thread_rings;
+};
+
+// Makes `t` record the spans of evaluations on the calling thread for the scope's lifetime. The thread's ring buffer
+// is looked up or set up here rather than inside traced spans, so scopes of different tracers may nest.
+class tracer_scope
+{
+public:
+    explicit tracer_scope(tracer& t);
+    ~tracer_scope();
+
+    tracer_scope(const tracer_scope&) = delete;
+    tracer_scope& operator=(const tracer_scope&) = delete;
+
+private:
+    tracer* m_previous;
+    tracer::ring* m_previous_ring;
+};
+
+tracer* current_tracer();
+
+// Measures a span from construction to destruction, if a tracer is given.
+template <class Describe>
+class trace_span
+{
+public:
+    trace_span(tracer* t, tracer::span_kind kind, Describe describe)
+        : m_tracer{ t }
+        , m_kind{ kind }
+        , m_start{ t ? tracer::clock::now() : tracer::clock::time_point{} }
+        , m_describe{ std::move(describe) }
+    {
+    }
+
+    ~trace_span()
+    {
+        if (m_tracer)
+        {
+            m_tracer->end(m_kind, m_start, m_describe);
+        }
+    }
+
+    trace_span(const trace_span&) = delete;
+    trace_span& operator=(const trace_span&) = delete;
+
+private:
+    tracer* m_tracer;
+    tracer::span_kind m_kind;
+    tracer::clock::time_point m_start;
+    Describe m_describe;
+};
+
+}  // namespace lisp
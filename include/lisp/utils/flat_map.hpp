@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+// Map kept as a vector of pairs sorted by key. Lookups are a binary search over contiguous storage and, with a
+// small_vector underneath, a handful of entries need no allocation at all. Inserting shifts the entries after it and
+// invalidates iterators and references.
+template <class Key, class T, class Container = std::vector<std::pair<Key, T>>>
+class flat_map
+{
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<Key, T>;
+    using container_type = Container;
+    using size_type = typename Container::size_type;
+    using iterator = typename Container::iterator;
+    using const_iterator = typename Container::const_iterator;
+    using allocator_type = typename Container::allocator_type;
+
+    flat_map() = default;
+
+    explicit flat_map(const allocator_type& alloc) : m_items(alloc)
+    {
+    }
+
+    // Like std::map, the first of several entries with the same key wins.
+    flat_map(std::initializer_list<value_type> items, const allocator_type& alloc = {}) : m_items(items, alloc)
+    {
+        std::stable_sort(
+            std::begin(m_items),
+            std::end(m_items),
+            [](const value_type& lhs, const value_type& rhs) { return lhs.first < rhs.first; });
+        m_items.erase(
+            std::unique(
+                std::begin(m_items),
+                std::end(m_items),
+                [](const value_type& lhs, const value_type& rhs) { return !(lhs.first < rhs.first); }),
+            std::end(m_items));
+    }
+
+    iterator begin()
+    {
+        return m_items.begin();
+    }
+
+    iterator end()
+    {
+        return m_items.end();
+    }
+
+    const_iterator begin() const
+    {
+        return m_items.begin();
+    }
+
+    const_iterator end() const
+    {
+        return m_items.end();
+    }
+
+    size_type size() const
+    {
+        return m_items.size();
+    }
+
+    bool empty() const
+    {
+        return m_items.empty();
+    }
+
+    iterator find(const Key& key)
+    {
+        const iterator iter = lower_bound(key);
+        return iter != end() && !(key < iter->first) ? iter : end();
+    }
+
+    const_iterator find(const Key& key) const
+    {
+        const const_iterator iter = lower_bound(key);
+        return iter != end() && !(key < iter->first) ? iter : end();
+    }
+
+    size_type count(const Key& key) const
+    {
+        return find(key) != end() ? 1 : 0;
+    }
+
+    template <class U>
+    std::pair<iterator, bool> emplace(const Key& key, U&& item)
+    {
+        const iterator iter = lower_bound(key);
+        if (iter != end() && !(key < iter->first))
+        {
+            return { iter, false };
+        }
+        return { m_items.emplace(iter, key, std::forward<U>(item)), true };
+    }
+
+    template <class U>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, U&& item)
+    {
+        const auto [iter, inserted] = emplace(key, std::forward<U>(item));
+        if (!inserted)
+        {
+            iter->second = std::forward<U>(item);
+        }
+        return { iter, inserted };
+    }
+
+    T& operator[](const Key& key)
+    {
+        return emplace(key, T{}).first->second;
+    }
+
+    iterator erase(const_iterator pos)
+    {
+        return m_items.erase(pos);
+    }
+
+    void clear()
+    {
+        m_items.clear();
+    }
+
+private:
+    iterator lower_bound(const Key& key)
+    {
+        return std::lower_bound(
+            std::begin(m_items),
+            std::end(m_items),
+            key,
+            [](const value_type& item, const Key& k) { return item.first < k; });
+    }
+
+    const_iterator lower_bound(const Key& key) const
+    {
+        return std::lower_bound(
+            std::begin(m_items),
+            std::end(m_items),
+            key,
+            [](const value_type& item, const Key& k) { return item.first < k; });
+    }
+
+    Container m_items;
+};
@@ -120,7 +120,7 @@ struct iterator_range
     template <class Container>
     operator Container() const
     {
-        return Container{ begin(), end() };
+        return Container(begin(), end());
     }
 
     iterator begin() const
@@ -0,0 +1,389 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Vector that keeps up to N elements inline and only asks its memory resource for storage when it grows beyond
+// that. Like the std::pmr containers, copies use the default resource and the resource does not follow assignment.
+template <class T, std::size_t N>
+class small_vector
+{
+    static_assert(N > 0, "small_vector needs room for at least one inline element");
+
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = T&;
+    using const_reference = const T&;
+    using pointer = T*;
+    using const_pointer = const T*;
+    using iterator = T*;
+    using const_iterator = const T*;
+    using allocator_type = std::pmr::polymorphic_allocator<T>;
+
+    small_vector() : small_vector(allocator_type{})
+    {
+    }
+
+    explicit small_vector(const allocator_type& alloc)
+        : m_data{ inline_data() }
+        , m_size{ 0 }
+        , m_capacity{ N }
+        , m_alloc{ alloc }
+    {
+    }
+
+    explicit small_vector(size_type count, const allocator_type& alloc = {}) : small_vector(alloc)
+    {
+        resize(count);
+    }
+
+    template <class Iter, class = typename std::iterator_traits<Iter>::iterator_category>
+    small_vector(Iter first, Iter last, const allocator_type& alloc = {}) : small_vector(alloc)
+    {
+        insert(end(), first, last);
+    }
+
+    small_vector(std::initializer_list<T> items, const allocator_type& alloc = {})
+        : small_vector(items.begin(), items.end(), alloc)
+    {
+    }
+
+    small_vector(const small_vector& other) : small_vector(other.begin(), other.end())
+    {
+    }
+
+    small_vector(small_vector&& other) : small_vector(other.m_alloc)
+    {
+        take(other);
+    }
+
+    ~small_vector()
+    {
+        clear();
+        release();
+    }
+
+    small_vector& operator=(const small_vector& other)
+    {
+        if (this != &other)
+        {
+            clear();
+            insert(end(), other.begin(), other.end());
+        }
+        return *this;
+    }
+
+    small_vector& operator=(small_vector&& other)
+    {
+        if (this != &other)
+        {
+            clear();
+            take(other);
+        }
+        return *this;
+    }
+
+    allocator_type get_allocator() const
+    {
+        return m_alloc;
+    }
+
+    iterator begin()
+    {
+        return m_data;
+    }
+
+    iterator end()
+    {
+        return m_data + m_size;
+    }
+
+    const_iterator begin() const
+    {
+        return m_data;
+    }
+
+    const_iterator end() const
+    {
+        return m_data + m_size;
+    }
+
+    T* data()
+    {
+        return m_data;
+    }
+
+    const T* data() const
+    {
+        return m_data;
+    }
+
+    size_type size() const
+    {
+        return m_size;
+    }
+
+    size_type capacity() const
+    {
+        return m_capacity;
+    }
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    T& operator[](size_type index)
+    {
+        return m_data[index];
+    }
+
+    const T& operator[](size_type index) const
+    {
+        return m_data[index];
+    }
+
+    T& at(size_type index)
+    {
+        check_index(index);
+        return m_data[index];
+    }
+
+    const T& at(size_type index) const
+    {
+        check_index(index);
+        return m_data[index];
+    }
+
+    T& front()
+    {
+        return m_data[0];
+    }
+
+    const T& front() const
+    {
+        return m_data[0];
+    }
+
+    T& back()
+    {
+        return m_data[m_size - 1];
+    }
+
+    const T& back() const
+    {
+        return m_data[m_size - 1];
+    }
+
+    void reserve(size_type count)
+    {
+        if (count > m_capacity)
+        {
+            reallocate(count);
+        }
+    }
+
+    template <class... Args>
+    T& emplace_back(Args&&... args)
+    {
+        if (m_size == m_capacity)
+        {
+            // The arguments may refer to an element, so the new one is built before the old ones are moved.
+            const size_type new_capacity = std::max<size_type>(2 * m_capacity, 1);
+            T* new_data = allocate(new_capacity);
+            try
+            {
+                ::new (static_cast<void*>(new_data + m_size)) T(std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                m_alloc.deallocate(new_data, new_capacity);
+                throw;
+            }
+            move_into(new_data);
+            release();
+            m_data = new_data;
+            m_capacity = new_capacity;
+        }
+        else
+        {
+            ::new (static_cast<void*>(m_data + m_size)) T(std::forward<Args>(args)...);
+        }
+        return m_data[m_size++];
+    }
+
+    void push_back(const T& item)
+    {
+        emplace_back(item);
+    }
+
+    void push_back(T&& item)
+    {
+        emplace_back(std::move(item));
+    }
+
+    void pop_back()
+    {
+        m_data[--m_size].~T();
+    }
+
+    iterator insert(const_iterator pos, const T& item)
+    {
+        return emplace(pos, item);
+    }
+
+    iterator insert(const_iterator pos, T&& item)
+    {
+        return emplace(pos, std::move(item));
+    }
+
+    template <class... Args>
+    iterator emplace(const_iterator pos, Args&&... args)
+    {
+        const size_type index = pos - begin();
+        emplace_back(std::forward<Args>(args)...);
+        std::rotate(begin() + index, end() - 1, end());
+        return begin() + index;
+    }
+
+    template <class Iter, class = typename std::iterator_traits<Iter>::iterator_category>
+    iterator insert(const_iterator pos, Iter first, Iter last)
+    {
+        const size_type index = pos - begin();
+        const size_type old_size = m_size;
+        if constexpr (std::is_base_of_v<
+                          std::forward_iterator_tag,
+                          typename std::iterator_traits<Iter>::iterator_category>)
+        {
+            reserve(m_size + static_cast<size_type>(std::distance(first, last)));
+        }
+        for (; first != last; ++first)
+        {
+            emplace_back(*first);
+        }
+        std::rotate(begin() + index, begin() + old_size, end());
+        return begin() + index;
+    }
+
+    iterator erase(const_iterator pos)
+    {
+        return erase(pos, pos + 1);
+    }
+
+    iterator erase(const_iterator first, const_iterator last)
+    {
+        const iterator from = begin() + (first - begin());
+        const iterator to = begin() + (last - begin());
+        const iterator new_end = std::move(to, end(), from);
+        while (end() != new_end)
+        {
+            pop_back();
+        }
+        return from;
+    }
+
+    void resize(size_type count)
+    {
+        while (m_size > count)
+        {
+            pop_back();
+        }
+        reserve(count);
+        while (m_size < count)
+        {
+            emplace_back();
+        }
+    }
+
+    void clear()
+    {
+        while (m_size > 0)
+        {
+            pop_back();
+        }
+    }
+
+private:
+    T* inline_data()
+    {
+        return reinterpret_cast<T*>(m_inline);
+    }
+
+    bool is_inline() const
+    {
+        return m_data == reinterpret_cast<const T*>(m_inline);
+    }
+
+    T* allocate(size_type count)
+    {
+        return m_alloc.allocate(count);
+    }
+
+    void release()
+    {
+        if (!is_inline())
+        {
+            m_alloc.deallocate(m_data, m_capacity);
+            m_data = inline_data();
+            m_capacity = N;
+        }
+    }
+
+    // Moves the elements to uninitialized storage and destroys them here; the size stays the same.
+    void move_into(T* dest)
+    {
+        std::uninitialized_move(begin(), end(), dest);
+        std::destroy(begin(), end());
+    }
+
+    void reallocate(size_type new_capacity)
+    {
+        T* new_data = allocate(new_capacity);
+        move_into(new_data);
+        release();
+        m_data = new_data;
+        m_capacity = new_capacity;
+    }
+
+    // Takes over the other vector's elements, stealing its buffer when both share a resource. Expects to be empty.
+    void take(small_vector& other)
+    {
+        if (!other.is_inline() && m_alloc == other.m_alloc)
+        {
+            release();
+            m_data = std::exchange(other.m_data, other.inline_data());
+            m_size = std::exchange(other.m_size, 0);
+            m_capacity = std::exchange(other.m_capacity, N);
+            return;
+        }
+        reserve(other.m_size);
+        for (T& item : other)
+        {
+            emplace_back(std::move(item));
+        }
+        other.clear();
+    }
+
+    void check_index(size_type index) const
+    {
+        if (index >= m_size)
+        {
+            throw std::out_of_range{ "small_vector index out of range" };
+        }
+    }
+
+    T* m_data;
+    size_type m_size;
+    size_type m_capacity;
+    allocator_type m_alloc;
+    alignas(T) std::byte m_inline[N * sizeof(T)];
+};
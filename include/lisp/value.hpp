@@ -4,12 +4,19 @@
 #include <functional>
 #include <iostream>
 #include <lisp/category.hpp>
+#include <lisp/errors.hpp>
 #include <lisp/null.hpp>
+#include <lisp/profiler.hpp>
 #include <lisp/stack.hpp>
+#include <lisp/stats.hpp>
 #include <lisp/symbol.hpp>
+#include <lisp/tracer.hpp>
 #include <lisp/utils/box.hpp>
 #include <lisp/utils/container_utils.hpp>
 #include <lisp/utils/overload.hpp>
+#include <lisp/utils/small_vector.hpp>
+#include <memory>
+#include <memory_resource>
 #include <optional>
 #include <variant>
 
@@ -22,69 +29,237 @@ struct lambda_base
     using stack_type = stack_base<Symbol, Value>;
     Value params;
     Value body;
-    stack_type* stack;
+    const stack_type* stack;
 };
 
+// Callables are immutable and shared: copying one only bumps a reference count, however much state its function
+// carries.
 template <class Value>
-struct callable_base
+class callable_base
 {
-    using function_type = std::function<Value(const std::vector<Value>&)>;
-    function_type fn;
-    std::string name;
-    std::optional<std::size_t> arity;
-    std::vector<Value> bound_args;
+public:
+    // Argument lists are built in the evaluation's arena (see arena.hpp); most calls fit in the inline slots and do
+    // not allocate at all.
+    using arg_list = small_vector<Value, 4>;
+    using function_type = std::function<Value(const arg_list&)>;
+    // Formats a name from the callable's state; it is only called when the name is printed or reported in an error.
+    using name_function = std::string (*)(const callable_base&);
+    // Called with the function when a callable sharing the state goes away and leaves others, which may be all that
+    // keeps a reference cycle through the function alive.
+    using release_function = void (*)(const function_type&);
+
+    explicit callable_base(
+        function_type fn, std::string name, std::optional<int> arity = {}, release_function release = nullptr)
+        : m_state{ std::make_shared<const state>(
+            state{ std::move(fn), std::move(name), nullptr, to_arity(arity), {}, {}, release }) }
+    {
+    }
 
-    explicit callable_base(function_type fn, std::string name, std::optional<int> arity = {})
-        : fn{ std::move(fn) }
-        , name{ std::move(name) }
-        , arity{ arity }
-        , bound_args{}
+    explicit callable_base(
+        function_type fn, name_function name, std::optional<int> arity = {}, release_function release = nullptr)
+        : m_state{ std::make_shared<const state>(state{ std::move(fn), {}, name, to_arity(arity), {}, {}, release }) }
     {
     }
 
+    // Binds leading arguments to the function of `self`, replacing any that `self` had bound.
     explicit callable_base(const callable_base& self, std::vector<Value>&& bound_args)
-        : fn{ self.fn }
-        , name{ self.name }
-        , arity{ self.arity }
-        , bound_args(std::move(bound_args))
+        : m_state{ std::make_shared<const state>(
+            state{ {}, {}, nullptr, {}, std::move(bound_args), self.unbound(), nullptr }) }
     {
     }
 
-    Value call(const std::vector<Value>& args) const
+    callable_base(const callable_base&) = default;
+    callable_base(callable_base&&) noexcept = default;
+
+    // The state this one shared goes through the destructor of `other`.
+    callable_base& operator=(callable_base other) noexcept
     {
-        if (arity)
+        std::swap(m_state, other.m_state);
+        std::swap(m_unchecked, other.m_unchecked);
+        return *this;
+    }
+
+    ~callable_base()
+    {
+        if (m_state && m_state->release && m_state.use_count() > 1)
         {
-            std::vector<Value> all_args = concat(bound_args, args);
-            if (all_args.size() > *arity)
-            {
-                throw std::runtime_error{ str("Expected ", *arity, " arguments, got ", all_args.size()) };
-            }
-            else if (all_args.size() < *arity)
-            {
-                return callable_base{ *this, std::move(all_args) };
-            }
-            else
+            m_state->release(m_state->fn);
+        }
+        else if (m_state && m_state->target && m_state->target->release && m_state.use_count() == 1)
+        {
+            // The last callable to bind arguments to a function lets go of it as a copy of the function would.
+            const std::shared_ptr<const state> target = m_state->target;
+            m_state.reset();
+            if (target.use_count() > 1)
             {
-                return fn(all_args);
+                target->release(target->fn);
             }
         }
+    }
+
+    const function_type& fn() const
+    {
+        return target().fn;
+    }
+
+    std::string name() const
+    {
+        const state& t = target();
+        return t.format ? t.format(*this) : t.name;
+    }
+
+    std::optional<std::size_t> arity() const
+    {
+        return target().arity;
+    }
+
+    const std::vector<Value>& bound_args() const
+    {
+        return m_state->bound_args;
+    }
+
+    // An unbound callable named and released as this one is, calling `fn` instead; for a copy of the function.
+    callable_base with_function(function_type fn) const
+    {
+        const state& t = target();
+        callable_base result{ std::make_shared<const state>(
+            state{ std::move(fn), t.name, t.format, t.arity, {}, {}, t.release }) };
+        result.m_unchecked = m_unchecked;
+        return result;
+    }
+
+    // A copy for call sites shown to pass exactly arity() arguments, as optimize() does: calls through it go straight to
+    // the function, without binding arguments or checking their number. Callables without bound arguments and a fixed
+    // arity only.
+    callable_base unchecked() const
+    {
+        callable_base result = *this;
+        result.m_unchecked = m_state->bound_args.empty() && target().arity.has_value();
+        return result;
+    }
+
+    bool is_unchecked() const
+    {
+        return m_unchecked;
+    }
+
+    // How many callables share this one's state.
+    long use_count() const
+    {
+        return m_state.use_count();
+    }
+
+    Value call(const arg_list& args) const
+    {
+        const state& t = target();
+        if (m_unchecked)
+        {
+            return t.fn(args);
+        }
+        const std::vector<Value>& bound = m_state->bound_args;
+        if (bound.empty() && (!t.arity || args.size() == *t.arity))
+        {
+            return t.fn(args);
+        }
+        arg_list all_args(args.get_allocator());
+        all_args.reserve(bound.size() + args.size());
+        all_args.insert(all_args.end(), bound.begin(), bound.end());
+        all_args.insert(all_args.end(), args.begin(), args.end());
+        if (!t.arity)
+        {
+            return t.fn(all_args);
+        }
+        if (all_args.size() > *t.arity)
+        {
+            throw std::runtime_error{ str("Expected ", *t.arity, " arguments, got ", all_args.size()) };
+        }
+        else if (all_args.size() < *t.arity)
+        {
+            // Bound arguments outlive the call, so they are copied out of the arena.
+            return callable_base{ *this, std::vector<Value>(all_args.begin(), all_args.end()) };
+        }
         else
         {
-            return fn(args);
+            return t.fn(all_args);
         }
     }
 
-    Value operator()(const std::vector<Value>& args) const
+    Value operator()(const arg_list& args) const
+    {
+        ++thread_stats().calls;
+        profiler* const profile = current_profiler();
+        tracer* const trace = current_tracer();
+        if (profile || trace)
+        {
+            return instrumented_call(args, profile, trace);
+        }
+        return checked_call(args);
+    }
+
+private:
+    // A callable with bound arguments keeps no function of its own and forwards to the unbound callable it was made
+    // from, so binding does not copy the function.
+    struct state
+    {
+        function_type fn;
+        std::string name;
+        name_function format;
+        std::optional<std::size_t> arity;
+        std::vector<Value> bound_args;
+        std::shared_ptr<const state> target;
+        release_function release;
+    };
+
+    explicit callable_base(std::shared_ptr<const state> s) : m_state{ std::move(s) }
+    {
+    }
+
+    // Reports errors with the name of the callable; limits pass through unchanged.
+    Value checked_call(const arg_list& args) const
     {
         try
         {
             return call(args);
         }
+        catch (const limit_exceeded&)
+        {
+            throw;
+        }
         catch (const std::exception& ex)
         {
-            throw std::runtime_error{ str("On calling ", name, ": ", ex.what()) };
+            throw std::runtime_error{ str("On calling ", name(), ": ", ex.what()) };
+        }
+    }
+
+    // Kept out of operator() so that uninstrumented calls do not pay for its stack frame.
+    [[gnu::noinline]] Value instrumented_call(const arg_list& args, profiler* profile, tracer* trace) const
+    {
+        if (profile)
+        {
+            profile->enter(unbound(), [this]() { return name(); });
         }
+        const profiler_exit profiled{ profile };
+        const trace_span traced{ trace, tracer::span_kind::call, [this]() { return name(); } };
+        return checked_call(args);
+    }
+
+    static std::optional<std::size_t> to_arity(std::optional<int> arity)
+    {
+        return arity ? std::optional<std::size_t>{ *arity } : std::nullopt;
+    }
+
+    const state& target() const
+    {
+        return m_state->target ? *m_state->target : *m_state;
+    }
+
+    std::shared_ptr<const state> unbound() const
+    {
+        return m_state->target ? m_state->target : m_state;
     }
+
+    std::shared_ptr<const state> m_state;
+    bool m_unchecked = false;
 };
 
 class value
@@ -114,7 +289,11 @@ public:
     value(callable_type v);
     value(lambda_type v);
 
-    value(const value&) = default;
+    value(const value& other) : m_data{ other.m_data }
+    {
+        ++thread_stats().value_copies;
+    }
+
     value(value&&) = default;
 
     value& operator=(const value& other);
@@ -146,17 +325,22 @@ public:
     friend std::ostream& operator<<(std::ostream& os, const value& item);
 
 private:
+    // Strings and arrays are immutable once built and shared between copies; the reference count is atomic, so a
+    // value can be handed to another thread without copying its contents.
     using variant_type = std::variant<
         null_type,
-        string_type,
+        std::shared_ptr<const string_type>,
         symbol_type,
         integer_type,
         floating_point_type,
         boolean_type,
-        array_type,
+        std::shared_ptr<const array_type>,
         callable_type,
         box<lambda_type>>;
 
+    // Gives the operators in value.cpp the held alternative.
+    friend struct value_access;
+
     variant_type m_data;
 };
 
@@ -175,6 +359,7 @@ bool operator>=(const value& lhs, const value& rhs);
 
 using array = value::array_type;
 using callable = value::callable_type;
+using arg_list = callable::arg_list;
 using stack_type = stack_base<value::symbol_type, value>;
 
 }  // namespace lisp
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <lisp/arena.hpp>
+
+namespace lisp
+{
+
+namespace
+{
+
+thread_local arena* active_arena = nullptr;
+
+arena& thread_arena()
+{
+    thread_local arena instance;
+    return instance;
+}
+
+}  // namespace
+
+arena::arena(std::size_t initial_size)
+    : m_buffer(initial_size)
+    , m_heap{}
+    , m_upstream{ m_buffer.data(), m_buffer.size(), &m_heap }
+    , m_pool{ &m_upstream }
+{
+}
+
+std::pmr::memory_resource* arena::resource()
+{
+    return &m_pool;
+}
+
+void arena::release()
+{
+    m_pool.release();
+    m_upstream.release();
+}
+
+void* arena::accounted_heap::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    const auto& account = current_account();
+    if (account)
+    {
+        account->allocate(bytes);
+    }
+    void* ptr = nullptr;
+    try
+    {
+        ptr = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    catch (...)
+    {
+        if (account)
+        {
+            account->deallocate(bytes);
+        }
+        throw;
+    }
+    if (account)
+    {
+        m_chunks.push_back(chunk{ ptr, bytes, account });
+    }
+    return ptr;
+}
+
+void arena::accounted_heap::do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment)
+{
+    std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+    const auto iter = std::find_if(m_chunks.rbegin(), m_chunks.rend(), [&](const chunk& c) { return c.ptr == ptr; });
+    if (iter != m_chunks.rend())
+    {
+        iter->account->deallocate(iter->bytes);
+        m_chunks.erase(std::next(iter).base());
+    }
+}
+
+bool arena::accounted_heap::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+    return this == &other;
+}
+
+arena_scope::arena_scope() : m_owner{ active_arena == nullptr }
+{
+    if (m_owner)
+    {
+        active_arena = &thread_arena();
+    }
+}
+
+arena_scope::~arena_scope()
+{
+    if (m_owner)
+    {
+        active_arena->release();
+        active_arena = nullptr;
+    }
+}
+
+bool arena_scope::outermost() const
+{
+    return m_owner;
+}
+
+std::pmr::memory_resource* current_resource()
+{
+    return active_arena ? active_arena->resource() : std::pmr::get_default_resource();
+}
+
+}  // namespace lisp
@@ -0,0 +1,496 @@
+#include <lisp/batch.hpp>
+#include <lisp/evaluate.hpp>
+#include <lisp/functions.hpp>
+#include <lisp/prepare.hpp>
+#include <lisp/special_forms.hpp>
+#include <numeric>
+
+namespace lisp
+{
+
+column::column() : m_data{ value_vector{} }
+{
+}
+
+column::column(integer_vector v) : m_data{ std::move(v) }
+{
+}
+
+column::column(floating_point_vector v) : m_data{ std::move(v) }
+{
+}
+
+column::column(boolean_vector v) : m_data{ std::move(v) }
+{
+}
+
+column::column(value_vector v) : m_data{ std::move(v) }
+{
+}
+
+column column::from_values(value_vector v)
+{
+    const auto all = [&](auto pred) { return !v.empty() && std::all_of(std::begin(v), std::end(v), pred); };
+    if (all([](const value& item) { return item.is_integer(); }))
+    {
+        integer_vector result(v.size());
+        std::transform(std::begin(v), std::end(v), std::begin(result), std::mem_fn(&value::as_integer));
+        return result;
+    }
+    if (all([](const value& item) { return item.is_floating_point(); }))
+    {
+        floating_point_vector result(v.size());
+        std::transform(std::begin(v), std::end(v), std::begin(result), std::mem_fn(&value::as_floating_point));
+        return result;
+    }
+    if (all([](const value& item) { return item.is_boolean(); }))
+    {
+        boolean_vector result(v.size());
+        std::transform(std::begin(v), std::end(v), std::begin(result), std::mem_fn(&value::as_boolean));
+        return result;
+    }
+    return v;
+}
+
+column column::scalar(const value& v)
+{
+    return from_values(value_vector{ v });
+}
+
+std::size_t column::size() const
+{
+    return std::visit([](const auto& v) { return v.size(); }, m_data);
+}
+
+value column::at(std::size_t row) const
+{
+    return std::visit(
+        overload{ [&](const integer_vector& v) { return value{ v[row] }; },
+                  [&](const floating_point_vector& v) { return value{ v[row] }; },
+                  [&](const boolean_vector& v) { return value{ static_cast<value::boolean_type>(v[row]) }; },
+                  [&](const value_vector& v) { return v[row]; } },
+        m_data);
+}
+
+array column::to_array() const
+{
+    array result;
+    result.reserve(size());
+    for (std::size_t i = 0; i < size(); ++i)
+    {
+        result.push_back(at(i));
+    }
+    return result;
+}
+
+const column::data_type& column::data() const
+{
+    return m_data;
+}
+
+column::data_type& column::data()
+{
+    return m_data;
+}
+
+namespace
+{
+
+using rows_type = std::vector<std::size_t>;
+
+struct batch_context
+{
+    const std::vector<symbol>& params;
+    std::vector<column> columns;
+    std::size_t rows;
+    const stack_type* globals;
+};
+
+// Row `i` of a column that may be broadcast from a single value.
+std::size_t row_of(const column& c, std::size_t i)
+{
+    return c.size() == 1 ? 0 : i;
+}
+
+column gather(const column& c, const rows_type& rows)
+{
+    if (c.size() == 1)
+    {
+        return c;
+    }
+    return std::visit(
+        [&](const auto& v) -> column
+        {
+            std::decay_t<decltype(v)> result(rows.size());
+            for (std::size_t i = 0; i < rows.size(); ++i)
+            {
+                result[i] = v[rows[i]];
+            }
+            return result;
+        },
+        c.data());
+}
+
+batch_context subset(const batch_context& ctx, const rows_type& rows)
+{
+    batch_context result{ ctx.params, {}, rows.size(), ctx.globals };
+    result.columns.reserve(ctx.columns.size());
+    for (const column& c : ctx.columns)
+    {
+        result.columns.push_back(gather(c, rows));
+    }
+    return result;
+}
+
+// Writes the rows of `part` into `out` at positions `rows`. `out` stays unboxed while every part has its type.
+void scatter(column& out, const column& part, const rows_type& rows)
+{
+    const bool same_type = out.data().index() == part.data().index();
+    if (!same_type)
+    {
+        column::value_vector boxed = out.to_array();
+        out = column{ std::move(boxed) };
+    }
+    std::visit(
+        [&](auto& target)
+        {
+            using vector_type = std::decay_t<decltype(target)>;
+            for (std::size_t i = 0; i < rows.size(); ++i)
+            {
+                if constexpr (std::is_same_v<vector_type, column::value_vector>)
+                {
+                    target[rows[i]] = part.at(row_of(part, i));
+                }
+                else
+                {
+                    target[rows[i]] = std::get<vector_type>(part.data())[row_of(part, i)];
+                }
+            }
+        },
+        out.data());
+}
+
+// An output column of `rows` rows with the same representation as `like`.
+column allocate_like(const column& like, std::size_t rows)
+{
+    return std::visit([&](const auto& v) -> column { return std::decay_t<decltype(v)>(rows); }, like.data());
+}
+
+column broadcast(const column& c, std::size_t rows)
+{
+    return std::visit([&](const auto& v) -> column { return std::decay_t<decltype(v)>(rows, v[0]); }, c.data());
+}
+
+column evaluate_rows(const value& expr, const batch_context& ctx)
+{
+    const prepared fn{ expr, ctx.params, ctx.globals };
+    column::value_vector result;
+    result.reserve(ctx.rows);
+    std::vector<value> args(ctx.columns.size());
+    for (std::size_t i = 0; i < ctx.rows; ++i)
+    {
+        for (std::size_t p = 0; p < args.size(); ++p)
+        {
+            args[p] = ctx.columns[p].at(row_of(ctx.columns[p], i));
+        }
+        result.push_back(fn.call(args));
+    }
+    return column::from_values(std::move(result));
+}
+
+column call_rows(const callable& fn, const std::vector<column>& args, std::size_t rows)
+{
+    column::value_vector result;
+    result.reserve(rows);
+    arg_list row_args(args.size());
+    for (std::size_t i = 0; i < rows; ++i)
+    {
+        for (std::size_t a = 0; a < args.size(); ++a)
+        {
+            row_args[a] = args[a].at(row_of(args[a], i));
+        }
+        result.push_back(fn(row_args));
+    }
+    return column::from_values(std::move(result));
+}
+
+template <class T>
+using storage_t = std::conditional_t<std::is_same_v<T, bool>, std::uint8_t, T>;
+
+template <class Op, class L, class R>
+column typed_kernel(Op op, const std::vector<L>& lhs, const std::vector<R>& rhs, std::size_t rows)
+{
+    using result_type = decltype(op(lhs[0], rhs[0]));
+    std::vector<storage_t<result_type>> result(rows);
+    const std::size_t ls = lhs.size() == 1 ? 0 : 1;
+    const std::size_t rs = rhs.size() == 1 ? 0 : 1;
+    for (std::size_t i = 0; i < rows; ++i)
+    {
+        result[i] = op(lhs[i * ls], rhs[i * rs]);
+    }
+    return result;
+}
+
+template <class Op>
+constexpr bool is_arithmetic_op = std::is_same_v<Op, std::plus<>> || std::is_same_v<Op, std::minus<>>
+                                  || std::is_same_v<Op, std::multiplies<>> || std::is_same_v<Op, std::divides<>>;
+
+template <class Op>
+constexpr bool is_ordering_op = std::is_same_v<Op, std::less<>> || std::is_same_v<Op, std::less_equal<>>
+                                || std::is_same_v<Op, std::greater<>> || std::is_same_v<Op, std::greater_equal<>>;
+
+template <class Op>
+constexpr bool is_equality_op = std::is_same_v<Op, std::equal_to<>> || std::is_same_v<Op, std::not_equal_to<>>;
+
+// Mirrors the type pairs that the scalar operators on value accept, so both paths agree on every row.
+template <class Op, class L, class R>
+constexpr bool has_kernel()
+{
+    using I = value::integer_type;
+    using F = value::floating_point_type;
+    using B = std::uint8_t;
+    constexpr bool mixed_numeric
+        = (std::is_same_v<L, I> && std::is_same_v<R, I>) || (std::is_same_v<L, I> && std::is_same_v<R, F>)
+          || (std::is_same_v<L, F> && std::is_same_v<R, I>);
+    if constexpr (is_arithmetic_op<Op> || is_ordering_op<Op>)
+    {
+        return mixed_numeric;
+    }
+    else if constexpr (std::is_same_v<Op, std::modulus<>>)
+    {
+        return std::is_same_v<L, I> && std::is_same_v<R, I>;
+    }
+    else if constexpr (is_equality_op<Op>)
+    {
+        return std::is_same_v<L, R> && (std::is_same_v<L, I> || std::is_same_v<L, F> || std::is_same_v<L, B>);
+    }
+    else
+    {
+        return false;
+    }
+}
+
+template <class Op>
+std::optional<column> try_kernel(const column& lhs, const column& rhs, std::size_t rows)
+{
+    return std::visit(
+        [&](const auto& l, const auto& r) -> std::optional<column>
+        {
+            using L = typename std::decay_t<decltype(l)>::value_type;
+            using R = typename std::decay_t<decltype(r)>::value_type;
+            if constexpr (has_kernel<Op, L, R>())
+            {
+                return typed_kernel(Op{}, l, r, rows);
+            }
+            else if constexpr (is_equality_op<Op> && !std::is_same_v<L, value> && !std::is_same_v<R, value>)
+            {
+                // Values of different categories never compare equal.
+                return column{ column::boolean_vector(rows, std::is_same_v<Op, std::not_equal_to<>>) };
+            }
+            else
+            {
+                return {};
+            }
+        },
+        lhs.data(),
+        rhs.data());
+}
+
+template <class... Ops>
+std::optional<column> dispatch_kernel(const callable& fn, const column& lhs, const column& rhs, std::size_t rows)
+{
+    std::optional<column> result;
+    ((!result && fn.fn().target<binary<Ops>>() ? (void)(result = try_kernel<Ops>(lhs, rhs, rows)) : void()), ...);
+    return result;
+}
+
+value::boolean_type is_true(const column& c, std::size_t row)
+{
+    return static_cast<bool>(c.at(row));
+}
+
+class batch_evaluator
+{
+public:
+    column operator()(const value& expr, const batch_context& ctx) const
+    {
+        if (expr.is_symbol())
+        {
+            return symbol_column(expr.as_symbol(), ctx);
+        }
+        if (!expr.is_array())
+        {
+            return column::scalar(expr);
+        }
+        const auto& a = expr.as_array();
+        if (a.empty())
+        {
+            return evaluate_rows(expr, ctx);
+        }
+        if (a.size() == 2 && a[0] == sym_quote)
+        {
+            return column::scalar(a[1]);
+        }
+        if (a.size() == 4 && a[0] == sym_if)
+        {
+            return if_column(a, ctx);
+        }
+        if (a[0] == sym_cond)
+        {
+            return cond_column(a, ctx);
+        }
+        if (a[0].is_symbol() && (is_special_form(a[0].as_symbol()) || is_param(a[0].as_symbol(), ctx)))
+        {
+            return evaluate_rows(expr, ctx);
+        }
+        if (!a[0].is_symbol())
+        {
+            return evaluate_rows(expr, ctx);
+        }
+        return call_column(ctx.globals->get(a[0].as_symbol()), a, ctx);
+    }
+
+private:
+    static bool is_param(const symbol& s, const batch_context& ctx)
+    {
+        return std::find(std::begin(ctx.params), std::end(ctx.params), s) != std::end(ctx.params);
+    }
+
+    static column symbol_column(const symbol& s, const batch_context& ctx)
+    {
+        const auto iter = std::find(std::begin(ctx.params), std::end(ctx.params), s);
+        if (iter != std::end(ctx.params))
+        {
+            return ctx.columns[iter - std::begin(ctx.params)];
+        }
+        return column::scalar(ctx.globals->get(s));
+    }
+
+    column call_column(const value& op, const array& a, const batch_context& ctx) const
+    {
+        std::vector<column> args;
+        args.reserve(a.size() - 1);
+        for (std::size_t i = 1; i < a.size(); ++i)
+        {
+            args.push_back((*this)(a[i], ctx));
+        }
+        const auto& fn = op.as_callable();
+        if (args.size() == 2 && fn.bound_args().empty())
+        {
+            const auto result = dispatch_kernel<
+                std::plus<>,
+                std::minus<>,
+                std::multiplies<>,
+                std::divides<>,
+                std::modulus<>,
+                std::equal_to<>,
+                std::not_equal_to<>,
+                std::less<>,
+                std::less_equal<>,
+                std::greater<>,
+                std::greater_equal<>>(fn, args[0], args[1], ctx.rows);
+            if (result)
+            {
+                return *result;
+            }
+        }
+        return call_rows(fn, args, ctx.rows);
+    }
+
+    column if_column(const array& a, const batch_context& ctx) const
+    {
+        const column test = (*this)(a[1], ctx);
+        if (test.size() == 1)
+        {
+            return (*this)(test.at(0).as_boolean() ? a[2] : a[3], ctx);
+        }
+        rows_type taken;
+        rows_type skipped;
+        for (std::size_t i = 0; i < ctx.rows; ++i)
+        {
+            (test.at(i).as_boolean() ? taken : skipped).push_back(i);
+        }
+        return merge({ { taken, a[2] }, { skipped, a[3] } }, ctx);
+    }
+
+    column cond_column(const array& a, const batch_context& ctx) const
+    {
+        std::vector<std::pair<rows_type, value>> branches;
+        rows_type remaining(ctx.rows);
+        std::iota(std::begin(remaining), std::end(remaining), std::size_t{ 0 });
+        for (std::size_t c = 1; c < a.size() && !remaining.empty(); ++c)
+        {
+            const auto& pair = a[c].as_array();
+            if (pair.size() != 2)
+            {
+                throw std::runtime_error{ "cond: a list of pairs required" };
+            }
+            const column test = (*this)(pair[0], subset(ctx, remaining));
+            rows_type taken;
+            rows_type rest;
+            for (std::size_t i = 0; i < remaining.size(); ++i)
+            {
+                (is_true(test, row_of(test, i)) ? taken : rest).push_back(remaining[i]);
+            }
+            branches.emplace_back(std::move(taken), pair[1]);
+            remaining = std::move(rest);
+        }
+        if (!remaining.empty())
+        {
+            throw std::runtime_error{ "cond: no match found" };
+        }
+        return merge(branches, ctx);
+    }
+
+    // Evaluates each branch on its own rows only and assembles the results in row order.
+    column merge(const std::vector<std::pair<rows_type, value>>& branches, const batch_context& ctx) const
+    {
+        std::optional<column> result;
+        for (const auto& [rows, expr] : branches)
+        {
+            if (rows.empty())
+            {
+                continue;
+            }
+            const column part = (*this)(expr, subset(ctx, rows));
+            if (!result)
+            {
+                result = allocate_like(part, ctx.rows);
+            }
+            scatter(*result, part, rows);
+        }
+        return result ? *result : column{};
+    }
+};
+
+}  // namespace
+
+column evaluate_batch(
+    const value& expr,
+    const std::vector<symbol>& params,
+    const std::vector<column>& columns,
+    const stack_type* globals)
+{
+    if (columns.size() != params.size())
+    {
+        throw std::runtime_error{ str("Expected ", params.size(), " columns, got ", columns.size()) };
+    }
+    std::size_t rows = 1;
+    for (const column& c : columns)
+    {
+        if (c.size() != 1 && rows != 1 && c.size() != rows)
+        {
+            throw std::runtime_error{ str("Column sizes differ: ", rows, " and ", c.size()) };
+        }
+        rows = c.size() != 1 ? c.size() : rows;
+    }
+    const column result = batch_evaluator{}(expand(expr, *globals), batch_context{ params, columns, rows, globals });
+    // A result that does not depend on any column is broadcast to every row.
+    if (result.size() == 1 && rows != 1)
+    {
+        return broadcast(result, rows);
+    }
+    return result;
+}
+
+}  // namespace lisp
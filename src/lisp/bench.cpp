@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <lisp/bench.hpp>
+#include <lisp/stats.hpp>
+#include <vector>
+
+#ifdef __linux__
+#include <time.h>
+#else
+#include <ctime>
+#endif
+
+namespace lisp
+{
+
+namespace
+{
+
+// Long enough for the clock's resolution and the cost of reading it not to matter.
+constexpr bench_clock::duration sample_time = std::chrono::microseconds{ 10 };
+
+std::chrono::nanoseconds cpu_now()
+{
+#ifdef __linux__
+    timespec ts = {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds{ ts.tv_sec } + std::chrono::nanoseconds{ ts.tv_nsec };
+#else
+    return std::chrono::nanoseconds{ static_cast<std::int64_t>(1e9 * std::clock() / CLOCKS_PER_SEC) };
+#endif
+}
+
+}  // namespace
+
+bench_result bench(const std::function<void()>& run, const bench_options& options)
+{
+    std::uint64_t warmup_runs = 0;
+    const bench_clock::time_point warmup_start = bench_clock::now();
+    bench_clock::duration warmup_elapsed = {};
+    do
+    {
+        run();
+        ++warmup_runs;
+        warmup_elapsed = bench_clock::now() - warmup_start;
+    } while (warmup_elapsed < options.warmup);
+
+    const bench_clock::duration estimate = warmup_elapsed / warmup_runs;
+    const std::uint64_t batch
+        = estimate.count() > 0 ? std::max<std::uint64_t>(1, sample_time / estimate) : std::uint64_t{ 1 } << 10;
+
+    std::vector<bench_clock::duration> samples;
+    const runtime_stats before = stats_snapshot();
+    const bench_clock::time_point start = bench_clock::now();
+    bench_clock::duration elapsed = {};
+    while (samples.empty()
+           || (elapsed < options.max_time && (elapsed < options.min_time || samples.size() < options.min_samples)))
+    {
+        const bench_clock::time_point batch_start = bench_clock::now();
+        for (std::uint64_t i = 0; i < batch; ++i)
+        {
+            run();
+        }
+        const bench_clock::time_point batch_end = bench_clock::now();
+        samples.push_back((batch_end - batch_start) / batch);
+        elapsed = batch_end - start;
+    }
+    const runtime_stats used = stats_snapshot() - before;
+
+    const std::uint64_t runs = batch * samples.size();
+    std::sort(std::begin(samples), std::end(samples));
+    const std::size_t p99 = std::min(samples.size() - 1, samples.size() * 99 / 100);
+    return bench_result{ runs,
+                         samples.size(),
+                         samples[samples.size() / 2],
+                         samples[p99],
+                         elapsed / runs,
+                         samples.front(),
+                         static_cast<double>(used.strings + used.arrays) / runs,
+                         static_cast<double>(used.payload_bytes) / runs };
+}
+
+time_result time_once(const std::function<void()>& run)
+{
+    const std::chrono::nanoseconds cpu_start = cpu_now();
+    const bench_clock::time_point start = bench_clock::now();
+    run();
+    return time_result{ bench_clock::now() - start, cpu_now() - cpu_start };
+}
+
+}  // namespace lisp
@@ -0,0 +1,80 @@
+#include <lisp/budget.hpp>
+#include <lisp/utils/string_utils.hpp>
+
+namespace lisp
+{
+
+namespace
+{
+
+thread_local budget* active_budget = nullptr;
+
+}  // namespace
+
+budget::budget(std::optional<std::uint64_t> steps, std::optional<clock::duration> timeout)
+    : m_fuel{ steps }
+    , m_deadline{ timeout ? std::optional<clock::time_point>{ clock::now() + *timeout } : std::nullopt }
+    , m_used{ 0 }
+    , m_chunk{ 1 }
+    , m_countdown{ 1 }
+{
+    // A first chunk of one step makes the first tick check the limits and pick the real chunk size.
+}
+
+std::optional<std::uint64_t> budget::remaining() const
+{
+    if (!m_fuel)
+    {
+        return {};
+    }
+    return *m_fuel - std::min(*m_fuel, used());
+}
+
+std::uint64_t budget::used() const
+{
+    return m_used + m_chunk - m_countdown;
+}
+
+std::optional<budget::clock::time_point> budget::deadline() const
+{
+    return m_deadline;
+}
+
+void budget::check()
+{
+    m_used += m_chunk;
+    if (m_fuel && m_used > *m_fuel)
+    {
+        m_chunk = m_countdown = 1;
+        throw budget_exceeded{ str("Step budget of ", *m_fuel, " exhausted") };
+    }
+    if (m_deadline && clock::now() >= *m_deadline)
+    {
+        m_chunk = m_countdown = 1;
+        throw budget_exceeded{ "Deadline exceeded" };
+    }
+    m_chunk = check_interval;
+    if (m_fuel)
+    {
+        // Stop exactly one step past the fuel so that the last allowed step still succeeds.
+        m_chunk = std::min(m_chunk, *m_fuel - m_used + 1);
+    }
+    m_countdown = m_chunk;
+}
+
+budget_scope::budget_scope(budget& limits) : m_previous{ active_budget }
+{
+    active_budget = &limits;
+}
+
+budget_scope::~budget_scope()
+{
+    active_budget = m_previous;
+}
+
+budget* current_budget()
+{
+    return active_budget;
+}
+
+}  // namespace lisp
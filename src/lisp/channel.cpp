@@ -0,0 +1,99 @@
+#include <lisp/channel.hpp>
+#include <lisp/evaluate.hpp>
+#include <unordered_set>
+
+namespace lisp
+{
+
+namespace
+{
+
+struct channel_registry
+{
+    std::mutex mutex;
+    std::unordered_set<channel*> channels;
+};
+
+// Never destroyed, so that threads still running at exit can use it.
+channel_registry& registry()
+{
+    static channel_registry* const instance = new channel_registry{};
+    return *instance;
+}
+
+}  // namespace
+
+channel::channel(std::size_t capacity) : m_queue{}, m_capacity{ capacity }, m_closed{ false }
+{
+    if (m_capacity == 0)
+    {
+        throw std::runtime_error{ "channel capacity must be positive" };
+    }
+    const std::lock_guard lock{ registry().mutex };
+    registry().channels.insert(this);
+}
+
+channel::~channel()
+{
+    const std::lock_guard lock{ registry().mutex };
+    registry().channels.erase(this);
+}
+
+void channel::send(value v)
+{
+    // Copied while the frames that closures in it keep are this thread's alone (see transfer()).
+    value sent = transfer(v);
+    {
+        std::unique_lock lock{ m_mutex };
+        m_not_full.wait(lock, [&]() { return m_closed || m_queue.size() < m_capacity; });
+        if (m_closed)
+        {
+            throw std::runtime_error{ "send on closed channel" };
+        }
+        m_queue.push_back(std::move(sent));
+    }
+    m_not_empty.notify_one();
+}
+
+std::optional<value> channel::recv()
+{
+    std::optional<value> result;
+    {
+        std::unique_lock lock{ m_mutex };
+        m_not_empty.wait(lock, [&]() { return m_closed || !m_queue.empty(); });
+        if (m_queue.empty())
+        {
+            return {};
+        }
+        result = std::move(m_queue.front());
+        m_queue.pop_front();
+    }
+    m_not_full.notify_one();
+    return result;
+}
+
+void channel::close()
+{
+    {
+        std::lock_guard lock{ m_mutex };
+        m_closed = true;
+    }
+    m_not_full.notify_all();
+    m_not_empty.notify_all();
+}
+
+void channel::close_all()
+{
+    const std::lock_guard lock{ registry().mutex };
+    for (channel* chan : registry().channels)
+    {
+        chan->close();
+    }
+}
+
+value channel_handle::operator()(const arg_list&) const
+{
+    return chan->recv().value_or(value{});
+}
+
+}  // namespace lisp
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <lisp/closure.hpp>
+#include <lisp/inline_cache.hpp>
+#include <lisp/special_forms.hpp>
+#include <memory>
+
+namespace lisp
+{
+
+namespace
+{
+
+void sort_unique(std::vector<symbol>& names)
+{
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+}
+
+class analysis
+{
+public:
+    explicit analysis(closure_info& info) : m_info{ info }
+    {
+    }
+
+    void operator()(const value& expr)
+    {
+        if (expr.is_symbol())
+        {
+            if (!is_special_form(expr.as_symbol()))
+            {
+                m_info.free.push_back(expr.as_symbol());
+            }
+            return;
+        }
+        if (!expr.is_array() || expr.as_array().empty())
+        {
+            return;
+        }
+        const array& a = expr.as_array();
+        if (a[0] == sym_quote)
+        {
+            return;
+        }
+        // A nested lambda binds in frames of its own, so it only adds the names it uses from outside.
+        if (is_lambda(expr))
+        {
+            const closure_info& nested = closure_info::of(expr);
+            m_info.free.insert(m_info.free.end(), nested.free.begin(), nested.free.end());
+            m_info.closed.insert(m_info.closed.end(), nested.free.begin(), nested.free.end());
+            return;
+        }
+        // A lambda applied in place makes no closure, but its frame is over this one.
+        if (is_lambda(a[0]))
+        {
+            const closure_info& nested = closure_info::of(a[0]);
+            m_info.free.insert(m_info.free.end(), nested.free.begin(), nested.free.end());
+            m_info.closed.insert(m_info.closed.end(), nested.closed.begin(), nested.closed.end());
+            m_info.shared = m_info.shared || nested.shared;
+            for (std::size_t i = 1; i < a.size(); ++i)
+            {
+                (*this)(a[i]);
+            }
+            return;
+        }
+        if (a.size() == 3 && a[0] == sym_loop && a[1].is_array())
+        {
+            m_info.shared = m_info.shared || closure_info::of(expr).shared;
+        }
+        if (a.size() == 3 && a[0] == sym_let && a[1].is_symbol())
+        {
+            m_info.assigned.push_back(a[1].as_symbol());
+            (*this)(a[2]);
+            return;
+        }
+        // dotimes and doseq bind their name in the frame they run in, as let does.
+        if ((a[0] == sym_dotimes || a[0] == sym_doseq) && a.size() > 1 && a[1].is_array() && a[1].as_array().size() == 2
+            && a[1].as_array()[0].is_symbol())
+        {
+            m_info.assigned.push_back(a[1].as_array()[0].as_symbol());
+        }
+        for (const value& item : a)
+        {
+            (*this)(item);
+        }
+    }
+
+private:
+    static bool is_lambda(const value& expr)
+    {
+        return expr.is_array() && expr.as_array().size() == 3 && expr.as_array()[0] == sym_lambda
+            && expr.as_array()[1].is_array();
+    }
+
+    closure_info& m_info;
+};
+
+}  // namespace
+
+const closure_info& closure_info::of(const value& form)
+{
+    // Loop forms have (name init) pairs in place of parameters; only what their body binds is of use.
+    const closure_slot& slot = static_cast<const array_storage&>(form.as_array()).closure;
+    if (const closure_info* info = slot.m_info.load(std::memory_order_acquire))
+    {
+        return *info;
+    }
+
+    auto info = std::make_unique<closure_info>();
+    analysis{ *info }(form.as_array()[2]);
+    sort_unique(info->free);
+    sort_unique(info->assigned);
+    sort_unique(info->closed);
+    for (const symbol& name : info->closed)
+    {
+        info->shared = info->shared || std::binary_search(info->assigned.begin(), info->assigned.end(), name);
+    }
+    for (const value& param : form.as_array()[1].as_array())
+    {
+        if (param.is_symbol())
+        {
+            const auto iter = std::lower_bound(info->free.begin(), info->free.end(), param.as_symbol());
+            if (iter != info->free.end() && *iter == param.as_symbol())
+            {
+                info->free.erase(iter);
+            }
+        }
+    }
+
+    // Threads analysing the same form at once agree on the result; the first one to finish publishes it.
+    const closure_info* expected = nullptr;
+    if (slot.m_info.compare_exchange_strong(expected, info.get(), std::memory_order_acq_rel))
+    {
+        return *info.release();
+    }
+    return *expected;
+}
+
+closure_slot::closure_slot(const closure_slot&) : closure_slot{}
+{
+}
+
+closure_slot::~closure_slot()
+{
+    delete m_info.load();
+}
+
+}  // namespace lisp
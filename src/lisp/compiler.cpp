@@ -0,0 +1,1018 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <iomanip>
+#include <lisp/compiler.hpp>
+#include <lisp/evaluate.hpp>
+#include <lisp/functions.hpp>
+#include <lisp/special_forms.hpp>
+#include <map>
+#include <set>
+#include <sstream>
+
+namespace lisp
+{
+
+namespace
+{
+
+enum class native_type
+{
+    // Not known yet: only produced by calls of functions whose result is still being inferred.
+    none,
+    integer,
+    floating_point,
+    boolean,
+    value,
+};
+
+native_type join(native_type lhs, native_type rhs)
+{
+    if (lhs == native_type::none)
+    {
+        return rhs;
+    }
+    if (rhs == native_type::none || lhs == rhs)
+    {
+        return lhs;
+    }
+    return native_type::value;
+}
+
+bool is_number(native_type t)
+{
+    return t == native_type::integer || t == native_type::floating_point;
+}
+
+const char* cpp_type(native_type t)
+{
+    switch (t)
+    {
+        case native_type::integer: return "std::int32_t";
+        case native_type::floating_point: return "double";
+        case native_type::boolean: return "bool";
+        default: return "lisp::value";
+    }
+}
+
+const char* cpp_param_type(native_type t)
+{
+    return t == native_type::integer || t == native_type::floating_point || t == native_type::boolean
+               ? cpp_type(t)
+               : "const lisp::value&";
+}
+
+// A C++ expression and the type it has. Pure expressions have no side effects, so they may be evaluated in any order.
+struct code
+{
+    std::string text;
+    native_type type;
+    bool pure;
+};
+
+std::string boxed(const code& c)
+{
+    return c.type == native_type::value ? c.text : str("lisp::value{ ", c.text, " }");
+}
+
+std::string convert(const code& c, native_type to)
+{
+    if (c.type == to || to == native_type::none)
+    {
+        return c.text;
+    }
+    switch (to)
+    {
+        case native_type::integer: return str(boxed(c), ".as_integer()");
+        case native_type::floating_point: return str(boxed(c), ".as_floating_point()");
+        case native_type::boolean: return str(boxed(c), ".as_boolean()");
+        default: return boxed(c);
+    }
+}
+
+// The test of a cond clause: anything but true is false.
+std::string truth(const code& c)
+{
+    return c.type == native_type::boolean ? c.text : str("static_cast<bool>(", boxed(c), ")");
+}
+
+std::string string_literal(std::string_view text)
+{
+    std::ostringstream os;
+    os << '"';
+    for (const char ch : text)
+    {
+        if (ch == '"' || ch == '\\')
+        {
+            os << '\\' << ch;
+        }
+        else if (ch >= 0x20 && ch < 0x7f)
+        {
+            os << ch;
+        }
+        else
+        {
+            os << '\\' << std::oct << std::setw(3) << std::setfill('0') << static_cast<int>(static_cast<unsigned char>(ch))
+               << std::dec << std::setfill(' ');
+        }
+    }
+    os << '"';
+    return os.str();
+}
+
+std::string floating_point_literal(double v)
+{
+    if (std::isnan(v))
+    {
+        return "std::numeric_limits<double>::quiet_NaN()";
+    }
+    if (std::isinf(v))
+    {
+        return v > 0 ? "std::numeric_limits<double>::infinity()" : "(-std::numeric_limits<double>::infinity())";
+    }
+    std::ostringstream os;
+    os << std::setprecision(17) << v;
+    std::string result = os.str();
+    if (result.find_first_of(".e") == std::string::npos)
+    {
+        result += ".0";
+    }
+    return v < 0 ? str("(", result, ")") : result;
+}
+
+// A C++ expression that builds `v`.
+std::string value_literal(const value& v)
+{
+    if (v.is_null())
+    {
+        return "lisp::value{ lisp::null }";
+    }
+    if (v.is_string())
+    {
+        return str("lisp::value{ std::string{ ", string_literal(v.as_string()), " } }");
+    }
+    if (v.is_symbol())
+    {
+        return str("lisp::value{ lisp::symbol{ ", string_literal(str(v.as_symbol())), " } }");
+    }
+    if (v.is_integer())
+    {
+        return str("lisp::value{ lisp::value::integer_type{ ", v.as_integer(), " } }");
+    }
+    if (v.is_floating_point())
+    {
+        return str("lisp::value{ ", floating_point_literal(v.as_floating_point()), " }");
+    }
+    if (v.is_boolean())
+    {
+        return v.as_boolean() ? "lisp::value{ true }" : "lisp::value{ false }";
+    }
+    if (v.is_array())
+    {
+        std::string items;
+        for (const value& item : v.as_array())
+        {
+            items += str(items.empty() ? " " : ", ", value_literal(item));
+        }
+        return str("lisp::value{ lisp::array{", items, items.empty() ? "} }" : " } }");
+    }
+    throw std::runtime_error{ str("Cannot compile a ", v.get_category(), " literal") };
+}
+
+std::string mangle(const symbol& s)
+{
+    std::string result = str(s);
+    std::replace_if(
+        std::begin(result), std::end(result), [](char ch) { return !std::isalnum(static_cast<unsigned char>(ch)); }, '_');
+    return result;
+}
+
+enum class operation_kind
+{
+    arithmetic,
+    modulus,
+    equality,
+    ordering,
+};
+
+struct operation
+{
+    const char* token;
+    operation_kind kind;
+};
+
+// The binary builtins of default_frame() that have a native counterpart.
+std::optional<operation> find_operation(const value* v)
+{
+    if (!v || !v->is_callable() || !v->as_callable().bound_args().empty())
+    {
+        return {};
+    }
+    const callable::function_type& fn = v->as_callable().fn();
+    const auto is = [&](auto op) { return fn.target<binary<decltype(op)>>() != nullptr; };
+    if (is(std::plus<>{}))
+    {
+        return operation{ "+", operation_kind::arithmetic };
+    }
+    if (is(std::minus<>{}))
+    {
+        return operation{ "-", operation_kind::arithmetic };
+    }
+    if (is(std::multiplies<>{}))
+    {
+        return operation{ "*", operation_kind::arithmetic };
+    }
+    if (is(std::divides<>{}))
+    {
+        return operation{ "/", operation_kind::arithmetic };
+    }
+    if (is(std::modulus<>{}))
+    {
+        return operation{ "%", operation_kind::modulus };
+    }
+    if (is(std::equal_to<>{}))
+    {
+        return operation{ "==", operation_kind::equality };
+    }
+    if (is(std::not_equal_to<>{}))
+    {
+        return operation{ "!=", operation_kind::equality };
+    }
+    if (is(std::less<>{}))
+    {
+        return operation{ "<", operation_kind::ordering };
+    }
+    if (is(std::less_equal<>{}))
+    {
+        return operation{ "<=", operation_kind::ordering };
+    }
+    if (is(std::greater<>{}))
+    {
+        return operation{ ">", operation_kind::ordering };
+    }
+    if (is(std::greater_equal<>{}))
+    {
+        return operation{ ">=", operation_kind::ordering };
+    }
+    return {};
+}
+
+// The native type of `lhs op rhs`, or value where the builtin's behavior differs from C++'s (floating point with
+// floating point, equality across types, ...) and the boxed operator is used instead.
+native_type operation_type(const operation& op, native_type lhs, native_type rhs)
+{
+    if (lhs == native_type::none || rhs == native_type::none)
+    {
+        return native_type::none;
+    }
+    switch (op.kind)
+    {
+        case operation_kind::arithmetic:
+            if (lhs == native_type::integer && rhs == native_type::integer)
+            {
+                return native_type::integer;
+            }
+            return is_number(lhs) && is_number(rhs) && lhs != rhs ? native_type::floating_point : native_type::value;
+        case operation_kind::modulus:
+            return lhs == native_type::integer && rhs == native_type::integer ? native_type::integer
+                                                                              : native_type::value;
+        case operation_kind::equality:
+            return lhs == rhs && lhs != native_type::value ? native_type::boolean : native_type::value;
+        case operation_kind::ordering:
+            return is_number(lhs) && is_number(rhs) ? native_type::boolean : native_type::value;
+    }
+    return native_type::value;
+}
+
+bool is_lambda_expression(const value& expr)
+{
+    return expr.is_array() && expr.as_array().size() == 3 && expr.as_array()[0] == sym_lambda;
+}
+
+bool is_let(const array& a)
+{
+    return a.size() == 3 && a[0] == sym_let && a[1].is_symbol();
+}
+
+bool is_function_definition(const value& form)
+{
+    if (!form.is_array() || !is_let(form.as_array()) || !is_lambda_expression(form.as_array()[2]))
+    {
+        return false;
+    }
+    const value& params = form.as_array()[2].as_array()[1];
+    return params.is_array()
+           && std::all_of(
+               std::begin(params.as_array()), std::end(params.as_array()), [](const value& p) { return p.is_symbol(); });
+}
+
+void collect_symbols(const value& expr, std::set<symbol>& result)
+{
+    if (expr.is_symbol())
+    {
+        result.insert(expr.as_symbol());
+    }
+    else if (expr.is_array())
+    {
+        for (const value& item : expr.as_array())
+        {
+            collect_symbols(item, result);
+        }
+    }
+}
+
+class translator
+{
+public:
+    explicit translator(const stack_type& globals) : m_globals{ globals }
+    {
+    }
+
+    std::string run(const value& program, const compile_options& options)
+    {
+        const value expanded = expand(program, m_globals);
+        if (expanded.is_array() && !expanded.as_array().empty() && expanded.as_array()[0] == sym_begin)
+        {
+            m_forms.assign(std::next(std::begin(expanded.as_array())), std::end(expanded.as_array()));
+        }
+        else
+        {
+            m_forms.push_back(expanded);
+        }
+        // Macros are only used while expanding; the compiled program does not bind them.
+        m_forms.erase(
+            std::remove_if(
+                std::begin(m_forms),
+                std::end(m_forms),
+                [](const value& form)
+                { return form.is_array() && form.as_array().size() == 3 && is_macro(form.as_array()[2]); }),
+            std::end(m_forms));
+        std::map<symbol, int> definitions;
+        for (const value& form : m_forms)
+        {
+            if (form.is_array() && is_let(form.as_array()))
+            {
+                ++definitions[form.as_array()[1].as_symbol()];
+            }
+        }
+        for (const auto& [name, count] : definitions)
+        {
+            m_defined.insert(name);
+        }
+        // A function bound more than once is whatever the last binding run made it; leave such names to the globals.
+        for (const value& form : m_forms)
+        {
+            if (is_function_definition(form) && definitions[form.as_array()[1].as_symbol()] == 1)
+            {
+                const symbol& name = form.as_array()[1].as_symbol();
+                const array& lambda = form.as_array()[2].as_array();
+                std::vector<symbol> params;
+                for (const value& p : lambda[1].as_array())
+                {
+                    params.push_back(p.as_symbol());
+                }
+                const std::size_t arity = params.size();
+                m_functions.emplace(
+                    name,
+                    function{ str("fn_", mangle(name), "_", m_functions.size()),
+                              std::move(params),
+                              lambda[2],
+                              std::vector<native_type>(arity, native_type::none),
+                              native_type::none });
+            }
+        }
+
+        // Types only grow towards value, so inference reaches a fixed point. Then whatever is still unknown (e.g. the
+        // result of a function that never returns) is boxed, and the types settle again with that.
+        infer();
+        for (auto& [name, fn] : m_functions)
+        {
+            if (fn.result == native_type::none)
+            {
+                fn.result = native_type::value;
+            }
+            for (native_type& t : fn.param_types)
+            {
+                if (t == native_type::none)
+                {
+                    t = native_type::value;
+                }
+            }
+        }
+        infer();
+        return translate(options);
+    }
+
+private:
+    struct function
+    {
+        std::string cpp_name;
+        std::vector<symbol> params;
+        value body;
+        std::vector<native_type> param_types;
+        native_type result;
+    };
+
+    struct local
+    {
+        symbol name;
+        std::string cpp_name;
+        native_type type;
+    };
+
+    // The function being generated; null for the entry point.
+    struct context
+    {
+        function* fn;
+        std::vector<local> locals;
+        bool uses_frame;
+        // The names the forms left to the interpreter in the frame mention.
+        std::set<symbol> frame_names;
+    };
+
+    std::vector<native_type> signature() const
+    {
+        std::vector<native_type> result;
+        for (const auto& [name, fn] : m_functions)
+        {
+            result.insert(std::end(result), std::begin(fn.param_types), std::end(fn.param_types));
+            result.push_back(fn.result);
+        }
+        return result;
+    }
+
+    void infer()
+    {
+        for (std::vector<native_type> before = signature();; before = signature())
+        {
+            translate({});
+            if (signature() == before)
+            {
+                return;
+            }
+        }
+    }
+
+    std::string translate(const compile_options& options)
+    {
+        m_constants.clear();
+        m_constant_names.clear();
+        m_next_name = 0;
+
+        std::ostringstream definitions;
+        for (auto& [name, fn] : m_functions)
+        {
+            definitions << "\n" << define_function(fn);
+        }
+        for (auto& [name, fn] : m_functions)
+        {
+            definitions << "\n" << define_wrapper(name, fn);
+        }
+        const std::string entry = define_entry(options.entry);
+
+        std::ostringstream os;
+        os << "// Generated by lisp --compile; do not edit.\n"
+           << "#include <lisp/compiled.hpp>\n\n"
+           << "namespace\n{\n\n";
+        for (const std::string& constant : m_constants)
+        {
+            os << constant << "\n";
+        }
+        os << "\n";
+        for (const auto& [name, fn] : m_functions)
+        {
+            os << declare_function(fn, {}) << ";\n"
+               << "lisp::value make_" << fn.cpp_name << "(lisp::stack_type& globals);\n";
+        }
+        os << definitions.str() << "\n}  // namespace\n\n" << entry;
+        if (options.main)
+        {
+            os << "\nint main()\n{\n"
+               << "    try\n    {\n"
+               << "        lisp::stack_type globals = lisp::default_stack();\n"
+               << "        std::cout << " << options.entry << "(globals) << \"\\n\";\n"
+               << "        return 0;\n    }\n"
+               << "    catch (const std::exception& ex)\n    {\n"
+               << "        std::cerr << ex.what() << \"\\n\";\n"
+               << "        return 1;\n    }\n}\n";
+        }
+        return os.str();
+    }
+
+    std::string declare_function(const function& fn, const std::vector<std::string>& names) const
+    {
+        std::string params;
+        for (std::size_t i = 0; i < fn.params.size(); ++i)
+        {
+            params += str(", ", cpp_param_type(fn.param_types[i]), names.empty() ? "" : " ", names.empty() ? "" : names[i]);
+        }
+        return str(cpp_type(fn.result), " ", fn.cpp_name, "(lisp::stack_type& globals", params, ")");
+    }
+
+    std::string define_function(function& fn)
+    {
+        context ctx{ &fn, {}, false, {} };
+        std::vector<std::string> names;
+        for (std::size_t i = 0; i < fn.params.size(); ++i)
+        {
+            names.push_back(new_name("p_", fn.params[i]));
+            ctx.locals.push_back(local{ fn.params[i], names.back(), fn.param_types[i] });
+        }
+        context* const outer = std::exchange(m_context, &ctx);
+        std::ostringstream body;
+        generate_tail(fn.body, body, "    ");
+        m_context = outer;
+
+        std::ostringstream os;
+        os << declare_function(fn, names) << "\n{\n";
+        if (ctx.uses_frame)
+        {
+            os << "    const lisp::function_frame frame{ globals, " << names_constant(ctx.frame_names) << " };\n";
+        }
+        os << body.str() << "}\n";
+        return os.str();
+    }
+
+    // The callable registered in the globals, which checks and unboxes the arguments of calls from outside.
+    std::string define_wrapper(const symbol& name, const function& fn)
+    {
+        std::string args;
+        for (std::size_t i = 0; i < fn.params.size(); ++i)
+        {
+            args += str(", ", convert(code{ str("args.at(", i, ")"), native_type::value, true }, fn.param_types[i]));
+        }
+        const code call{ str(fn.cpp_name, "(globals", args, ")"), fn.result, false };
+        std::ostringstream os;
+        os << "lisp::value make_" << fn.cpp_name << "(lisp::stack_type& globals)\n{\n"
+           << "    return lisp::value{ lisp::callable{ [&globals](const lisp::arg_list& args) -> lisp::value { return "
+           << boxed(call) << "; }, " << string_literal(str(name)) << ", " << fn.params.size() << " } };\n}\n";
+        return os.str();
+    }
+
+    std::string define_entry(const std::string& entry)
+    {
+        context ctx{ nullptr, {}, false, {} };
+        context* const outer = std::exchange(m_context, &ctx);
+        std::ostringstream body;
+        if (m_forms.empty())
+        {
+            body << "    return lisp::value{};\n";
+        }
+        for (std::size_t i = 0; i < m_forms.size(); ++i)
+        {
+            const value& form = m_forms[i];
+            code c = {};
+            if (form.is_array() && is_let(form.as_array()))
+            {
+                const symbol& name = form.as_array()[1].as_symbol();
+                if (m_functions.count(name) && is_function_definition(form))
+                {
+                    const std::string make = str("make_", m_functions.at(name).cpp_name, "(globals)");
+                    c = code{ str("globals.insert(", symbol_constant(name), ", ", make, ")"), native_type::value, false };
+                }
+                else if (is_lambda_expression(form.as_array()[2]))
+                {
+                    c = interpreted(form);
+                }
+                else
+                {
+                    const std::string init = boxed(expression(form.as_array()[2]));
+                    c = code{ str("globals.insert(", symbol_constant(name), ", ", init, ")"), native_type::value, false };
+                }
+            }
+            else
+            {
+                c = expression(form);
+            }
+            if (i + 1 == m_forms.size())
+            {
+                body << "    return " << boxed(c) << ";\n";
+            }
+            else
+            {
+                body << "    static_cast<void>(" << c.text << ");\n";
+            }
+        }
+        m_context = outer;
+
+        std::ostringstream os;
+        os << "lisp::value " << entry << "(lisp::stack_type& globals)\n{\n";
+        if (ctx.uses_frame)
+        {
+            os << "    const lisp::function_frame frame{ globals, " << names_constant(ctx.frame_names) << " };\n";
+        }
+        os << body.str() << "}\n";
+        return os.str();
+    }
+
+    std::string new_name(const char* prefix, const symbol& s)
+    {
+        return str(prefix, mangle(s), "_", m_next_name++);
+    }
+
+    // A namespace-scope constant, defined once per distinct initializer.
+    std::string constant(const char* type, const std::string& init, const char* prefix)
+    {
+        auto [iter, inserted] = m_constant_names.try_emplace(str(type, " ", init));
+        if (inserted)
+        {
+            iter->second = str(prefix, m_constant_names.size() - 1);
+            m_constants.push_back(str("const ", type, " ", iter->second, " = ", init, ";"));
+        }
+        return iter->second;
+    }
+
+    std::string symbol_constant(const symbol& s)
+    {
+        return constant("lisp::symbol", str("lisp::symbol{ ", string_literal(str(s)), " }"), "s");
+    }
+
+    std::string value_constant(const value& v)
+    {
+        return constant("lisp::value", value_literal(v), "k");
+    }
+
+    std::string names_constant(const std::set<symbol>& names)
+    {
+        std::string init;
+        for (const symbol& s : names)
+        {
+            init += str(init.empty() ? " " : ", ", symbol_constant(s));
+        }
+        return constant("std::vector<lisp::symbol>", str("lisp::sorted_names({", init, init.empty() ? "})" : " })"), "n");
+    }
+
+    const local* find_local(const symbol& s) const
+    {
+        const auto& locals = m_context->locals;
+        const auto iter
+            = std::find_if(std::rbegin(locals), std::rend(locals), [&](const local& l) { return l.name == s; });
+        return iter != std::rend(locals) ? &*iter : nullptr;
+    }
+
+    // A function referred to other than by a direct call may be called with anything.
+    void escape(const symbol& s)
+    {
+        const auto iter = m_functions.find(s);
+        if (iter != m_functions.end())
+        {
+            for (native_type& t : iter->second.param_types)
+            {
+                t = native_type::value;
+            }
+        }
+    }
+
+    void emit_return(const code& c, std::ostream& os, const std::string& indent)
+    {
+        if (function* fn = m_context->fn)
+        {
+            fn->result = join(fn->result, c.type);
+            os << indent << "return " << convert(c, fn->result) << ";\n";
+        }
+        else
+        {
+            os << indent << "return " << boxed(c) << ";\n";
+        }
+    }
+
+    void generate_tail(const value& expr, std::ostream& os, const std::string& indent)
+    {
+        const array* a = expr.is_array() && !expr.as_array().empty() ? &expr.as_array() : nullptr;
+        if (a && a->size() == 4 && (*a)[0] == sym_if)
+        {
+            os << indent << "if (" << convert(expression((*a)[1]), native_type::boolean) << ")\n" << indent << "{\n";
+            generate_block((*a)[2], os, indent + "    ");
+            os << indent << "}\n" << indent << "else\n" << indent << "{\n";
+            generate_block((*a)[3], os, indent + "    ");
+            os << indent << "}\n";
+        }
+        else if (a && is_cond(*a))
+        {
+            for (std::size_t i = 1; i < a->size(); ++i)
+            {
+                const array& clause = (*a)[i].as_array();
+                os << indent << (i == 1 ? "if (" : "else if (") << truth(expression(clause[0])) << ")\n"
+                   << indent << "{\n";
+                generate_block(clause[1], os, indent + "    ");
+                os << indent << "}\n";
+            }
+            os << indent << "throw std::runtime_error{ \"cond: no match found\" };\n";
+        }
+        else if (a && (*a)[0] == sym_begin)
+        {
+            if (a->size() == 1)
+            {
+                emit_return(code{ "lisp::value{}", native_type::value, true }, os, indent);
+                return;
+            }
+            for (std::size_t i = 1; i + 1 < a->size(); ++i)
+            {
+                generate_statement((*a)[i], os, indent);
+            }
+            generate_tail(a->back(), os, indent);
+        }
+        else if (a && is_let(*a))
+        {
+            const local& l = declare(*a, os, indent);
+            emit_return(code{ l.cpp_name, l.type, true }, os, indent);
+        }
+        else
+        {
+            emit_return(expression(expr), os, indent);
+        }
+    }
+
+    // A scope of its own: the locals declared in it end with it.
+    void generate_block(const value& expr, std::ostream& os, const std::string& indent)
+    {
+        const std::size_t locals = m_context->locals.size();
+        generate_tail(expr, os, indent);
+        m_context->locals.erase(std::next(std::begin(m_context->locals), locals), std::end(m_context->locals));
+    }
+
+    void generate_statement(const value& expr, std::ostream& os, const std::string& indent)
+    {
+        const array* a = expr.is_array() && !expr.as_array().empty() ? &expr.as_array() : nullptr;
+        if (a && (*a)[0] == sym_begin)
+        {
+            for (const value& form : iterator_range{ *a } |= drop(1))
+            {
+                generate_statement(form, os, indent);
+            }
+        }
+        else if (a && is_let(*a))
+        {
+            declare(*a, os, indent);
+        }
+        else
+        {
+            os << indent << "static_cast<void>(" << expression(expr).text << ");\n";
+        }
+    }
+
+    // Binds a local for the rest of the enclosing block. A lambda is bound by the interpreter as well, so that it can
+    // refer to itself.
+    const local& declare(const array& let, std::ostream& os, const std::string& indent)
+    {
+        const symbol& name = let[1].as_symbol();
+        const code c = is_lambda_expression(let[2]) ? interpreted(value{ let }) : expression(let[2]);
+        m_context->locals.push_back(local{ name, new_name("l_", name), c.type });
+        const local& l = m_context->locals.back();
+        os << indent << "[[maybe_unused]] const " << cpp_type(c.type) << " " << l.cpp_name << " = " << c.text << ";\n";
+        return l;
+    }
+
+    static bool is_cond(const array& a)
+    {
+        return a[0] == sym_cond
+               && std::all_of(
+                   std::next(std::begin(a)),
+                   std::end(a),
+                   [](const value& clause) { return clause.is_array() && clause.as_array().size() == 2; });
+    }
+
+    code expression(const value& expr)
+    {
+        if (expr.is_symbol())
+        {
+            return reference(expr.as_symbol());
+        }
+        if (expr.is_integer())
+        {
+            return code{ str(expr.as_integer()), native_type::integer, true };
+        }
+        if (expr.is_floating_point())
+        {
+            return code{ floating_point_literal(expr.as_floating_point()), native_type::floating_point, true };
+        }
+        if (expr.is_boolean())
+        {
+            return code{ expr.as_boolean() ? "true" : "false", native_type::boolean, true };
+        }
+        if (!expr.is_array())
+        {
+            return code{ value_constant(expr), native_type::value, true };
+        }
+        const array& a = expr.as_array();
+        if (a.empty())
+        {
+            return interpreted(expr);
+        }
+        if (a.size() == 2 && a[0] == sym_quote)
+        {
+            return code{ value_constant(a[1]), native_type::value, true };
+        }
+        if (a.size() == 4 && a[0] == sym_if)
+        {
+            const code test = expression(a[1]);
+            const code then = expression(a[2]);
+            const code otherwise = expression(a[3]);
+            const native_type t = join(then.type, otherwise.type);
+            return code{
+                str("(", convert(test, native_type::boolean), " ? ", convert(then, t), " : ", convert(otherwise, t), ")"),
+                t,
+                test.pure && then.pure && otherwise.pure };
+        }
+        if (is_cond(a))
+        {
+            std::vector<std::pair<code, code>> clauses;
+            native_type t = native_type::none;
+            for (const value& clause : iterator_range{ a } |= drop(1))
+            {
+                clauses.emplace_back(expression(clause.as_array()[0]), expression(clause.as_array()[1]));
+                t = join(t, clauses.back().second.type);
+            }
+            t = t == native_type::none ? native_type::value : t;
+            std::string text = str("lisp::cond_no_match<", cpp_type(t), ">()");
+            for (auto iter = std::rbegin(clauses); iter != std::rend(clauses); ++iter)
+            {
+                text = str("(", truth(iter->first), " ? ", convert(iter->second, t), " : ", text, ")");
+            }
+            return code{ text, t, false };
+        }
+        if (a[0] == sym_begin)
+        {
+            return sequence(a);
+        }
+        if (a[0].is_symbol() && is_special_form(a[0].as_symbol()))
+        {
+            return interpreted(expr);
+        }
+        return call(a);
+    }
+
+    code reference(const symbol& s)
+    {
+        if (const local* l = find_local(s))
+        {
+            return code{ l->cpp_name, l->type, true };
+        }
+        escape(s);
+        return code{ str("globals[", symbol_constant(s), "]"), native_type::value, true };
+    }
+
+    // A begin in an expression: the comma operator, or a lambda called in place if it binds locals.
+    code sequence(const array& a)
+    {
+        if (a.size() == 1)
+        {
+            return code{ "lisp::value{}", native_type::value, true };
+        }
+        const bool binds = std::any_of(
+            std::next(std::begin(a)),
+            std::end(a),
+            [](const value& form)
+            {
+                return form.is_array() && !form.as_array().empty()
+                       && (is_let(form.as_array()) || form.as_array()[0] == sym_begin);
+            });
+        if (!binds)
+        {
+            std::string text = "(";
+            code c = {};
+            bool pure = true;
+            for (std::size_t i = 1; i < a.size(); ++i)
+            {
+                c = expression(a[i]);
+                pure = pure && c.pure;
+                text += i + 1 < a.size() ? str("static_cast<void>(", c.text, "), ") : str(c.text, ")");
+            }
+            return code{ text, c.type, pure };
+        }
+        const std::size_t locals = m_context->locals.size();
+        std::ostringstream os;
+        for (std::size_t i = 1; i + 1 < a.size(); ++i)
+        {
+            generate_statement(a[i], os, "");
+        }
+        const code last = expression(a.back());
+        m_context->locals.erase(std::next(std::begin(m_context->locals), locals), std::end(m_context->locals));
+        std::string statements = os.str();
+        std::replace(std::begin(statements), std::end(statements), '\n', ' ');
+        return code{ str("[&]() { ", statements, "return ", last.text, "; }()"), last.type, false };
+    }
+
+    // Operands with side effects run left to right, as in the interpreter, rather than in C++'s unspecified order.
+    template <class Build>
+    code sequenced(std::vector<code> operands, native_type type, Build build)
+    {
+        const auto impure
+            = std::count_if(std::begin(operands), std::end(operands), [](const code& c) { return !c.pure; });
+        if (impure < 2)
+        {
+            return code{ build(operands), type, false };
+        }
+        std::string text = "[&]() { ";
+        for (code& operand : operands)
+        {
+            const std::string name = str("t", m_next_name++);
+            text += str("const auto ", name, " = ", operand.text, "; ");
+            operand.text = name;
+        }
+        return code{ str(text, "return ", build(operands), "; }()"), type, false };
+    }
+
+    code call(const array& a)
+    {
+        std::vector<code> args;
+        if (a[0].is_symbol() && !find_local(a[0].as_symbol()))
+        {
+            const symbol& name = a[0].as_symbol();
+            const auto fn = m_functions.find(name);
+            if (fn != m_functions.end() && fn->second.params.size() + 1 == a.size())
+            {
+                function& f = fn->second;
+                for (std::size_t i = 1; i < a.size(); ++i)
+                {
+                    args.push_back(expression(a[i]));
+                    f.param_types[i - 1] = join(f.param_types[i - 1], args.back().type);
+                }
+                return sequenced(
+                    std::move(args),
+                    f.result,
+                    [&](const std::vector<code>& operands)
+                    {
+                        std::string text = str(f.cpp_name, "(globals");
+                        for (std::size_t i = 0; i < operands.size(); ++i)
+                        {
+                            text += str(", ", convert(operands[i], f.param_types[i]));
+                        }
+                        return text + ")";
+                    });
+            }
+            const std::optional<operation> op = m_defined.count(name) ? std::nullopt : find_operation(m_globals.find(name));
+            if (op && a.size() == 3)
+            {
+                const code lhs = expression(a[1]);
+                const code rhs = expression(a[2]);
+                const native_type t = operation_type(*op, lhs.type, rhs.type);
+                const bool native = t != native_type::value;
+                code result = sequenced(
+                    { lhs, rhs },
+                    op->kind == operation_kind::equality || op->kind == operation_kind::ordering ? native_type::boolean : t,
+                    [&](const std::vector<code>& operands)
+                    {
+                        return native ? str("(", operands[0].text, " ", op->token, " ", operands[1].text, ")")
+                                      : str("(", boxed(operands[0]), " ", op->token, " ", boxed(operands[1]), ")");
+                    });
+                result.pure = lhs.pure && rhs.pure;
+                return result;
+            }
+        }
+        // Braced initializers run in order, so the head and arguments need no sequencing.
+        std::string text = str("lisp::call_dynamic(", boxed(expression(a[0])), ", {");
+        for (std::size_t i = 1; i < a.size(); ++i)
+        {
+            text += str(i == 1 ? " " : ", ", boxed(expression(a[i])));
+        }
+        return code{ text + (a.size() > 1 ? " })" : "})"), native_type::value, false };
+    }
+
+    // Leaves `expr` to the interpreter. Inside functions it runs in the function's frame, which closures it makes keep
+    // as long as they would in the interpreter.
+    code interpreted(const value& expr)
+    {
+        std::set<symbol> symbols;
+        collect_symbols(expr, symbols);
+        std::string locals;
+        for (const symbol& s : symbols)
+        {
+            escape(s);
+            if (const local* l = find_local(s))
+            {
+                const std::string boxed_local = boxed(code{ l->cpp_name, l->type, true });
+                locals += str(locals.empty() ? " " : ", ", "{ ", symbol_constant(s), ", ", boxed_local, " }");
+            }
+        }
+        const bool in_frame = m_context->fn || !locals.empty();
+        m_context->uses_frame = m_context->uses_frame || in_frame;
+        if (in_frame)
+        {
+            m_context->frame_names.insert(symbols.begin(), symbols.end());
+        }
+        const char* frame = in_frame ? "*frame" : "globals";
+        return code{
+            str("lisp::interpret_form(", value_constant(expr), ", ", frame, ", {", locals, locals.empty() ? "})" : " })"),
+            native_type::value,
+            false };
+    }
+
+    const stack_type& m_globals;
+    std::vector<value> m_forms;
+    std::set<symbol> m_defined;
+    std::map<symbol, function> m_functions;
+    std::vector<std::string> m_constants;
+    std::map<std::string, std::string> m_constant_names;
+    std::size_t m_next_name = 0;
+    context* m_context = nullptr;
+};
+
+}  // namespace
+
+std::string compile_to_cpp(const value& program, const compile_options& options, const stack_type& globals)
+{
+    return translator{ globals }.run(program, options);
+}
+
+}  // namespace lisp
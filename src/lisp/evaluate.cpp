@@ -1,17 +1,16 @@
+#include <lisp/arena.hpp>
+#include <lisp/bench.hpp>
+#include <lisp/budget.hpp>
+#include <lisp/closure.hpp>
 #include <lisp/evaluate.hpp>
+#include <lisp/inline_cache.hpp>
+#include <lisp/special_forms.hpp>
 #include <lisp/utils/iterator_range.hpp>
+#include <map>
 
 namespace lisp
 {
 
-const auto sym_defun = symbol{ "defun" };
-const auto sym_lambda = symbol{ "lambda" };
-const auto sym_let = symbol{ "let" };
-const auto sym_if = symbol{ "if" };
-const auto sym_begin = symbol{ "begin" };
-const auto sym_cond = symbol{ "cond" };
-const auto sym_quote = symbol{ "quote" };
-
 std::optional<array> do_apply_macro(const array& a)
 {
     if (a.size() == 4 && a.at(0) == sym_defun)
@@ -21,29 +20,514 @@ std::optional<array> do_apply_macro(const array& a)
     return {};
 }
 
-array apply_macro(const array& a)
+std::string lambda_name(const callable& self)
 {
-    return do_apply_macro(a).value_or(a);
+    return str("lambda [", *self.arity(), "]");
 }
 
 struct callable_lambda
 {
     value::lambda_type lambda;
-    value operator()(const std::vector<value>& args) const
+    // The lambda form, which keeps the analysis of its body.
+    value form;
+    const closure_info* info;
+    // The variables the lambda copied from the frames it was made in, if any, or the frame it refers to; lambda.stack
+    // points to it.
+    std::shared_ptr<const stack_type> captured;
+    // The frame the lambda refers to, which may still bind names it uses, if any.
+    std::weak_ptr<stack_type> kept;
+
+    callable_lambda(value::lambda_type lambda, value form, const closure_info* info)
+        : lambda{ lambda }, form{ std::move(form) }, info{ info }, captured{}, kept{}
+    {
+    }
+
+    callable_lambda(const callable_lambda&) = default;
+    callable_lambda(callable_lambda&&) = default;
+    callable_lambda& operator=(const callable_lambda&) = delete;
+
+    ~callable_lambda();
+
+    value operator()(const arg_list& args) const
     {
+        if (info->shared)
+        {
+            return call_shared(args);
+        }
         const auto& params = lambda.params.as_array();
-        auto new_frame = stack_type::frame_type{};
+        // Frames keep their parameters inline, so they are filled in place rather than built and moved.
+        auto new_stack = stack_type{ stack_type::frame_type(current_resource()), lambda.stack };
+        new_stack.assigned = &info->assigned;
+        ++thread_stats().frames;
         for (std::size_t i = 0; i < params.size(); ++i)
         {
-            new_frame.emplace(params.at(i).as_symbol(), args.at(i));
+            new_stack.frame.emplace(params.at(i).as_symbol(), args.at(i));
         }
 
-        auto new_stack = stack_type{ new_frame, lambda.stack };
+        return evaluate_expanded(lambda.body, &new_stack);
+    }
+
+    // Calls in a frame on the heap that closures made in the body may keep, along with what the closure keeps.
+    [[gnu::noinline]] value call_shared(const arg_list& args) const;
+};
+
+// A macro defined by defmacro: calling it binds its parameters to the forms it is given in a frame over the globals it
+// was defined in, and evaluates its body to the form that replaces the call.
+struct macro
+{
+    value params;
+    value body;
+    const stack_type* globals;
 
-        return evaluate(lambda.body, &new_stack);
+    value operator()(const arg_list& args) const
+    {
+        const auto& names = params.as_array();
+        stack_type frame{ {}, globals };
+        for (std::size_t i = 0; i < names.size(); ++i)
+        {
+            frame.frame.emplace(names[i].as_symbol(), args.at(i));
+        }
+        return evaluate_expanded(body, &frame);
     }
 };
 
+bool is_lambda_form(const value& expr)
+{
+    return expr.is_array() && expr.as_array().size() == 3 && expr.as_array()[0] == sym_lambda;
+}
+
+// Marks the frames from `kept` out to `rest` in which calls of a closure whose body `info` describes may find names, so
+// that they keep their bindings when the code running in them returns.
+void mark_referenced(const closure_info& info, const stack_type* kept, const stack_type* rest)
+{
+    kept->referenced = true;
+    for (const symbol& name : info.free)
+    {
+        if (kept->frame.count(name))
+        {
+            continue;
+        }
+        for (const stack_type* s = kept->outer; s != rest; s = s->outer)
+        {
+            const bool binds = s->frame.count(name) != 0;
+            if (binds || std::binary_search(s->assigned->begin(), s->assigned->end(), name))
+            {
+                s->referenced = true;
+            }
+            if (binds)
+            {
+                break;
+            }
+        }
+    }
+}
+
+// The frame calls of a lambda made in `stack` start from. The variables the body uses from frames whose bindings stay
+// as they are, i.e. lambda frames that do not bind them with let, are copied into a frame of their own over the rest of
+// the chain, so the closure neither keeps those frames nor searches them. If a variable may still be bound by let in
+// one of them, the copies go over that frame instead, which the closure keeps; such frames are made on the heap (see
+// closure.hpp).
+void closure_frame(callable_lambda& fn, stack_type* stack)
+{
+    const closure_info& info = *fn.info;
+    static const std::vector<symbol> no_names;
+    const auto copyable = [](const stack_type* s) { return s && !s->global && s->assigned; };
+    const stack_type* rest = stack;
+    while (copyable(rest))
+    {
+        rest = rest->outer;
+    }
+    if (rest == stack)
+    {
+        fn.lambda.stack = stack;
+        return;
+    }
+
+    // The innermost frame that may still bind one of the variables.
+    const stack_type* kept = rest;
+    for (const symbol& name : info.free)
+    {
+        for (const stack_type* s = stack; s != kept; s = s->outer)
+        {
+            if (std::binary_search(s->assigned->begin(), s->assigned->end(), name))
+            {
+                kept = s;
+                break;
+            }
+            if (s->frame.count(name))
+            {
+                break;
+            }
+        }
+    }
+    std::shared_ptr<stack_type> keep;
+    if (kept != rest)
+    {
+        keep = kept->self.lock();
+        // Only frames that no closure outlives are made elsewhere.
+        if (!keep)
+        {
+            fn.lambda.stack = stack;
+            return;
+        }
+        fn.kept = keep;
+        mark_referenced(info, kept, rest);
+    }
+
+    stack_type::frame_type copies;
+    for (const symbol& name : info.free)
+    {
+        for (const stack_type* s = stack; s != kept; s = s->outer)
+        {
+            const auto iter = s->frame.find(name);
+            if (iter != s->frame.end())
+            {
+                copies.emplace(name, iter->second);
+                break;
+            }
+        }
+    }
+    if (copies.empty())
+    {
+        fn.lambda.stack = kept;
+        fn.captured = std::move(keep);
+        return;
+    }
+    // Every closure of the form copies the same names, so call sites in its body may skip the frame like any other
+    // that is not extended.
+    const std::shared_ptr<stack_type> frame = make_shared_frame(kept, std::move(keep));
+    frame->frame = std::move(copies);
+    frame->assigned = &no_names;
+    ++thread_stats().frames;
+    fn.lambda.stack = frame.get();
+    fn.captured = frame;
+}
+
+// Whether `fn` keeps `frame`, directly or through the frame of its copies.
+bool keeps(const callable_lambda& fn, const std::shared_ptr<stack_type>& frame)
+{
+    return !fn.kept.owner_before(frame) && !frame.owner_before(fn.kept);
+}
+
+// The function of `v` if it is a closure without bound arguments.
+const callable_lambda* closure_of(const value& v)
+{
+    return v.is_callable() && v.as_callable().bound_args().empty() ? v.as_callable().fn().target<callable_lambda>()
+                                                                    : nullptr;
+}
+
+// As release_cycles, while `leaving`, the function of a closure, loses one of the callables that share it.
+void release_frame(const std::shared_ptr<stack_type>& frame, const callable::function_type* leaving)
+{
+    const auto shares = [](const value& v, const value& other)
+    { return other.is_callable() && &other.as_callable().fn() == &v.as_callable().fn(); };
+    long owners = frame.use_count() - 1;
+    const auto begin = frame->frame.begin();
+    const auto end = frame->frame.end();
+    for (auto iter = begin; iter != end && owners > 0; ++iter)
+    {
+        const value& v = iter->second;
+        const callable_lambda* fn = closure_of(v);
+        // A closure bound under several names owns the frame once, and is counted at its first binding.
+        if (!fn || !keeps(*fn, frame)
+            || std::any_of(begin, iter, [&](const auto& binding) { return shares(v, binding.second); }))
+        {
+            continue;
+        }
+        const long bindings = std::count_if(begin, end, [&](const auto& binding) { return shares(v, binding.second); });
+        if (v.as_callable().use_count() > bindings + (&v.as_callable().fn() == leaving ? 1 : 0))
+        {
+            return;
+        }
+        --owners;
+    }
+    if (owners == 0)
+    {
+        // The closures released here look at the frame again as they go.
+        const stack_type::frame_type bindings = std::move(frame->frame);
+        frame->frame.clear();
+    }
+}
+
+// Tried when a closure that refers to the frame goes away and when all but one of the callables of such a closure do,
+// which may leave only its binding in the frame.
+void release_cycles(const std::shared_ptr<stack_type>& frame)
+{
+    if (!frame->referenced)
+    {
+        // No closure looks names up here, even those that keep the frame on the way to the frames further out, so
+        // the bindings are of no more use once the code running in it returns.
+        const stack_type::frame_type bindings = std::move(frame->frame);
+        frame->frame.clear();
+        return;
+    }
+    release_frame(frame, nullptr);
+}
+
+void release_closure(const callable::function_type& f)
+{
+    const callable_lambda* fn = f.target<callable_lambda>();
+    if (const std::shared_ptr<stack_type> frame = fn ? fn->kept.lock() : nullptr)
+    {
+        release_frame(frame, &f);
+    }
+}
+
+callable_lambda::~callable_lambda()
+{
+    if (kept.expired())
+    {
+        return;
+    }
+    captured.reset();
+    if (const std::shared_ptr<stack_type> frame = kept.lock())
+    {
+        release_frame(frame, nullptr);
+    }
+}
+
+// Makes the copies of transfer(). Frames and functions met more than once are copied once, so closures that shared
+// them before share the copies, and closures bound in the frames they keep are bound in the copies.
+class transfer_copy
+{
+public:
+    // The copy of `v`, or nothing if it may be shared as it is.
+    std::optional<value> operator()(const value& v)
+    {
+        if (v.is_array())
+        {
+            return copy_array(v.as_array());
+        }
+        if (!v.is_callable())
+        {
+            return {};
+        }
+        const callable& c = v.as_callable();
+        std::optional<value> fn = copy_function(c);
+        if (c.bound_args().empty())
+        {
+            return fn;
+        }
+        const std::optional<value> bound = copy_array(c.bound_args());
+        if (!fn && !bound)
+        {
+            return {};
+        }
+        array args = bound ? bound->as_array() : c.bound_args();
+        return value{ callable{ fn ? fn->as_callable() : c, std::move(args) } };
+    }
+
+private:
+    std::optional<value> copy_array(const array& items)
+    {
+        for (std::size_t i = 0; i < items.size(); ++i)
+        {
+            std::optional<value> first = (*this)(items[i]);
+            if (!first)
+            {
+                continue;
+            }
+            // Items before the first that changes are shared; those after it are copied as needed.
+            array result(items.begin(), items.begin() + i);
+            result.reserve(items.size());
+            result.push_back(std::move(*first));
+            for (std::size_t j = i + 1; j < items.size(); ++j)
+            {
+                std::optional<value> item = (*this)(items[j]);
+                result.push_back(item ? std::move(*item) : items[j]);
+            }
+            return value{ std::move(result) };
+        }
+        return {};
+    }
+
+    // The unbound callable of `c` with a copy of its closure, if the closure refers to a frame that is copied.
+    std::optional<value> copy_function(const callable& c)
+    {
+        const callable::function_type* const key = &c.fn();
+        if (const auto iter = m_functions.find(key); iter != m_functions.end())
+        {
+            return iter->second;
+        }
+        const callable_lambda* const fn = c.fn().target<callable_lambda>();
+        const std::shared_ptr<stack_type> kept = fn ? fn->kept.lock() : nullptr;
+        // A closure that keeps no frame has at most one of its own, holding copies of the variables it uses.
+        const std::shared_ptr<stack_type> frame = !fn || !fn->captured ? nullptr
+                                                  : kept              ? copy_frame(*fn->captured)
+                                                                      : copy_bindings(*fn->captured);
+        // A closure bound in the frame it keeps has been copied along with the frame.
+        if (const auto iter = m_functions.find(key); iter != m_functions.end())
+        {
+            return iter->second;
+        }
+        std::optional<value> result;
+        if (frame)
+        {
+            callable_lambda copy{ *fn };
+            copy.lambda.stack = frame.get();
+            copy.captured = frame;
+            if (kept)
+            {
+                copy.kept = copy_frame(*kept);
+            }
+            result = c.with_function(std::move(copy));
+        }
+        m_functions.emplace(key, result);
+        return result;
+    }
+
+    // A copy of a frame made on the heap and of those it is nested in, with copies of the values bound in them.
+    std::shared_ptr<stack_type> copy_frame(const stack_type& frame)
+    {
+        if (const auto iter = m_frames.find(&frame); iter != m_frames.end())
+        {
+            return iter->second;
+        }
+        const std::shared_ptr<stack_type> outer_frame = frame.outer ? frame.outer->self.lock() : nullptr;
+        const std::shared_ptr<stack_type> outer = outer_frame ? copy_frame(*outer_frame) : nullptr;
+        const std::shared_ptr<stack_type> result = make_shared_frame(outer ? outer.get() : frame.outer, outer);
+        result->extended = frame.extended;
+        result->assigned = frame.assigned;
+        result->referenced = frame.referenced;
+        ++thread_stats().frames;
+        // Known before the bindings are copied, so closures bound here that keep the frame keep the copy.
+        m_frames.emplace(&frame, result);
+        for (const auto& [name, v] : frame.frame)
+        {
+            std::optional<value> item = (*this)(v);
+            result->frame.emplace(name, item ? std::move(*item) : v);
+        }
+        return result;
+    }
+
+    // A copy of the frame of a closure that keeps no other, if a value bound in it is copied.
+    std::shared_ptr<stack_type> copy_bindings(const stack_type& frame)
+    {
+        if (const auto iter = m_bindings.find(&frame); iter != m_bindings.end())
+        {
+            return iter->second;
+        }
+        stack_type::frame_type copies;
+        bool copied = false;
+        for (const auto& [name, v] : frame.frame)
+        {
+            std::optional<value> item = (*this)(v);
+            copied = copied || item.has_value();
+            copies.emplace(name, item ? std::move(*item) : v);
+        }
+        std::shared_ptr<stack_type> result;
+        if (copied)
+        {
+            result = make_shared_frame(frame.outer, nullptr);
+            result->frame = std::move(copies);
+            result->assigned = frame.assigned;
+            ++thread_stats().frames;
+        }
+        m_bindings.emplace(&frame, result);
+        return result;
+    }
+
+    std::map<const stack_type*, std::shared_ptr<stack_type>> m_frames;
+    std::map<const stack_type*, std::shared_ptr<stack_type>> m_bindings;
+    std::map<const callable::function_type*, std::optional<value>> m_functions;
+};
+
+// The frame of a lambda call, of a lambda applied in place or of a loop: on this stack, or on the heap if closures
+// made in it may keep it.
+class local_frame
+{
+public:
+    // Over `stack`, which code in the frame is nested in.
+    local_frame(const closure_info& info, stack_type* stack)
+        : local_frame{ info, stack, info.shared ? stack->self.lock() : nullptr }
+    {
+    }
+
+    // Over `outer`, which `keep` owns where closures keep it.
+    local_frame(const closure_info& info, const stack_type* outer, std::shared_ptr<const stack_type> keep)
+    {
+        if (info.shared)
+        {
+            m_shared = make_shared_frame(outer, std::move(keep));
+            m_frame = m_shared.get();
+        }
+        else
+        {
+            m_frame = &m_local.emplace(stack_type::frame_type(current_resource()), outer);
+        }
+        m_frame->assigned = &info.assigned;
+    }
+
+    ~local_frame()
+    {
+        if (m_shared)
+        {
+            release_cycles(m_shared);
+        }
+    }
+
+    local_frame(const local_frame&) = delete;
+    local_frame& operator=(const local_frame&) = delete;
+
+    stack_type* get() const
+    {
+        return m_frame;
+    }
+
+    stack_type* operator->() const
+    {
+        return m_frame;
+    }
+
+private:
+    std::optional<stack_type> m_local;
+    std::shared_ptr<stack_type> m_shared;
+    stack_type* m_frame;
+};
+
+value callable_lambda::call_shared(const arg_list& args) const
+{
+    const auto& params = lambda.params.as_array();
+    const local_frame new_stack{ *info, lambda.stack, captured };
+    ++thread_stats().frames;
+    for (std::size_t i = 0; i < params.size(); ++i)
+    {
+        new_stack->frame.emplace(params.at(i).as_symbol(), args.at(i));
+    }
+    return evaluate_expanded(lambda.body, new_stack.get());
+}
+
+value make_lambda(const value& form, stack_type* stack, std::optional<std::string> name)
+{
+    const array& a = form.as_array();
+    const closure_info& info = closure_info::of(form);
+    const auto arity = a[1].as_array().size();
+    callable_lambda fn{ value::lambda_type{ a[1], a[2], nullptr }, form, &info };
+    closure_frame(fn, stack);
+    // A closure that keeps a frame may be bound in it, and then only goes away with the frame.
+    const callable::release_function release = fn.kept.expired() ? nullptr : &release_closure;
+    if (name)
+    {
+        return value::callable_type{ std::move(fn), std::move(*name), arity, release };
+    }
+    return value::callable_type{ std::move(fn), &lambda_name, arity, release };
+}
+
+// Reports a failed call with the arguments it was given.
+[[noreturn, gnu::noinline, gnu::cold]] void call_failed(const std::exception& ex, const arg_list& arg_values)
+{
+    std::stringstream ss;
+    ss << "Exception: " << ex.what() << "\n"
+       << "Args:"
+       << "\n";
+    for (std::size_t i = 0; i < arg_values.size(); ++i)
+    {
+        ss << "[" << i << "] " << arg_values[i] << " <" << arg_values[i].get_category() << ">"
+           << "\n";
+    }
+    throw std::runtime_error{ ss.str() };
+}
+
 struct evaluate_fn
 {
     value operator()(const value& expr, stack_type* stack) const
@@ -54,7 +538,7 @@ struct evaluate_fn
         }
         else if (expr.is_array())
         {
-            const auto a = apply_macro(expr.as_array());
+            const array& a = expr.as_array();
             const auto args = iterator_range{ a } |= drop(1);
             if (a.size() == 4)
             {
@@ -67,16 +551,17 @@ struct evaluate_fn
             {
                 if (a[0] == sym_let)
                 {
-                    return stack->insert(args.at(0).as_symbol(), (*this)(args.at(1), stack));
+                    const symbol& name = args.at(0).as_symbol();
+                    // A lambda bound by let or defun is named after its symbol, for error messages and profiles.
+                    if (is_lambda_form(args.at(1)))
+                    {
+                        return stack->insert(name, make_lambda(args.at(1), stack, str(name)));
+                    }
+                    return stack->insert(name, (*this)(args.at(1), stack));
                 }
                 else if (a[0] == sym_lambda)
                 {
-                    const auto params = args.at(0);
-                    const auto body = args.at(1);
-                    const auto arity = params.as_array().size();
-                    return value::callable_type{ callable_lambda{ value::lambda_type{ params, body, stack } },
-                                                 str("lambda [", arity, "]"),
-                                                 arity };
+                    return make_lambda(expr, stack, {});
                 }
             }
             if (a.size() == 2)
@@ -111,47 +596,603 @@ struct evaluate_fn
                 }
                 throw std::runtime_error{ "cond: no match found" };
             }
+            if (a[0] == sym_bench)
+            {
+                return bench_form(a, stack);
+            }
+            if (a[0] == sym_time)
+            {
+                return time_form(a, stack);
+            }
+            if (a[0].is_symbol() && is_iteration_form(a[0].as_symbol()))
+            {
+                return iteration_form(expr, stack);
+            }
+
+            if (is_lambda_form(a[0]))
+            {
+                return apply_lambda_form(a, stack);
+            }
+
+            // Names in the form are found through its cache.
+            site_cache* const site = site_cache::of(expr);
+            const auto operand = [&](std::size_t i) -> value
+            {
+                return site && a[i].is_symbol() ? site->lookup(a[i].as_symbol(), i, a.size(), *stack)
+                                                : (*this)(a[i], stack);
+            };
 
-            const value op = (*this)(a[0], stack);
+            // Builtins that optimize() put in place of their names are called from the form, not copied.
+            value looked_up;
+            const value& op = a[0].is_callable() ? a[0] : (looked_up = operand(0));
 
-            const std::vector<value> arg_values = std::invoke(
+            const arg_list arg_values = std::invoke(
                 [&]()
                 {
-                    std::vector<value> result;
+                    arg_list result(current_resource());
                     result.reserve(args.size());
-                    std::transform(
-                        std::begin(args),
-                        std::end(args),
-                        std::back_inserter(result),
-                        [&](const value& v) { return (*this)(v, stack); });
+                    for (std::size_t i = 1; i < a.size(); ++i)
+                    {
+                        result.push_back(operand(i));
+                    }
                     return result;
                 });
 
+            if (budget* limits = current_budget())
+            {
+                limits->tick();
+            }
+
             try
             {
                 return op.as_callable()(arg_values);
             }
+            catch (const limit_exceeded&)
+            {
+                throw;
+            }
             catch (const std::exception& ex)
             {
-                std::stringstream ss;
-                ss << "Exception: " << ex.what() << "\n"
-                   << "Args:"
-                   << "\n";
-                for (std::size_t i = 0; i < arg_values.size(); ++i)
+                call_failed(ex, arg_values);
+            }
+        }
+        return expr;
+    }
+
+    // ((lambda (params...) body) args...): the lambda cannot outlive the call, so its frame is made on this stack, over
+    // `stack`, and no closure is made at all.
+    [[gnu::noinline]] value apply_lambda_form(const array& a, stack_type* stack) const
+    {
+        arg_list arg_values(current_resource());
+        arg_values.reserve(a.size() - 1);
+        for (std::size_t i = 1; i < a.size(); ++i)
+        {
+            arg_values.push_back((*this)(a[i], stack));
+        }
+
+        if (budget* limits = current_budget())
+        {
+            limits->tick();
+        }
+
+        const array& params = a[0].as_array()[1].as_array();
+        try
+        {
+            // Partial application goes through a closure, as for any other callable.
+            if (params.size() != arg_values.size())
+            {
+                return make_lambda(a[0], stack, {}).as_callable()(arg_values);
+            }
+            ++thread_stats().calls;
+            ++thread_stats().frames;
+            const local_frame frame{ closure_info::of(a[0]), stack };
+            for (std::size_t i = 0; i < params.size(); ++i)
+            {
+                frame->frame.emplace(params[i].as_symbol(), arg_values[i]);
+            }
+            return evaluate_expanded(a[0].as_array()[2], frame.get());
+        }
+        catch (const limit_exceeded&)
+        {
+            throw;
+        }
+        catch (const std::exception& ex)
+        {
+            call_failed(ex, arg_values);
+        }
+    }
+
+    [[gnu::noinline]] value iteration_form(const value& expr, stack_type* stack) const
+    {
+        const array& a = expr.as_array();
+        if (a[0] == sym_loop)
+        {
+            return loop_form(expr, stack);
+        }
+        if (a[0] == sym_while)
+        {
+            return while_form(a, stack);
+        }
+        return a[0] == sym_dotimes ? dotimes_form(a, stack) : doseq_form(a, stack);
+    }
+
+    // (loop ((name init)...) body): binds the names in a frame of its own, each init seeing the names before it, and
+    // evaluates body there. (recur values...) in tail position of body assigns the values to the names in place and
+    // evaluates body again. Every repetition is a step of the budget.
+    value loop_form(const value& expr, stack_type* stack) const
+    {
+        const array& a = expr.as_array();
+        const auto is_binding = [](const value& b)
+        { return b.is_array() && b.as_array().size() == 2 && b.as_array()[0].is_symbol(); };
+        if (a.size() != 3 || !a[1].is_array()
+            || !std::all_of(std::begin(a[1].as_array()), std::end(a[1].as_array()), is_binding))
+        {
+            throw std::runtime_error{ "loop: a list of (name value) pairs and a body required" };
+        }
+        const array& bindings = a[1].as_array();
+        const local_frame frame{ closure_info::of(expr), stack };
+        ++thread_stats().frames;
+        for (const value& b : bindings)
+        {
+            frame->frame.emplace(b.as_array()[0].as_symbol(), (*this)(b.as_array()[1], frame.get()));
+        }
+
+        budget* limits = current_budget();
+        arg_list next(current_resource());
+        next.reserve(bindings.size());
+        value result = {};
+        while (loop_tail(a[2], frame.get(), next, result))
+        {
+            if (next.size() != bindings.size())
+            {
+                throw std::runtime_error{ str("recur: ", bindings.size(), " values required, got ", next.size()) };
+            }
+            for (std::size_t i = 0; i < bindings.size(); ++i)
+            {
+                frame->frame.find(bindings[i].as_array()[0].as_symbol())->second = std::move(next[i]);
+            }
+            if (limits)
+            {
+                limits->tick();
+            }
+        }
+        return result;
+    }
+
+    // Evaluates `expr` in tail position of a loop body. Returns true if it ends in recur, with the values recur was given
+    // in `next`; otherwise sets `result` to its value.
+    bool loop_tail(const value& expr, stack_type* stack, arg_list& next, value& result) const
+    {
+        if (expr.is_array() && !expr.as_array().empty())
+        {
+            const array& a = expr.as_array();
+            if (a[0] == sym_recur)
+            {
+                next.clear();
+                for (std::size_t i = 1; i < a.size(); ++i)
                 {
-                    ss << "[" << i << "] " << arg_values[i] << " <" << arg_values[i].get_category() << ">"
-                       << "\n";
+                    next.push_back((*this)(a[i], stack));
                 }
-                throw std::runtime_error{ ss.str() };
+                return true;
+            }
+            if (a.size() == 4 && a[0] == sym_if)
+            {
+                return loop_tail((*this)(a[1], stack).as_boolean() ? a[2] : a[3], stack, next, result);
+            }
+            if (a.size() > 1 && a[0] == sym_begin)
+            {
+                for (std::size_t i = 1; i + 1 < a.size(); ++i)
+                {
+                    (*this)(a[i], stack);
+                }
+                return loop_tail(a.back(), stack, next, result);
+            }
+            if (a[0] == sym_cond)
+            {
+                for (const value& clause : iterator_range{ a } |= drop(1))
+                {
+                    const auto& pair = clause.as_array();
+                    if (pair.size() != 2)
+                    {
+                        throw std::runtime_error{ "cond: a list of pairs required" };
+                    }
+                    if ((*this)(pair[0], stack))
+                    {
+                        return loop_tail(pair[1], stack, next, result);
+                    }
+                }
+                throw std::runtime_error{ "cond: no match found" };
             }
         }
-        return expr;
+        result = (*this)(expr, stack);
+        return false;
+    }
+
+    // (while test body...): evaluates the body as long as test is true. Both run in the current frame, so let in the
+    // body updates what the test sees. Returns null; every repetition is a step of the budget.
+    value while_form(const array& a, stack_type* stack) const
+    {
+        if (a.size() < 3)
+        {
+            throw std::runtime_error{ "while: a test and a body required" };
+        }
+        budget* limits = current_budget();
+        while ((*this)(a[1], stack).as_boolean())
+        {
+            repeat_body(a, stack, limits);
+        }
+        return value{};
+    }
+
+    // (dotimes (name count) body...): evaluates the body with name bound to 0, 1, ..., count - 1 in the current frame,
+    // as by let. Returns null; every repetition is a step of the budget.
+    value dotimes_form(const array& a, stack_type* stack) const
+    {
+        const symbol& name = iteration_name(a, "dotimes: (name count) and a body required");
+        const value::integer_type count = (*this)(a[1].as_array()[1], stack).as_integer();
+        budget* limits = current_budget();
+        for (value::integer_type i = 0; i < count; ++i)
+        {
+            stack->insert(name, i);
+            repeat_body(a, stack, limits);
+        }
+        return value{};
+    }
+
+    // (doseq (name list) body...): evaluates the body with name bound to each element of list in turn, in the current
+    // frame, as by let. Returns null; every repetition is a step of the budget.
+    value doseq_form(const array& a, stack_type* stack) const
+    {
+        const symbol& name = iteration_name(a, "doseq: (name list) and a body required");
+        const value items = (*this)(a[1].as_array()[1], stack);
+        budget* limits = current_budget();
+        for (const value& item : items.as_array())
+        {
+            stack->insert(name, item);
+            repeat_body(a, stack, limits);
+        }
+        return value{};
+    }
+
+    static const symbol& iteration_name(const array& a, const char* usage)
+    {
+        if (a.size() < 3 || !a[1].is_array() || a[1].as_array().size() != 2 || !a[1].as_array()[0].is_symbol())
+        {
+            throw std::runtime_error{ usage };
+        }
+        return a[1].as_array()[0].as_symbol();
+    }
+
+    void repeat_body(const array& a, stack_type* stack, budget* limits) const
+    {
+        for (std::size_t i = 2; i < a.size(); ++i)
+        {
+            (*this)(a[i], stack);
+        }
+        if (limits)
+        {
+            limits->tick();
+        }
+    }
+
+    // (bench expr [min-ms]): evaluates expr repeatedly and returns the timing per run in nanoseconds, as a list of
+    // (name value) pairs. Every run is a step of the budget.
+    [[gnu::noinline]] value bench_form(const array& a, stack_type* stack) const
+    {
+        if (a.size() != 2 && a.size() != 3)
+        {
+            throw std::runtime_error{ "bench: an expression and optionally the minimal time in ms required" };
+        }
+        bench_options options;
+        if (a.size() == 3)
+        {
+            const value ms = (*this)(a[2], stack);
+            options.min_time = std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double, std::milli>{
+                ms.is_integer() ? ms.as_integer() : ms.as_floating_point() });
+        }
+        budget* limits = current_budget();
+        const bench_result r = bench(
+            [&]()
+            {
+                if (limits)
+                {
+                    limits->tick();
+                }
+                (*this)(a[1], stack);
+            },
+            options);
+        const auto ns = [](bench_clock::duration d) { return std::chrono::duration<double, std::nano>(d).count(); };
+        return array{ array{ symbol{ "runs" }, static_cast<double>(r.runs) },
+                      array{ symbol{ "samples" }, static_cast<double>(r.samples) },
+                      array{ symbol{ "median" }, ns(r.median) },
+                      array{ symbol{ "p99" }, ns(r.p99) },
+                      array{ symbol{ "mean" }, ns(r.mean) },
+                      array{ symbol{ "min" }, ns(r.min) },
+                      array{ symbol{ "allocations" }, r.allocations },
+                      array{ symbol{ "allocated_bytes" }, r.allocated_bytes } };
+    }
+
+    // (time expr): evaluates expr once and returns its value with the wall and CPU time in milliseconds.
+    [[gnu::noinline]] value time_form(const array& a, stack_type* stack) const
+    {
+        if (a.size() != 2)
+        {
+            throw std::runtime_error{ "time: one expression required" };
+        }
+        value result = {};
+        const time_result r = time_once([&]() { result = (*this)(a[1], stack); });
+        const auto ms = [](auto d) { return std::chrono::duration<double, std::milli>(d).count(); };
+        return array{ array{ symbol{ "value" }, std::move(result) },
+                      array{ symbol{ "wall" }, ms(r.wall) },
+                      array{ symbol{ "cpu" }, ms(r.cpu) } };
     }
 };
 
-value evaluate(const value& expr, stack_type* stack)
+// Names a top-level form in a trace by its first two elements, e.g. "(defun fib ...)".
+std::string describe_form(const value& expr)
+{
+    if (!expr.is_array() || expr.as_array().empty())
+    {
+        return str(expr);
+    }
+    const array& a = expr.as_array();
+    return a.size() == 1 ? str("(", a[0], ")") : str("(", a[0], " ", a[1], a.size() > 2 ? " ...)" : ")");
+}
+
+// Evaluates `form` as a top-level form: a span for the tracer and an entry named after the form it was expanded from,
+// `source`, for the profiler, whichever are given.
+value evaluate_form(const value& source, const value& form, stack_type* stack, profiler* prof, tracer* trace)
+{
+    const trace_span traced{ trace, tracer::span_kind::eval, [&]() { return describe_form(source); } };
+    if (prof)
+    {
+        prof->enter(describe_form(source));
+    }
+    const profiler_exit exit{ prof };
+    return evaluate_fn{}(form, stack);
+}
+
+bool is_begin(const value& expr)
+{
+    return expr.is_array() && !expr.as_array().empty() && expr.as_array()[0] == sym_begin;
+}
+
+// Out of line, so that the nested evaluations of lambda bodies do not carry its stack frame.
+[[gnu::noinline]] value evaluate_instrumented(
+    const value& source, const value& expr, stack_type* stack, profiler* prof, tracer* trace)
+{
+    if (!is_begin(expr))
+    {
+        return evaluate_form(source, expr, stack, prof, trace);
+    }
+    // The forms of a top-level begin are reported on their own, inside the begin's span, under the names they have in
+    // the source unless a macro made the begin.
+    const bool paired = is_begin(source) && source.as_array().size() == expr.as_array().size();
+    const trace_span traced{ trace, tracer::span_kind::eval, [&]() { return describe_form(source); } };
+    value result = {};
+    for (std::size_t i = 1; i < expr.as_array().size(); ++i)
+    {
+        const value& form = expr.as_array()[i];
+        result = evaluate_form(paired ? source.as_array()[i] : form, form, stack, prof, trace);
+    }
+    return result;
+}
+
+value evaluate_program(const value& source, const value& expr, stack_type* stack)
 {
+    const arena_scope scope;
+    if (scope.outermost())
+    {
+        profiler* prof = current_profiler();
+        tracer* trace = current_tracer();
+        if (prof || trace)
+        {
+            return evaluate_instrumented(source, expr, stack, prof, trace);
+        }
+    }
     return evaluate_fn{}(expr, stack);
 }
 
-}  // namespace lisp
\ No newline at end of file
+value evaluate(const value& expr, stack_type* stack)
+{
+    return evaluate_program(expr, expand(expr, *stack), stack);
+}
+
+value evaluate(const value& expr, stack_type* stack, budget& limits)
+{
+    const budget_scope scope{ limits };
+    return evaluate(expr, stack);
+}
+
+value evaluate_expanded(const value& expr, stack_type* stack)
+{
+    return evaluate_program(expr, expr, stack);
+}
+
+value apply_lambda(const value& form, const arg_list& args, const stack_type* globals)
+{
+    const auto& params = form.as_array()[1].as_array();
+    if (args.size() != params.size())
+    {
+        throw std::runtime_error{ str("Expected ", params.size(), " arguments, got ", args.size()) };
+    }
+    const local_frame frame{ closure_info::of(form), globals, nullptr };
+    ++thread_stats().frames;
+    for (std::size_t i = 0; i < params.size(); ++i)
+    {
+        frame->frame.emplace(params[i].as_symbol(), args[i]);
+    }
+    return evaluate_expanded(form.as_array()[2], frame.get());
+}
+
+value transfer(const value& v)
+{
+    std::optional<value> copy = transfer_copy{}(v);
+    return copy ? std::move(*copy) : v;
+}
+
+class expander
+{
+public:
+    explicit expander(const stack_type& globals) : m_globals{ globals }
+    {
+    }
+
+    value operator()(const value& expr)
+    {
+        if (!expr.is_array() || expr.as_array().empty() || expr.as_array()[0] == sym_quote)
+        {
+            return expr;
+        }
+        const array& a = expr.as_array();
+        if (a[0] == sym_defmacro)
+        {
+            return define(a);
+        }
+        if (const std::optional<array> expanded = do_apply_macro(a))
+        {
+            return (*this)(*expanded);
+        }
+        if (const value* m = a[0].is_symbol() ? find_macro(a[0].as_symbol()) : nullptr)
+        {
+            const arg_list args(std::next(std::begin(a)), std::end(a));
+            return (*this)(m->as_callable()(args));
+        }
+        // Only the arrays on the way to an expanded form are copied.
+        std::optional<array> result;
+        const std::size_t shadowed = m_shadowed.size();
+        if (is_lambda_form(expr) && a[1].is_array())
+        {
+            // Parameters are names, not calls, and hide macros of the same name in the body.
+            shadow(a[1].as_array());
+            expand_item(a, 2, result);
+        }
+        else if (a.size() == 3 && a[0] == sym_loop && a[1].is_array())
+        {
+            // Each init sees the names bound before it.
+            std::optional<array> bindings;
+            for (std::size_t i = 0; i < a[1].as_array().size(); ++i)
+            {
+                const value& b = a[1].as_array()[i];
+                if (b.is_array() && b.as_array().size() == 2 && b.as_array()[0].is_symbol())
+                {
+                    std::optional<array> binding;
+                    expand_item(b.as_array(), 1, binding);
+                    if (binding)
+                    {
+                        (bindings ? *bindings : bindings.emplace(a[1].as_array()))[i] = std::move(*binding);
+                    }
+                    m_shadowed.push_back(b.as_array()[0].as_symbol());
+                }
+            }
+            if (bindings)
+            {
+                (result ? *result : result.emplace(a))[1] = std::move(*bindings);
+            }
+            expand_item(a, 2, result);
+        }
+        else if ((a[0] == sym_dotimes || a[0] == sym_doseq) && a.size() > 1 && a[1].is_array()
+                 && a[1].as_array().size() == 2 && a[1].as_array()[0].is_symbol())
+        {
+            std::optional<array> binding;
+            expand_item(a[1].as_array(), 1, binding);
+            if (binding)
+            {
+                (result ? *result : result.emplace(a))[1] = std::move(*binding);
+            }
+            m_shadowed.push_back(a[1].as_array()[0].as_symbol());
+            for (std::size_t i = 2; i < a.size(); ++i)
+            {
+                expand_item(a, i, result);
+            }
+        }
+        else
+        {
+            for (std::size_t i = 0; i < a.size(); ++i)
+            {
+                expand_item(a, i, result);
+            }
+        }
+        m_shadowed.erase(m_shadowed.begin() + shadowed, m_shadowed.end());
+        return result ? value{ std::move(*result) } : expr;
+    }
+
+private:
+    // Expands a[i], copying `a` into `result` if it changes.
+    void expand_item(const array& a, std::size_t i, std::optional<array>& result)
+    {
+        value item = (*this)(a[i]);
+        if (item.is_array() && (!a[i].is_array() || &item.as_array() != &a[i].as_array()))
+        {
+            (result ? *result : result.emplace(a))[i] = std::move(item);
+        }
+    }
+
+    void shadow(const array& names)
+    {
+        for (const value& name : names)
+        {
+            if (name.is_symbol())
+            {
+                m_shadowed.push_back(name.as_symbol());
+            }
+        }
+    }
+
+    value define(const array& a)
+    {
+        if (a.size() != 4 || !a[1].is_symbol() || !a[2].is_array()
+            || !std::all_of(
+                std::begin(a[2].as_array()), std::end(a[2].as_array()), [](const value& p) { return p.is_symbol(); }))
+        {
+            throw std::runtime_error{ "defmacro: a name, a list of parameters and a body required" };
+        }
+        const symbol& name = a[1].as_symbol();
+        const std::size_t shadowed = m_shadowed.size();
+        shadow(a[2].as_array());
+        const value body = (*this)(a[3]);
+        m_shadowed.erase(m_shadowed.begin() + shadowed, m_shadowed.end());
+        const value m = callable{ macro{ a[2], body, &m_globals }, str(name), a[2].as_array().size() };
+        m_macros.insert_or_assign(name, m);
+        return array{ sym_let, a[1], m };
+    }
+
+    // Macros defined earlier in the expression hide those of the globals, and names bound around the form hide both.
+    const value* find_macro(const symbol& s) const
+    {
+        if (std::find(m_shadowed.begin(), m_shadowed.end(), s) != m_shadowed.end())
+        {
+            return nullptr;
+        }
+        const auto iter = m_macros.find(s);
+        if (iter != m_macros.end())
+        {
+            return &iter->second;
+        }
+        const value* v = m_globals.find(s);
+        return v && is_macro(*v) ? v : nullptr;
+    }
+
+    const stack_type& m_globals;
+    std::map<symbol, value> m_macros;
+    // The parameters and loop variables in scope.
+    std::vector<symbol> m_shadowed;
+};
+
+value expand(const value& expr, const stack_type& globals)
+{
+    return expander{ globals }(expr);
+}
+
+value expand(const value& expr)
+{
+    static const stack_type no_globals{ {} };
+    return expand(expr, no_globals);
+}
+
+bool is_macro(const value& v)
+{
+    return v.is_callable() && v.as_callable().fn().target<macro>() != nullptr;
+}
+
+}  // namespace lisp
@@ -0,0 +1,81 @@
+#include <lisp/inline_cache.hpp>
+#include <lisp/stats.hpp>
+
+namespace lisp
+{
+
+namespace
+{
+
+// Its address tells threads apart.
+thread_local const char thread_tag = 0;
+
+}  // namespace
+
+site_cache::site_cache(const site_cache&) : site_cache{}
+{
+}
+
+site_cache* site_cache::of(const value& form)
+{
+    site_cache& cache = static_cast<const array_storage&>(form.as_array()).cache;
+    const void* const self = &thread_tag;
+    const void* owner = cache.m_owner.load(std::memory_order_acquire);
+    if (owner == self || (!owner && cache.m_owner.compare_exchange_strong(owner, self)))
+    {
+        return &cache;
+    }
+    return nullptr;
+}
+
+const value& site_cache::lookup(const symbol& s, std::size_t index, std::size_t size, const stack_type& stack)
+{
+    if (!m_entries)
+    {
+        m_entries = std::make_unique<entry[]>(size);
+    }
+    entry& e = m_entries[index];
+    if (e.binding)
+    {
+        // A name added to a frame in between would hide the binding, so the walk stops at extended frames and global
+        // frames that changed. The frames are reached from the caller's, so they are all alive.
+        const stack_type* frame = &stack;
+        for (std::size_t i = 0; i < e.hops && frame && !frame->extended
+                                && (!frame->global || frame->version == e.passed_version);
+             ++i)
+        {
+            frame = frame->outer;
+        }
+        if (frame == e.home && frame->version == e.home_version)
+        {
+            ++thread_stats().cached_lookups;
+            return *e.binding;
+        }
+    }
+
+    ++thread_stats().lookups;
+    std::size_t hops = 0;
+    // Bindings behind more than one other global frame are not remembered.
+    std::size_t passed = 0;
+    std::uint64_t passed_version = 0;
+    for (const stack_type* frame = &stack; frame; frame = frame->outer, ++hops)
+    {
+        const auto iter = frame->frame.find(s);
+        if (iter != frame->frame.end())
+        {
+            if (frame->global && passed < 2)
+            {
+                e = entry{ frame, frame->version, passed_version, &iter->second, hops };
+            }
+            return iter->second;
+        }
+        if (frame->global)
+        {
+            ++passed;
+            passed_version = frame->version;
+        }
+    }
+    return stack.get(s);
+}
+
+}  // namespace lisp
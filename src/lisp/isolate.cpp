@@ -0,0 +1,133 @@
+#include <lisp/channel.hpp>
+#include <lisp/default_stack.hpp>
+#include <lisp/evaluate.hpp>
+#include <lisp/isolate.hpp>
+#include <lisp/scheduler.hpp>
+#include <chrono>
+#include <future>
+#include <list>
+#include <mutex>
+#include <thread>
+
+namespace lisp
+{
+
+namespace
+{
+
+// The threads of isolates, which are waited for at exit rather than left running while the statics they use are
+// destroyed. Channels are closed first, so that isolates waiting on them finish; those still running after a grace
+// period are left to the end of the process.
+class isolate_threads
+{
+public:
+    static isolate_threads& instance()
+    {
+        // Made after, and so destroyed before, the statics that isolates use.
+        prelude();
+        scheduler::instance();
+        static isolate_threads threads;
+        return threads;
+    }
+
+    template <class Fn>
+    void start(Fn fn)
+    {
+        const std::lock_guard lock{ m_mutex };
+        if (m_exiting)
+        {
+            throw std::runtime_error{ "isolate: the process is exiting" };
+        }
+        // Threads that have finished are joined as new ones start, so the list stays as long as the running ones.
+        for (auto iter = m_threads.begin(); iter != m_threads.end();)
+        {
+            if (iter->done.wait_for(std::chrono::seconds{ 0 }) == std::future_status::ready)
+            {
+                iter->thread.join();
+                iter = m_threads.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+        std::promise<void> done;
+        std::future<void> finished = done.get_future();
+        m_threads.push_back(entry{ std::thread{ [fn = std::move(fn), done = std::move(done)]() mutable
+                                                {
+                                                    fn();
+                                                    done.set_value();
+                                                } },
+                                   std::move(finished) });
+    }
+
+    ~isolate_threads()
+    {
+        // Threads are joined without the lock, which isolates that start others as they finish take.
+        std::list<entry> threads;
+        {
+            const std::lock_guard lock{ m_mutex };
+            m_exiting = true;
+            threads.swap(m_threads);
+        }
+        channel::close_all();
+        const auto deadline = std::chrono::steady_clock::now() + exit_grace_period;
+        for (entry& e : threads)
+        {
+            if (e.done.wait_until(deadline) == std::future_status::ready)
+            {
+                e.thread.join();
+            }
+            else
+            {
+                e.thread.detach();
+            }
+        }
+    }
+
+private:
+    struct entry
+    {
+        std::thread thread;
+        std::future<void> done;
+    };
+
+    static constexpr std::chrono::milliseconds exit_grace_period{ 1000 };
+
+    std::mutex m_mutex;
+    std::list<entry> m_threads;
+    bool m_exiting = false;
+};
+
+}  // namespace
+
+value spawn_isolate(value program, std::vector<value> args)
+{
+    // Sent as one value, so that closures among the arguments that share a frame share its copy.
+    value sent = transfer(array{ std::move(program), std::move(args) });
+    auto state = std::make_shared<task_state>();
+    isolate_threads::instance().start(
+        [sent = std::move(sent), state]()
+        {
+            try
+            {
+                stack_type stack = default_stack();
+                const array& parts = sent.as_array();
+                const array& call_args = parts.at(1).as_array();
+                const value fn = evaluate(parts.at(0), &stack);
+                state->set_value(fn.as_callable()(arg_list(std::begin(call_args), std::end(call_args))));
+            }
+            catch (...)
+            {
+                state->set_exception(std::current_exception());
+            }
+        });
+    return callable{ task_handle{ state }, "isolate", 0 };
+}
+
+value isolate::operator()(const arg_list& args) const
+{
+    return spawn_isolate(args.at(0), iterator_range{ args } |= drop(1));
+}
+
+}  // namespace lisp
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <lisp/memory.hpp>
+#include <lisp/utils/string_utils.hpp>
+#include <new>
+
+namespace lisp
+{
+
+namespace
+{
+
+thread_local std::shared_ptr<memory_account> active_account = nullptr;
+
+// Each block starts with a header that holds the account it was charged to.
+class accounted_heap_resource : public std::pmr::memory_resource
+{
+private:
+    using account_ptr = std::shared_ptr<memory_account>;
+
+    static std::size_t header_size(std::size_t alignment)
+    {
+        return (sizeof(account_ptr) + alignment - 1) / alignment * alignment;
+    }
+
+    static std::size_t block_alignment(std::size_t alignment)
+    {
+        return std::max(alignment, alignof(account_ptr));
+    }
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        const std::size_t header = header_size(alignment);
+        account_ptr account = active_account;
+        if (account)
+        {
+            account->allocate(header + bytes);
+        }
+        void* block = nullptr;
+        try
+        {
+            block = std::pmr::new_delete_resource()->allocate(header + bytes, block_alignment(alignment));
+        }
+        catch (...)
+        {
+            if (account)
+            {
+                account->deallocate(header + bytes);
+            }
+            throw;
+        }
+        new (block) account_ptr{ std::move(account) };
+        return static_cast<std::byte*>(block) + header;
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override
+    {
+        const std::size_t header = header_size(alignment);
+        void* const block = static_cast<std::byte*>(ptr) - header;
+        account_ptr* const holder = std::launder(static_cast<account_ptr*>(block));
+        const account_ptr account = std::move(*holder);
+        holder->~account_ptr();
+        std::pmr::new_delete_resource()->deallocate(block, header + bytes, block_alignment(alignment));
+        if (account)
+        {
+            account->deallocate(header + bytes);
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+}  // namespace
+
+memory_account::memory_account(std::optional<std::size_t> quota) : m_quota{ quota }, m_live{ 0 }, m_peak{ 0 }
+{
+}
+
+void memory_account::allocate(std::size_t bytes)
+{
+    std::size_t live = m_live.load(std::memory_order_relaxed);
+    do
+    {
+        if (m_quota && live + bytes > *m_quota)
+        {
+            throw memory_limit_exceeded{ str("Memory limit of ", *m_quota, " bytes exceeded (", live, " bytes live)") };
+        }
+    } while (!m_live.compare_exchange_weak(live, live + bytes, std::memory_order_relaxed));
+
+    std::size_t peak = m_peak.load(std::memory_order_relaxed);
+    while (peak < live + bytes && !m_peak.compare_exchange_weak(peak, live + bytes, std::memory_order_relaxed))
+    {
+    }
+}
+
+void memory_account::deallocate(std::size_t bytes) noexcept
+{
+    std::size_t live = m_live.load(std::memory_order_relaxed);
+    while (!m_live.compare_exchange_weak(live, live - std::min(bytes, live), std::memory_order_relaxed))
+    {
+    }
+}
+
+std::size_t memory_account::live() const
+{
+    return m_live.load(std::memory_order_relaxed);
+}
+
+std::size_t memory_account::peak() const
+{
+    return m_peak.load(std::memory_order_relaxed);
+}
+
+const std::optional<std::size_t>& memory_account::quota() const
+{
+    return m_quota;
+}
+
+memory_scope::memory_scope(std::shared_ptr<memory_account> account) : m_previous{ std::move(active_account) }
+{
+    active_account = std::move(account);
+}
+
+memory_scope::~memory_scope()
+{
+    active_account = std::move(m_previous);
+}
+
+const std::shared_ptr<memory_account>& current_account()
+{
+    return active_account;
+}
+
+std::pmr::memory_resource* accounted_resource()
+{
+    // Never destroyed, so that frames in statics can still free their bindings at exit.
+    static accounted_heap_resource* const instance = new accounted_heap_resource{};
+    return instance;
+}
+
+}  // namespace lisp
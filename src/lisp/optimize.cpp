@@ -0,0 +1,674 @@
+#include <lisp/evaluate.hpp>
+#include <lisp/functions.hpp>
+#include <lisp/optimize.hpp>
+#include <lisp/special_forms.hpp>
+#include <map>
+#include <optional>
+#include <set>
+
+namespace lisp
+{
+
+namespace
+{
+
+using symbol_set = std::set<symbol>;
+
+// Bodies up to this many nodes are inlined.
+constexpr std::size_t max_inline_size = 24;
+
+bool is_form(const value& expr, const symbol& head)
+{
+    return expr.is_array() && !expr.as_array().empty() && expr.as_array()[0] == head;
+}
+
+bool is_lambda_expression(const value& expr)
+{
+    return is_form(expr, sym_lambda) && expr.as_array().size() == 3 && expr.as_array()[1].is_array()
+           && std::all_of(
+               std::begin(expr.as_array()[1].as_array()),
+               std::end(expr.as_array()[1].as_array()),
+               [](const value& p) { return p.is_symbol(); });
+}
+
+bool is_let(const value& expr)
+{
+    return is_form(expr, sym_let) && expr.as_array().size() == 3 && expr.as_array()[1].is_symbol();
+}
+
+// The (name expr) pair of dotimes and doseq.
+bool is_iteration_binding(const array& a)
+{
+    return (a[0] == sym_dotimes || a[0] == sym_doseq) && a.size() > 1 && a[1].is_array() && a[1].as_array().size() == 2
+           && a[1].as_array()[0].is_symbol();
+}
+
+// Literals, quoted data and builtins: evaluating them has no effect and always gives the same value.
+bool is_constant(const value& expr)
+{
+    return (!expr.is_symbol() && !expr.is_array()) || (is_form(expr, sym_quote) && expr.as_array().size() == 2);
+}
+
+const value& constant_value(const value& expr)
+{
+    return expr.is_array() ? expr.as_array()[1] : expr;
+}
+
+value constant_expression(value v)
+{
+    return v.is_array() || v.is_symbol() ? value{ array{ sym_quote, std::move(v) } } : v;
+}
+
+std::size_t size_of(const value& expr)
+{
+    if (!expr.is_array())
+    {
+        return 1;
+    }
+    std::size_t result = 1;
+    for (const value& item : expr.as_array())
+    {
+        result += size_of(item);
+    }
+    return result;
+}
+
+// Whether a form in `expr` binds names, which could capture the names substituted into it.
+bool binds_names(const value& expr)
+{
+    if (!expr.is_array() || expr.as_array().empty() || is_form(expr, sym_quote))
+    {
+        return false;
+    }
+    const array& a = expr.as_array();
+    if (a[0] == sym_let || a[0] == sym_lambda || a[0] == sym_defun || a[0] == sym_loop || a[0] == sym_dotimes
+        || a[0] == sym_doseq)
+    {
+        return true;
+    }
+    return std::any_of(std::begin(a), std::end(a), binds_names);
+}
+
+void collect_free(const value& expr, symbol_set& result)
+{
+    if (expr.is_symbol())
+    {
+        result.insert(expr.as_symbol());
+    }
+    else if (expr.is_array() && !is_form(expr, sym_quote))
+    {
+        for (const value& item : expr.as_array())
+        {
+            collect_free(item, result);
+        }
+    }
+}
+
+value substitute(const value& expr, const std::map<symbol, value>& args)
+{
+    if (expr.is_symbol())
+    {
+        const auto iter = args.find(expr.as_symbol());
+        return iter != args.end() ? iter->second : expr;
+    }
+    if (!expr.is_array() || is_form(expr, sym_quote))
+    {
+        return expr;
+    }
+    array result;
+    result.reserve(expr.as_array().size());
+    for (const value& item : expr.as_array())
+    {
+        result.push_back(substitute(item, args));
+    }
+    return result;
+}
+
+// Builtins without side effects, which are called here when all their arguments are constants.
+bool is_pure(const callable& fn)
+{
+    if (!fn.bound_args().empty())
+    {
+        return false;
+    }
+    const callable::function_type& f = fn.fn();
+    const auto is = [&](auto op) { return f.target<decltype(op)>() != nullptr; };
+    return is(binary{ std::plus<>{} }) || is(binary{ std::minus<>{} }) || is(binary{ std::multiplies<>{} })
+           || is(binary{ std::divides<>{} }) || is(binary{ std::modulus<>{} }) || is(binary{ std::equal_to<>{} })
+           || is(binary{ std::not_equal_to<>{} }) || is(binary{ std::less<>{} }) || is(binary{ std::less_equal<>{} })
+           || is(binary{ std::greater<>{} }) || is(binary{ std::greater_equal<>{} }) || is(car{}) || is(cdr{})
+           || is(cons{}) || is(list{}) || is(seq_rev{}) || is(seq_at{}) || is(str_cat{}) || is(str_has_prefix{})
+           || is(str_has_suffix{});
+}
+
+// Integer division by zero is undefined behavior, so it is left to fail, or not, where it always did.
+bool divides_by_zero(const callable& fn, const arg_list& args)
+{
+    const callable::function_type& f = fn.fn();
+    const bool division
+        = f.target<binary<std::divides<>>>() != nullptr || f.target<binary<std::modulus<>>>() != nullptr;
+    return division && args.size() == 2 && args[0].is_integer() && args[1].is_integer() && args[1].as_integer() == 0;
+}
+
+// The category a builtin requires of argument `i`, where it requires one.
+std::optional<category> required_category(const callable& fn, std::size_t i)
+{
+    const callable::function_type& f = fn.fn();
+    const auto is = [&](auto op) { return f.target<decltype(op)>() != nullptr; };
+    if (is(car{}) || is(cdr{}) || is(seq_rev{}))
+    {
+        return i == 0 ? std::optional{ category::array } : std::nullopt;
+    }
+    if (is(seq_map{}) || is(seq_filter{}) || is(seq_at{}))
+    {
+        return i == 0 ? (is(seq_at{}) ? category::integer : category::callable) : category::array;
+    }
+    if (is(str_has_prefix{}) || is(str_has_suffix{}))
+    {
+        return category::string;
+    }
+    if (is(partial{}) && i == 0)
+    {
+        return category::callable;
+    }
+    return {};
+}
+
+// The category of every result of a builtin, where there is one.
+std::optional<category> result_category(const callable& fn)
+{
+    const callable::function_type& f = fn.fn();
+    const auto is = [&](auto op) { return f.target<decltype(op)>() != nullptr; };
+    if (is(list{}) || is(cons{}) || is(cdr{}) || is(seq_map{}) || is(seq_filter{}) || is(seq_rev{}))
+    {
+        return category::array;
+    }
+    if (is(binary{ std::equal_to<>{} }) || is(binary{ std::not_equal_to<>{} }) || is(binary{ std::less<>{} })
+        || is(binary{ std::less_equal<>{} }) || is(binary{ std::greater<>{} }) || is(binary{ std::greater_equal<>{} })
+        || is(str_has_prefix{}) || is(str_has_suffix{}))
+    {
+        return category::boolean;
+    }
+    if (is(str_cat{}))
+    {
+        return category::string;
+    }
+    return {};
+}
+
+// The category an optimized expression evaluates to, where that is known without evaluating it.
+std::optional<category> category_of(const value& expr)
+{
+    if (is_constant(expr))
+    {
+        return constant_value(expr).get_category();
+    }
+    if (is_lambda_expression(expr))
+    {
+        return category::callable;
+    }
+    if (expr.is_array() && !expr.as_array().empty() && expr.as_array()[0].is_callable())
+    {
+        // Too few arguments make a callable that waits for the rest.
+        const callable& fn = expr.as_array()[0].as_callable();
+        const std::optional<std::size_t> arity = fn.arity();
+        if (fn.bound_args().empty() && (!arity || *arity == expr.as_array().size() - 1))
+        {
+            return result_category(fn);
+        }
+    }
+    return {};
+}
+
+class optimizer
+{
+public:
+    optimizer(const value& expr, const stack_type& globals) : m_globals{ globals }
+    {
+        collect_bound(expr, false);
+        if (!is_form(expr, sym_begin))
+        {
+            return;
+        }
+        // A function bound once in the whole expression, not only among the top-level forms, is known wherever it is
+        // called after its definition.
+        const array& forms = expr.as_array();
+        for (std::size_t i = 1; i < forms.size(); ++i)
+        {
+            const value& form = forms[i];
+            if (!is_let(form) || !is_lambda_expression(form.as_array()[2]))
+            {
+                continue;
+            }
+            const symbol& name = form.as_array()[1].as_symbol();
+            const array& lambda = form.as_array()[2].as_array();
+            if (m_lets[name] != 1 || m_local.count(name))
+            {
+                continue;
+            }
+            m_functions.emplace(name, candidate{ &lambda, i });
+            if (can_inline(lambda, name))
+            {
+                m_candidates.emplace(name, candidate{ &lambda, i });
+            }
+        }
+    }
+
+    value run(const value& expr)
+    {
+        if (!is_form(expr, sym_begin))
+        {
+            return (*this)(expr);
+        }
+        // The forms of a top-level begin are numbered, so that only calls after a definition are inlined.
+        array result{ expr.as_array()[0] };
+        for (m_form = 1; m_form < expr.as_array().size(); ++m_form)
+        {
+            result.push_back((*this)(expr.as_array()[m_form]));
+        }
+        m_form = 0;
+        return simplify_begin(result);
+    }
+
+private:
+    struct candidate
+    {
+        const array* lambda;
+        std::size_t form;
+    };
+
+    // Lambda parameters, loop variables and let targets are bound; those inside lambdas, and loop variables, are also
+    // local, i.e. not globals.
+    void collect_bound(const value& expr, bool in_lambda)
+    {
+        if (!expr.is_array() || expr.as_array().empty() || is_form(expr, sym_quote))
+        {
+            return;
+        }
+        const array& a = expr.as_array();
+        if (is_let(expr) || is_iteration_binding(a))
+        {
+            const symbol& name = is_let(expr) ? a[1].as_symbol() : a[1].as_array()[0].as_symbol();
+            m_bound.insert(name);
+            ++m_lets[name];
+            if (in_lambda)
+            {
+                m_local.insert(name);
+            }
+        }
+        if (a[0] == sym_loop && a.size() == 3 && a[1].is_array())
+        {
+            for (const value& b : a[1].as_array())
+            {
+                if (b.is_array() && !b.as_array().empty() && b.as_array()[0].is_symbol())
+                {
+                    m_bound.insert(b.as_array()[0].as_symbol());
+                    m_local.insert(b.as_array()[0].as_symbol());
+                }
+            }
+        }
+        const bool lambda = a.size() == 3 && a[0] == sym_lambda && a[1].is_array();
+        if (lambda)
+        {
+            for (const value& param : a[1].as_array())
+            {
+                if (param.is_symbol())
+                {
+                    m_bound.insert(param.as_symbol());
+                    m_local.insert(param.as_symbol());
+                }
+            }
+        }
+        for (const value& item : a)
+        {
+            collect_bound(item, in_lambda || lambda);
+        }
+    }
+
+    // The body is substituted where the lambda is called, so its free names must mean there what they meant where the
+    // lambda was made: globals, never rebound locally.
+    bool can_inline(const array& lambda, const symbol& name) const
+    {
+        const value& body = lambda[2];
+        if (size_of(body) > max_inline_size || binds_names(body))
+        {
+            return false;
+        }
+        symbol_set free;
+        collect_free(body, free);
+        std::set<symbol> params;
+        for (const value& p : lambda[1].as_array())
+        {
+            params.insert(p.as_symbol());
+        }
+        return std::none_of(
+            std::begin(free),
+            std::end(free),
+            [&](const symbol& s) { return s == name || (!params.count(s) && m_local.count(s)); });
+    }
+
+    const value* builtin(const symbol& s) const
+    {
+        if (m_bound.count(s))
+        {
+            return nullptr;
+        }
+        const value* v = m_globals.find(s);
+        return v && v == prelude().find(s) ? v : nullptr;
+    }
+
+    value operator()(const value& expr)
+    {
+        if (expr.is_symbol())
+        {
+            const value* v = builtin(expr.as_symbol());
+            return v ? *v : expr;
+        }
+        if (!expr.is_array() || expr.as_array().empty())
+        {
+            return expr;
+        }
+        const array& a = expr.as_array();
+        if (a[0] == sym_quote)
+        {
+            return expr;
+        }
+        if (a[0] == sym_let && a.size() == 3)
+        {
+            return array{ a[0], a[1], (*this)(a[2]) };
+        }
+        if (a[0] == sym_lambda && a.size() == 3)
+        {
+            return array{ a[0], a[1], conditional(a[2]) };
+        }
+        // The names bound by loops are left as they are.
+        if (a[0] == sym_loop && a.size() == 3 && a[1].is_array())
+        {
+            array bindings;
+            for (const value& b : a[1].as_array())
+            {
+                const bool pair = b.is_array() && b.as_array().size() == 2;
+                bindings.push_back(pair ? value{ array{ b.as_array()[0], (*this)(b.as_array()[1]) } } : b);
+            }
+            return array{ a[0], std::move(bindings), (*this)(a[2]) };
+        }
+        if (is_iteration_binding(a))
+        {
+            array result{ a[0], array{ a[1].as_array()[0], (*this)(a[1].as_array()[1]) } };
+            for (const value& item : iterator_range{ a } |= drop(2))
+            {
+                result.push_back(conditional(item));
+            }
+            return result;
+        }
+        if (a[0] == sym_if && a.size() == 4)
+        {
+            const value test = (*this)(a[1]);
+            if (test.is_boolean())
+            {
+                return (*this)(test.as_boolean() ? a[2] : a[3]);
+            }
+            return array{ a[0], test, conditional(a[2]), conditional(a[3]) };
+        }
+        if (a[0] == sym_cond)
+        {
+            return simplify_cond(a);
+        }
+        if (a[0] == sym_begin)
+        {
+            array result{ a[0] };
+            for (const value& form : iterator_range{ a } |= drop(1))
+            {
+                result.push_back((*this)(form));
+            }
+            return simplify_begin(result);
+        }
+        if (a[0] == sym_while)
+        {
+            array result{ a[0] };
+            for (std::size_t i = 1; i < a.size(); ++i)
+            {
+                result.push_back(i == 1 ? (*this)(a[i]) : conditional(a[i]));
+            }
+            return result;
+        }
+        if (a[0].is_symbol() && is_special_form(a[0].as_symbol()))
+        {
+            array result{ a[0] };
+            for (const value& item : iterator_range{ a } |= drop(1))
+            {
+                result.push_back((*this)(item));
+            }
+            return result;
+        }
+        return call(a);
+    }
+
+    value call(const array& a)
+    {
+        array args;
+        for (const value& arg : iterator_range{ a } |= drop(1))
+        {
+            args.push_back((*this)(arg));
+        }
+        if (a[0].is_symbol())
+        {
+            const auto iter = m_candidates.find(a[0].as_symbol());
+            if (iter != m_candidates.end() && m_form > iter->second.form)
+            {
+                if (std::optional<value> body = inline_call(*iter->second.lambda, args))
+                {
+                    return *body;
+                }
+            }
+        }
+        else if (is_lambda_expression(a[0]) && !binds_names(a[0].as_array()[2]))
+        {
+            if (std::optional<value> body = inline_call(a[0].as_array(), args))
+            {
+                return *body;
+            }
+        }
+        value head = (*this)(a[0]);
+        if (m_conditional == 0)
+        {
+            check_call(head, args);
+        }
+        if (head.is_callable() && is_pure(head.as_callable())
+            && std::all_of(std::begin(args), std::end(args), is_constant))
+        {
+            arg_list values;
+            for (const value& arg : args)
+            {
+                values.push_back(constant_value(arg));
+            }
+            // Integer division by zero is left for the evaluation; any other error is one it would raise too, but only
+            // if the call is sure to be evaluated.
+            if (!divides_by_zero(head.as_callable(), values))
+            {
+                try
+                {
+                    return constant_expression(head.as_callable().call(values));
+                }
+                catch (const std::exception& ex)
+                {
+                    if (m_conditional == 0)
+                    {
+                        throw std::runtime_error{ str("On calling ", head.as_callable().name(), ": ", ex.what()) };
+                    }
+                }
+            }
+        }
+        const std::optional<std::size_t> arity = head.is_callable() ? head.as_callable().arity() : std::nullopt;
+        if (arity && args.size() == *arity)
+        {
+            head = head.as_callable().unchecked();
+        }
+        args.insert(std::begin(args), head);
+        return args;
+    }
+
+    // Calls that fail however they are reached, with too many arguments or with an argument of a category the builtin
+    // called does not take, are reported here, with the message evaluating them would give. Only calls that are sure to
+    // be evaluated are checked; the others may never run.
+    void check_call(const value& head, const array& args) const
+    {
+        std::optional<std::size_t> arity;
+        std::string name;
+        if (head.is_callable() && head.as_callable().bound_args().empty())
+        {
+            arity = head.as_callable().arity();
+            name = head.as_callable().name();
+        }
+        else if (is_lambda_expression(head))
+        {
+            arity = head.as_array()[1].as_array().size();
+            name = str("lambda [", *arity, "]");
+        }
+        else if (head.is_symbol())
+        {
+            // A function's body runs once it is bound, so calls in it are checked too.
+            const auto iter = m_functions.find(head.as_symbol());
+            if (iter != m_functions.end() && m_form >= iter->second.form)
+            {
+                arity = (*iter->second.lambda)[1].as_array().size();
+                name = str(head);
+            }
+        }
+        if (arity && args.size() > *arity)
+        {
+            throw std::runtime_error{ str("On calling ", name, ": Expected ", *arity, " arguments, got ", args.size()) };
+        }
+        if (!head.is_callable() || !head.as_callable().bound_args().empty())
+        {
+            return;
+        }
+        for (std::size_t i = 0; i < args.size(); ++i)
+        {
+            const std::optional<category> required = required_category(head.as_callable(), i);
+            const std::optional<category> actual = required ? category_of(args[i]) : std::nullopt;
+            if (actual && *actual != *required)
+            {
+                throw std::runtime_error{ str("On calling ", name, ": accessing: ", *required, ", actual: ", *actual) };
+            }
+        }
+    }
+
+    // Arguments are evaluated once before a call, so only those that may be evaluated any number of times instead
+    // are substituted: constants, and names, which the body cannot rebind.
+    std::optional<value> inline_call(const array& lambda, const array& args)
+    {
+        const array& params = lambda[1].as_array();
+        const bool substitutable = std::all_of(
+            std::begin(args), std::end(args), [](const value& arg) { return is_constant(arg) || arg.is_symbol(); });
+        if (params.size() != args.size() || !substitutable
+            || std::find(std::begin(m_inlining), std::end(m_inlining), &lambda) != std::end(m_inlining))
+        {
+            return {};
+        }
+        std::map<symbol, value> bindings;
+        for (std::size_t i = 0; i < params.size(); ++i)
+        {
+            bindings.emplace(params[i].as_symbol(), args[i]);
+        }
+        m_inlining.push_back(&lambda);
+        value result = (*this)(substitute(lambda[2], bindings));
+        m_inlining.pop_back();
+        return result;
+    }
+
+    // Optimizes a form that may not be evaluated: a branch, a loop body that may run no times or a lambda body.
+    value conditional(const value& expr)
+    {
+        ++m_conditional;
+        value result = (*this)(expr);
+        --m_conditional;
+        return result;
+    }
+
+    // Clauses with a constant test are dropped if it is false and end the cond if it is true.
+    value simplify_cond(const array& a)
+    {
+        array result{ a[0] };
+        for (const value& clause : iterator_range{ a } |= drop(1))
+        {
+            if (!clause.is_array() || clause.as_array().size() != 2)
+            {
+                result.push_back(clause);
+                continue;
+            }
+            // Only the first test is sure to be evaluated.
+            const value test = result.size() == 1 ? (*this)(clause.as_array()[0]) : conditional(clause.as_array()[0]);
+            if (is_constant(test) && !static_cast<bool>(constant_value(test)))
+            {
+                continue;
+            }
+            const value branch = conditional(clause.as_array()[1]);
+            if (is_constant(test))
+            {
+                if (result.size() == 1)
+                {
+                    return branch;
+                }
+                result.push_back(array{ true, branch });
+                break;
+            }
+            result.push_back(array{ test, branch });
+        }
+        return result;
+    }
+
+    // Nested begin forms are spliced in, and constants whose value is not the result are dropped.
+    static value simplify_begin(const array& a)
+    {
+        array forms;
+        for (const value& form : iterator_range{ a } |= drop(1))
+        {
+            if (is_form(form, sym_begin))
+            {
+                forms.insert(std::end(forms), std::next(std::begin(form.as_array())), std::end(form.as_array()));
+            }
+            else
+            {
+                forms.push_back(form);
+            }
+        }
+        array result{ a[0] };
+        for (std::size_t i = 0; i < forms.size(); ++i)
+        {
+            if (i + 1 == forms.size() || !is_constant(forms[i]))
+            {
+                result.push_back(forms[i]);
+            }
+        }
+        if (result.size() == 1)
+        {
+            return value{};
+        }
+        return result.size() == 2 ? result[1] : value{ result };
+    }
+
+    const stack_type& m_globals;
+    symbol_set m_bound;
+    symbol_set m_local;
+    // How many times each name is bound by let, dotimes or doseq.
+    std::map<symbol, int> m_lets;
+    // The lambdas bound at the top level, and by nothing else, by name.
+    std::map<symbol, candidate> m_functions;
+    std::map<symbol, candidate> m_candidates;
+    std::vector<const array*> m_inlining;
+    // The top-level form being optimized, counting from 1; 0 outside of a top-level begin.
+    std::size_t m_form = 0;
+    // How many branches, loop bodies and lambda bodies the form being optimized is in.
+    std::size_t m_conditional = 0;
+};
+
+}  // namespace
+
+value optimize(const value& expr, const stack_type& globals)
+{
+    const value expanded = expand(expr, globals);
+    return optimizer{ expanded, globals }.run(expanded);
+}
+
+}  // namespace lisp
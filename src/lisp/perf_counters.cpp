@@ -0,0 +1,150 @@
+#include <lisp/perf_counters.hpp>
+#include <lisp/utils/string_utils.hpp>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace lisp
+{
+
+double hardware_counts::ipc() const
+{
+    return cycles > 0 ? static_cast<double>(instructions) / static_cast<double>(cycles) : 0.0;
+}
+
+hardware_counts& hardware_counts::operator+=(const hardware_counts& other)
+{
+    cycles += other.cycles;
+    instructions += other.instructions;
+    cache_misses += other.cache_misses;
+    branch_misses += other.branch_misses;
+    return *this;
+}
+
+hardware_counts operator-(const hardware_counts& lhs, const hardware_counts& rhs)
+{
+    return hardware_counts{ lhs.cycles - rhs.cycles,
+                            lhs.instructions - rhs.instructions,
+                            lhs.cache_misses - rhs.cache_misses,
+                            lhs.branch_misses - rhs.branch_misses };
+}
+
+#ifdef __linux__
+
+namespace
+{
+
+constexpr std::array<std::uint64_t, 4> events = { PERF_COUNT_HW_CPU_CYCLES,
+                                                  PERF_COUNT_HW_INSTRUCTIONS,
+                                                  PERF_COUNT_HW_CACHE_MISSES,
+                                                  PERF_COUNT_HW_BRANCH_MISSES };
+
+int open_event(std::uint64_t config, int group_fd)
+{
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group_fd == -1 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC));
+}
+
+}  // namespace
+
+perf_counters::perf_counters() : m_fds{ -1, -1, -1, -1 }, m_error{}
+{
+    // One group, so that all four are scheduled onto the PMU together and read in one go.
+    for (std::size_t i = 0; i < events.size(); ++i)
+    {
+        m_fds[i] = open_event(events[i], m_fds[0]);
+        if (m_fds[i] < 0)
+        {
+            m_error = str("perf_event_open: ", std::strerror(errno));
+            close();
+            return;
+        }
+    }
+    ::ioctl(m_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ::ioctl(m_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+perf_counters::~perf_counters()
+{
+    close();
+}
+
+void perf_counters::close()
+{
+    for (int& fd : m_fds)
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        fd = -1;
+    }
+}
+
+bool perf_counters::available() const
+{
+    return m_fds[0] >= 0;
+}
+
+hardware_counts perf_counters::read() const
+{
+    if (!available())
+    {
+        return {};
+    }
+    struct
+    {
+        std::uint64_t count;
+        std::uint64_t values[4];
+    } data = {};
+    if (::read(m_fds[0], &data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)) || data.count != 4)
+    {
+        return {};
+    }
+    return hardware_counts{ data.values[0], data.values[1], data.values[2], data.values[3] };
+}
+
+#else
+
+perf_counters::perf_counters() : m_fds{ -1, -1, -1, -1 }, m_error{ "perf_event_open is only available on Linux" }
+{
+}
+
+perf_counters::~perf_counters() = default;
+
+void perf_counters::close()
+{
+}
+
+bool perf_counters::available() const
+{
+    return false;
+}
+
+hardware_counts perf_counters::read() const
+{
+    return {};
+}
+
+#endif
+
+const std::string& perf_counters::error() const
+{
+    return m_error;
+}
+
+}  // namespace lisp
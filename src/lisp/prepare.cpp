@@ -0,0 +1,180 @@
+#include <lisp/evaluate.hpp>
+#include <lisp/optimize.hpp>
+#include <lisp/prepare.hpp>
+#include <lisp/special_forms.hpp>
+#include <set>
+
+namespace lisp
+{
+
+namespace
+{
+
+using symbol_set = std::set<symbol>;
+
+// Names that may be bound while the expression runs: parameters of any lambda, variables of any loop and targets of
+// any let in it.
+void collect_bound(const value& expr, symbol_set& bound)
+{
+    if (!expr.is_array())
+    {
+        return;
+    }
+    const auto& a = expr.as_array();
+    if (a.empty() || a[0] == sym_quote)
+    {
+        return;
+    }
+    if (a.size() == 3 && a[0] == sym_let && a[1].is_symbol())
+    {
+        bound.insert(a[1].as_symbol());
+    }
+    if (a.size() == 3 && a[0] == sym_lambda && a[1].is_array())
+    {
+        for (const value& param : a[1].as_array())
+        {
+            bound.insert(param.as_symbol());
+        }
+    }
+    // The (name expr) pairs of loop, dotimes and doseq.
+    const auto bind_pair = [&](const value& pair)
+    {
+        if (pair.is_array() && !pair.as_array().empty() && pair.as_array()[0].is_symbol())
+        {
+            bound.insert(pair.as_array()[0].as_symbol());
+        }
+    };
+    if (a.size() == 3 && a[0] == sym_loop && a[1].is_array())
+    {
+        std::for_each(std::begin(a[1].as_array()), std::end(a[1].as_array()), bind_pair);
+    }
+    if (a.size() > 1 && (a[0] == sym_dotimes || a[0] == sym_doseq))
+    {
+        bind_pair(a[1]);
+    }
+    for (const value& item : a)
+    {
+        collect_bound(item, bound);
+    }
+}
+
+value resolve(const value& expr, const symbol_set& bound, const stack_type& globals)
+{
+    if (expr.is_symbol())
+    {
+        const auto& s = expr.as_symbol();
+        if (is_special_form(s) || bound.count(s))
+        {
+            return expr;
+        }
+        const value* v = globals.find(s);
+        if (!v)
+        {
+            return expr;
+        }
+        return v->is_array() || v->is_symbol() ? value{ array{ sym_quote, *v } } : *v;
+    }
+    if (!expr.is_array())
+    {
+        return expr;
+    }
+    const auto& a = expr.as_array();
+    if (a.empty() || a[0] == sym_quote)
+    {
+        return expr;
+    }
+    array result = a;
+    // The binding positions of let and lambda are names, not references.
+    const std::size_t first = (a.size() == 3 && (a[0] == sym_let || a[0] == sym_lambda)) ? 2 : 0;
+    for (std::size_t i = first; i < result.size(); ++i)
+    {
+        result[i] = resolve(result[i], bound, globals);
+    }
+    return result;
+}
+
+struct scratch_stack
+{
+    stack_type stack{ {} };
+    bool busy = false;
+};
+
+thread_local scratch_stack scratch = {};
+
+}  // namespace
+
+prepared::prepared(const value& expr, std::vector<symbol> params, const stack_type* globals)
+{
+    const value expanded = expand(expr, *globals);
+    symbol_set bound{ std::begin(params), std::end(params) };
+    collect_bound(expanded, bound);
+    // Optimized as the body of a lambda, so that the parameters are bound there.
+    const value lambda = optimize(
+        array{ sym_lambda, array(std::begin(params), std::end(params)), resolve(expanded, bound, *globals) }, *globals);
+    m_state = std::make_shared<const state>(state{ lambda, &closure_info::of(lambda), std::move(params), globals });
+}
+
+value prepared::call(const std::vector<value>& args) const
+{
+    const state& s = *m_state;
+    if (args.size() != s.params.size())
+    {
+        throw std::runtime_error{ str("Expected ", s.params.size(), " arguments, got ", args.size()) };
+    }
+
+    // A nested call on the same thread cannot take over the frame its caller is still using, and closures that may
+    // keep the frame after the call need one of their own.
+    if (scratch.busy || s.info->shared)
+    {
+        return apply_lambda(s.lambda, arg_list(args.begin(), args.end()), s.globals);
+    }
+
+    struct busy_guard
+    {
+        busy_guard()
+        {
+            scratch.busy = true;
+        }
+        ~busy_guard()
+        {
+            scratch.busy = false;
+        }
+    } guard;
+
+    // Rebinding existing keys reuses the map nodes; only names left over from a different parameter list, or bound
+    // by let during the previous call, have to be dropped.
+    auto& frame = scratch.stack.frame;
+    for (std::size_t i = 0; i < args.size(); ++i)
+    {
+        frame.insert_or_assign(s.params[i], args[i]);
+    }
+    if (frame.size() != s.params.size())
+    {
+        const symbol_set keep{ std::begin(s.params), std::end(s.params) };
+        for (auto it = frame.begin(); it != frame.end();)
+        {
+            it = keep.count(it->first) ? std::next(it) : frame.erase(it);
+        }
+    }
+    scratch.stack.outer = s.globals;
+    // Closures copy the variables they use out of the frame, which the next call rebinds.
+    scratch.stack.assigned = &s.info->assigned;
+    return evaluate_expanded(s.lambda.as_array()[2], &scratch.stack);
+}
+
+const value& prepared::expr() const
+{
+    return m_state->lambda.as_array()[2];
+}
+
+const std::vector<symbol>& prepared::params() const
+{
+    return m_state->params;
+}
+
+prepared prepare(const value& expr, std::vector<symbol> params, const stack_type* globals)
+{
+    return prepared{ expr, std::move(params), globals };
+}
+
+}  // namespace lisp
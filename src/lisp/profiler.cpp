@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <iomanip>
+#include <lisp/profiler.hpp>
+
+namespace lisp
+{
+
+namespace
+{
+
+thread_local profiler* active_profiler = nullptr;
+
+double to_ms(profiler::clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+}  // namespace
+
+profiler::profiler(bool hardware_counters)
+    : m_functions{}
+    , m_index{}
+    , m_named{}
+    , m_counters{ hardware_counters ? std::make_unique<perf_counters>() : nullptr }
+    , m_root{ nullptr, nullptr, {}, {} }
+    , m_stack{}
+{
+}
+
+profiler::~profiler() = default;
+
+profiler::function& profiler::named(const std::string& name)
+{
+    function*& entry = m_named[name];
+    if (!entry)
+    {
+        m_functions.push_back(std::make_unique<function>(function{ name, 0, 0, {}, {}, {}, {} }));
+        entry = m_functions.back().get();
+    }
+    return *entry;
+}
+
+void profiler::enter(const std::string& name)
+{
+    push(named(name));
+}
+
+bool profiler::hardware_counters() const
+{
+    return m_counters && m_counters->available();
+}
+
+std::string profiler::hardware_counters_error() const
+{
+    return m_counters ? m_counters->error() : std::string{};
+}
+
+void profiler::push(function& fn)
+{
+    node* parent = m_stack.empty() ? &m_root : m_stack.back().path;
+    std::unique_ptr<node>& path = parent->children[&fn];
+    if (!path)
+    {
+        path = std::make_unique<node>(node{ &fn, parent, {}, {} });
+    }
+    ++fn.calls;
+    ++fn.active;
+    const hardware_counts counts = hardware_counters() ? m_counters->read() : hardware_counts{};
+    m_stack.push_back(frame{ &fn, path.get(), clock::now(), {}, counts, {} });
+}
+
+void profiler::exit()
+{
+    const frame f = m_stack.back();
+    m_stack.pop_back();
+    const clock::duration elapsed = clock::now() - f.start;
+    const hardware_counts counts = hardware_counters() ? m_counters->read() - f.start_counts : hardware_counts{};
+    const clock::duration exclusive = elapsed - f.children;
+    f.fn->exclusive += exclusive;
+    f.fn->exclusive_counts += counts - f.children_counts;
+    f.path->exclusive += exclusive;
+    // Time spent in a recursive call is already part of the outermost call of the same function.
+    if (--f.fn->active == 0)
+    {
+        f.fn->inclusive += elapsed;
+        f.fn->inclusive_counts += counts;
+    }
+    if (!m_stack.empty())
+    {
+        m_stack.back().children += elapsed;
+        m_stack.back().children_counts += counts;
+    }
+}
+
+std::vector<profiler::function_stats> profiler::stats() const
+{
+    std::map<std::string, function_stats> by_name;
+    for (const auto& fn : m_functions)
+    {
+        function_stats& s = by_name.try_emplace(fn->name, function_stats{ fn->name, 0, {}, {}, {}, {} }).first->second;
+        s.calls += fn->calls;
+        s.inclusive += fn->inclusive;
+        s.exclusive += fn->exclusive;
+        s.inclusive_counts += fn->inclusive_counts;
+        s.exclusive_counts += fn->exclusive_counts;
+    }
+    std::vector<function_stats> result;
+    for (auto& [name, s] : by_name)
+    {
+        result.push_back(std::move(s));
+    }
+    std::stable_sort(
+        std::begin(result),
+        std::end(result),
+        [](const function_stats& lhs, const function_stats& rhs) { return lhs.exclusive > rhs.exclusive; });
+    return result;
+}
+
+void profiler::write_report(std::ostream& os) const
+{
+    const std::vector<function_stats> all = stats();
+    clock::duration total = {};
+    for (const function_stats& s : all)
+    {
+        total += s.exclusive;
+    }
+    const bool counted = hardware_counters();
+    os << std::setw(10) << "calls" << std::setw(14) << "incl ms" << std::setw(14) << "excl ms" << std::setw(8)
+       << "excl %";
+    if (counted)
+    {
+        os << std::setw(12) << "excl Mcyc" << std::setw(7) << "IPC" << std::setw(12) << "cache miss" << std::setw(12)
+           << "br miss";
+    }
+    os << "  name\n";
+    for (const function_stats& s : all)
+    {
+        const double share = total.count() > 0 ? 100.0 * s.exclusive.count() / total.count() : 0.0;
+        os << std::setw(10) << s.calls << std::fixed << std::setprecision(3) << std::setw(14) << to_ms(s.inclusive)
+           << std::setw(14) << to_ms(s.exclusive) << std::setprecision(1) << std::setw(8) << share;
+        if (counted)
+        {
+            const hardware_counts& c = s.exclusive_counts;
+            os << std::setprecision(3) << std::setw(12) << c.cycles / 1e6 << std::setprecision(2) << std::setw(7)
+               << c.ipc() << std::setw(12) << c.cache_misses << std::setw(12) << c.branch_misses;
+        }
+        os << "  " << s.name << "\n";
+    }
+}
+
+void profiler::write_folded(std::ostream& os) const
+{
+    std::map<std::string, std::int64_t> lines;
+    std::vector<std::pair<const node*, std::string>> pending;
+    for (const auto& [fn, child] : m_root.children)
+    {
+        pending.emplace_back(child.get(), fn->name);
+    }
+    while (!pending.empty())
+    {
+        const auto [n, path] = pending.back();
+        pending.pop_back();
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(n->exclusive).count();
+        if (us > 0)
+        {
+            lines[path] += us;
+        }
+        for (const auto& [fn, child] : n->children)
+        {
+            pending.emplace_back(child.get(), path + ";" + fn->name);
+        }
+    }
+    for (const auto& [path, us] : lines)
+    {
+        os << path << " " << us << "\n";
+    }
+}
+
+profiler_scope::profiler_scope(profiler& p) : m_previous{ active_profiler }
+{
+    active_profiler = &p;
+}
+
+profiler_scope::~profiler_scope()
+{
+    active_profiler = m_previous;
+}
+
+profiler* current_profiler()
+{
+    return active_profiler;
+}
+
+}  // namespace lisp
@@ -0,0 +1,194 @@
+#include <chrono>
+#include <lisp/evaluate.hpp>
+#include <lisp/scheduler.hpp>
+
+namespace lisp
+{
+
+namespace
+{
+
+struct worker_context
+{
+    const scheduler* owner = nullptr;
+    std::size_t index = 0;
+};
+
+thread_local worker_context current_worker = {};
+
+}  // namespace
+
+scheduler::scheduler(std::size_t worker_count) : m_workers{}, m_threads{}, m_pending{ 0 }, m_next{ 0 }, m_stop{ false }
+{
+    worker_count = std::max<std::size_t>(worker_count, 1);
+    for (std::size_t i = 0; i < worker_count; ++i)
+    {
+        m_workers.push_back(std::make_unique<worker>());
+    }
+    for (std::size_t i = 0; i < worker_count; ++i)
+    {
+        m_threads.emplace_back([this, i]() { run(i); });
+    }
+}
+
+scheduler::~scheduler()
+{
+    {
+        std::lock_guard lock{ m_mutex };
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+void scheduler::submit(task_type task)
+{
+    const std::size_t index = current_worker.owner == this  //
+                                  ? current_worker.index
+                                  : m_next.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+    {
+        worker& w = *m_workers[index];
+        std::lock_guard lock{ w.mutex };
+        w.queue.push_back(std::move(task));
+    }
+    {
+        std::lock_guard lock{ m_mutex };
+        m_pending.fetch_add(1, std::memory_order_release);
+    }
+    m_cv.notify_one();
+}
+
+bool scheduler::run_one()
+{
+    const std::size_t index = current_worker.owner == this ? current_worker.index : 0;
+    auto task = current_worker.owner == this ? pop(index) : std::optional<task_type>{};
+    if (!task)
+    {
+        task = steal(index);
+    }
+    if (!task)
+    {
+        return false;
+    }
+    m_pending.fetch_sub(1, std::memory_order_acq_rel);
+    (*task)();
+    return true;
+}
+
+std::size_t scheduler::worker_count() const
+{
+    return m_workers.size();
+}
+
+scheduler& scheduler::instance()
+{
+    static scheduler result{ std::thread::hardware_concurrency() };
+    return result;
+}
+
+std::optional<scheduler::task_type> scheduler::pop(std::size_t index)
+{
+    worker& w = *m_workers[index];
+    std::lock_guard lock{ w.mutex };
+    if (w.queue.empty())
+    {
+        return {};
+    }
+    task_type result = std::move(w.queue.back());
+    w.queue.pop_back();
+    return result;
+}
+
+std::optional<scheduler::task_type> scheduler::steal(std::size_t index)
+{
+    for (std::size_t i = 0; i < m_workers.size(); ++i)
+    {
+        worker& w = *m_workers[(index + i) % m_workers.size()];
+        std::lock_guard lock{ w.mutex };
+        if (!w.queue.empty())
+        {
+            task_type result = std::move(w.queue.front());
+            w.queue.pop_front();
+            return result;
+        }
+    }
+    return {};
+}
+
+void scheduler::run(std::size_t index)
+{
+    current_worker = worker_context{ this, index };
+    while (true)
+    {
+        if (run_one())
+        {
+            continue;
+        }
+        std::unique_lock lock{ m_mutex };
+        m_cv.wait(lock, [&]() { return m_stop || m_pending.load(std::memory_order_acquire) > 0; });
+        if (m_stop)
+        {
+            return;
+        }
+    }
+}
+
+void task_state::set_value(value v)
+{
+    {
+        std::lock_guard lock{ m_mutex };
+        m_result = std::move(v);
+        m_ready = true;
+    }
+    m_cv.notify_all();
+}
+
+void task_state::set_exception(std::exception_ptr ex)
+{
+    {
+        std::lock_guard lock{ m_mutex };
+        m_error = std::move(ex);
+        m_ready = true;
+    }
+    m_cv.notify_all();
+}
+
+bool task_state::ready() const
+{
+    std::lock_guard lock{ m_mutex };
+    return m_ready;
+}
+
+value task_state::get()
+{
+    using namespace std::chrono_literals;
+    scheduler& sched = scheduler::instance();
+    while (!ready())
+    {
+        if (sched.run_one())
+        {
+            continue;
+        }
+        // Nothing left to help with: the awaited task is running elsewhere. Wake up now and then in case it
+        // spawned more work that only this thread is free to pick up.
+        std::unique_lock lock{ m_mutex };
+        m_cv.wait_for(lock, 1ms, [&]() { return m_ready; });
+    }
+    std::lock_guard lock{ m_mutex };
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+    // Every thread that awaits the task gets frames of its own for the closures in the result.
+    return transfer(*m_result);
+}
+
+value task_handle::operator()(const arg_list&) const
+{
+    return state->get();
+}
+
+}  // namespace lisp
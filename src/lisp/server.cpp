@@ -0,0 +1,449 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <lisp/evaluate.hpp>
+#include <lisp/parser.hpp>
+#include <lisp/scheduler.hpp>
+#include <lisp/server.hpp>
+#include <thread>
+
+namespace lisp
+{
+
+namespace
+{
+
+constexpr std::uint64_t listen_id = 0;
+constexpr std::uint64_t event_id = 1;
+constexpr std::size_t max_frame_size = 64 * 1024 * 1024;
+constexpr std::size_t max_cached_programs = 1024;
+
+std::runtime_error system_error(std::string_view what)
+{
+    return std::runtime_error{ str(what, ": ", std::strerror(errno)) };
+}
+
+std::string encode_frame(std::string_view payload)
+{
+    const auto size = static_cast<std::uint32_t>(payload.size());
+    std::string result(4, '\0');
+    for (int i = 0; i < 4; ++i)
+    {
+        result[i] = static_cast<char>((size >> (8 * (3 - i))) & 0xFF);
+    }
+    result += payload;
+    return result;
+}
+
+// Removes a complete frame from the front of the buffer, if there is one.
+std::optional<std::string> decode_frame(std::string& buffer)
+{
+    if (buffer.size() < 4)
+    {
+        return {};
+    }
+    std::size_t size = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        size = (size << 8) | static_cast<unsigned char>(buffer[i]);
+    }
+    if (size > max_frame_size)
+    {
+        throw std::runtime_error{ str("Frame of ", size, " bytes exceeds the limit") };
+    }
+    if (buffer.size() < 4 + size)
+    {
+        return {};
+    }
+    std::string result = buffer.substr(4, size);
+    buffer.erase(0, 4 + size);
+    return result;
+}
+
+std::string encode_response(bool ok, std::string_view text)
+{
+    std::string payload(1, ok ? '\0' : '\1');
+    payload += text;
+    return encode_frame(payload);
+}
+
+sockaddr_un make_address(const std::string& path)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error{ str("Socket path too long: ", path) };
+    }
+    std::copy(std::begin(path), std::end(path), address.sun_path);
+    return address;
+}
+
+void write_all(int fd, std::string_view data)
+{
+    while (!data.empty())
+    {
+        const auto n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw system_error("send");
+        }
+        data.remove_prefix(n);
+    }
+}
+
+struct file_descriptor
+{
+    int fd;
+
+    ~file_descriptor()
+    {
+        ::close(fd);
+    }
+};
+
+}  // namespace
+
+server::server(const stack_type* globals, const std::string& socket_path)
+    : m_globals{ globals }
+    , m_path{ socket_path }
+    , m_listen_fd{ -1 }
+    , m_epoll_fd{ -1 }
+    , m_event_fd{ -1 }
+    , m_stopping{ false }
+    , m_in_flight{ 0 }
+    , m_next_id{ event_id + 1 }
+{
+    const sockaddr_un address = make_address(m_path);
+    m_listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listen_fd < 0)
+    {
+        throw system_error("socket");
+    }
+    ::unlink(m_path.c_str());
+    if (::bind(m_listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0
+        || ::listen(m_listen_fd, SOMAXCONN) < 0)
+    {
+        const auto error = system_error(str("listen on ", m_path));
+        ::close(m_listen_fd);
+        throw error;
+    }
+    m_epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    m_event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_epoll_fd < 0 || m_event_fd < 0)
+    {
+        throw system_error("epoll");
+    }
+    epoll_event listen_event = {};
+    listen_event.events = EPOLLIN;
+    listen_event.data.u64 = listen_id;
+    ::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &listen_event);
+    epoll_event wake_event = {};
+    wake_event.events = EPOLLIN;
+    wake_event.data.u64 = event_id;
+    ::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_event_fd, &wake_event);
+}
+
+server::~server()
+{
+    for (auto& [id, conn] : m_connections)
+    {
+        ::close(conn.fd);
+    }
+    ::close(m_event_fd);
+    ::close(m_epoll_fd);
+    ::close(m_listen_fd);
+    ::unlink(m_path.c_str());
+}
+
+void server::run()
+{
+    std::array<epoll_event, 64> events;
+    while (!m_stopping.load())
+    {
+        const int count = ::epoll_wait(m_epoll_fd, events.data(), static_cast<int>(events.size()), -1);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw system_error("epoll_wait");
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            const std::uint64_t id = events[i].data.u64;
+            if (id == listen_id)
+            {
+                accept_all();
+            }
+            else if (id == event_id)
+            {
+                std::uint64_t counter = 0;
+                [[maybe_unused]] const auto n = ::read(m_event_fd, &counter, sizeof(counter));
+                drain_completions();
+            }
+            else
+            {
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                {
+                    on_readable(id);
+                }
+                if (events[i].events & EPOLLOUT)
+                {
+                    on_writable(id);
+                }
+            }
+        }
+    }
+    // Workers still hold on to this server until their requests complete.
+    while (m_in_flight.load() > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+    }
+}
+
+void server::stop()
+{
+    m_stopping.store(true);
+    const std::uint64_t one = 1;
+    [[maybe_unused]] const auto n = ::write(m_event_fd, &one, sizeof(one));
+}
+
+void server::accept_all()
+{
+    while (true)
+    {
+        const int fd = ::accept4(m_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        const std::uint64_t id = m_next_id++;
+        m_connections.emplace(id, connection{ fd, {}, {}, {}, false });
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = id;
+        ::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void server::on_readable(std::uint64_t id)
+{
+    const auto iter = m_connections.find(id);
+    if (iter == m_connections.end())
+    {
+        return;
+    }
+    connection& conn = iter->second;
+    char buffer[64 * 1024];
+    while (true)
+    {
+        const auto n = ::read(conn.fd, buffer, sizeof(buffer));
+        if (n > 0)
+        {
+            conn.input.append(buffer, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        close(id);
+        return;
+    }
+    try
+    {
+        while (auto frame = decode_frame(conn.input))
+        {
+            conn.pending.push_back(std::move(*frame));
+        }
+    }
+    catch (const std::exception&)
+    {
+        close(id);
+        return;
+    }
+    dispatch(id);
+}
+
+void server::on_writable(std::uint64_t id)
+{
+    const auto iter = m_connections.find(id);
+    if (iter == m_connections.end())
+    {
+        return;
+    }
+    connection& conn = iter->second;
+    while (!conn.output.empty())
+    {
+        const auto n = ::send(conn.fd, conn.output.data(), conn.output.size(), MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            close(id);
+            return;
+        }
+        conn.output.erase(0, n);
+    }
+    watch(id, !conn.output.empty());
+}
+
+void server::dispatch(std::uint64_t id)
+{
+    connection& conn = m_connections.at(id);
+    if (conn.busy || conn.pending.empty())
+    {
+        return;
+    }
+    conn.busy = true;
+    ++m_in_flight;
+    scheduler::instance().submit(
+        [this, id, code = std::move(conn.pending.front())]()
+        {
+            std::string frame;
+            try
+            {
+                stack_type stack{ {}, m_globals };
+                frame = encode_response(true, str(evaluate(parse_cached(code), &stack)));
+            }
+            catch (const std::exception& ex)
+            {
+                frame = encode_response(false, ex.what());
+            }
+            {
+                std::lock_guard lock{ m_completions_mutex };
+                m_completions.push_back(completion{ id, std::move(frame) });
+            }
+            const std::uint64_t one = 1;
+            [[maybe_unused]] const auto n = ::write(m_event_fd, &one, sizeof(one));
+            --m_in_flight;
+        });
+    conn.pending.pop_front();
+}
+
+void server::drain_completions()
+{
+    std::vector<completion> done;
+    {
+        std::lock_guard lock{ m_completions_mutex };
+        std::swap(done, m_completions);
+    }
+    for (completion& c : done)
+    {
+        const auto iter = m_connections.find(c.id);
+        if (iter == m_connections.end())
+        {
+            continue;
+        }
+        iter->second.busy = false;
+        iter->second.output += c.frame;
+        on_writable(c.id);
+        if (m_connections.count(c.id))
+        {
+            dispatch(c.id);
+        }
+    }
+}
+
+void server::close(std::uint64_t id)
+{
+    const auto iter = m_connections.find(id);
+    if (iter == m_connections.end())
+    {
+        return;
+    }
+    ::epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, iter->second.fd, nullptr);
+    ::close(iter->second.fd);
+    m_connections.erase(iter);
+}
+
+void server::watch(std::uint64_t id, bool want_write)
+{
+    epoll_event event = {};
+    event.events = EPOLLIN | (want_write ? EPOLLOUT : 0u);
+    event.data.u64 = id;
+    ::epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, m_connections.at(id).fd, &event);
+}
+
+value server::parse_cached(const std::string& code)
+{
+    {
+        std::lock_guard lock{ m_cache_mutex };
+        const auto iter = m_cache.find(code);
+        if (iter != m_cache.end())
+        {
+            return iter->second;
+        }
+    }
+    const value result = expand(parse(code), *m_globals);
+    std::lock_guard lock{ m_cache_mutex };
+    if (m_cache.size() >= max_cached_programs)
+    {
+        m_cache.clear();
+    }
+    m_cache.emplace(code, result);
+    return result;
+}
+
+response request(const std::string& socket_path, std::string_view code)
+{
+    const sockaddr_un address = make_address(socket_path);
+    const file_descriptor socket{ ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) };
+    if (socket.fd < 0)
+    {
+        throw system_error("socket");
+    }
+    if (::connect(socket.fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0)
+    {
+        throw system_error(str("connect to ", socket_path));
+    }
+    write_all(socket.fd, encode_frame(code));
+    std::string input;
+    char buffer[64 * 1024];
+    while (true)
+    {
+        if (const auto frame = decode_frame(input))
+        {
+            if (frame->empty())
+            {
+                throw std::runtime_error{ "Empty response" };
+            }
+            return response{ frame->front() == '\0', frame->substr(1) };
+        }
+        const auto n = ::read(socket.fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            throw std::runtime_error{ "Connection closed before a response arrived" };
+        }
+        input.append(buffer, n);
+    }
+}
+
+}  // namespace lisp
@@ -0,0 +1,29 @@
+#include <lisp/stats.hpp>
+
+namespace lisp
+{
+
+runtime_stats operator-(const runtime_stats& lhs, const runtime_stats& rhs)
+{
+    return runtime_stats{ lhs.values - rhs.values,
+                          lhs.value_copies - rhs.value_copies,
+                          lhs.strings - rhs.strings,
+                          lhs.arrays - rhs.arrays,
+                          lhs.payload_bytes - rhs.payload_bytes,
+                          lhs.frames - rhs.frames,
+                          lhs.calls - rhs.calls,
+                          lhs.lookups - rhs.lookups,
+                          lhs.cached_lookups - rhs.cached_lookups };
+}
+
+runtime_stats stats_snapshot()
+{
+    return thread_stats();
+}
+
+void reset_stats()
+{
+    thread_stats() = {};
+}
+
+}  // namespace lisp
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <lisp/tracer.hpp>
+
+namespace lisp
+{
+
+namespace
+{
+
+thread_local tracer* active_tracer = nullptr;
+
+void write_escaped(std::ostream& os, std::string_view text)
+{
+    for (const char ch : text)
+    {
+        if (ch == '"' || ch == '\\')
+        {
+            os << '\\' << ch;
+        }
+        else if (static_cast<unsigned char>(ch) < 0x20)
+        {
+            os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(ch) << std::dec
+               << std::setfill(' ');
+        }
+        else
+        {
+            os << ch;
+        }
+    }
+}
+
+}  // namespace
+
+tracer::tracer(clock::duration threshold, std::size_t capacity)
+    : m_threshold{ threshold }
+    , m_capacity{ std::max<std::size_t>(capacity, 1) }
+    , m_origin{ clock::now() }
+    , m_mutex{}
+    , m_rings{}
+    , m_thread_rings{}
+{
+}
+
+tracer::~tracer() = default;
+
+tracer::ring& tracer::thread_ring()
+{
+    std::lock_guard lock{ m_mutex };
+    ring*& found = m_thread_rings[std::this_thread::get_id()];
+    if (!found)
+    {
+        m_rings.push_back(std::make_unique<ring>());
+        ring& r = *m_rings.back();
+        r.thread = m_rings.size();
+        r.events.resize(m_capacity);
+        r.written.store(0);
+        found = &r;
+    }
+    return *found;
+}
+
+tracer::ring*& tracer::scoped_ring()
+{
+    thread_local ring* r = nullptr;
+    return r;
+}
+
+void tracer::record(span_kind kind, clock::time_point start, clock::time_point finish, std::string_view name)
+{
+    ring& r = active_tracer == this ? *scoped_ring() : thread_ring();
+    const std::uint64_t index = r.written.load(std::memory_order_relaxed);
+    event& e = r.events[index % m_capacity];
+    e.kind = kind;
+    e.start = start;
+    e.duration = finish - start;
+    const std::size_t size = std::min(name.size(), max_name_size);
+    std::memcpy(e.name, name.data(), size);
+    e.name[size] = '\0';
+    r.written.store(index + 1, std::memory_order_release);
+}
+
+void tracer::write_json(std::ostream& os) const
+{
+    using microseconds = std::chrono::duration<double, std::micro>;
+    std::lock_guard lock{ m_mutex };
+    os << "{\"traceEvents\":[";
+    bool first = true;
+    for (const auto& r : m_rings)
+    {
+        const std::uint64_t written = r->written.load(std::memory_order_acquire);
+        const std::uint64_t begin = written > m_capacity ? written - m_capacity : 0;
+        for (std::uint64_t i = begin; i < written; ++i)
+        {
+            const event& e = r->events[i % m_capacity];
+            os << (first ? "\n" : ",\n") << "{\"name\":\"";
+            write_escaped(os, e.name);
+            os << "\",\"cat\":\"" << (e.kind == span_kind::eval ? "eval" : "call") << "\",\"ph\":\"X\""
+               << std::fixed << std::setprecision(3) << ",\"ts\":" << microseconds(e.start - m_origin).count()
+               << ",\"dur\":" << microseconds(e.duration).count() << ",\"pid\":1,\"tid\":" << r->thread << "}";
+            first = false;
+        }
+    }
+    os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+tracer_scope::tracer_scope(tracer& t) : m_previous{ active_tracer }, m_previous_ring{ tracer::scoped_ring() }
+{
+    tracer::scoped_ring() = &t.thread_ring();
+    active_tracer = &t;
+}
+
+tracer_scope::~tracer_scope()
+{
+    active_tracer = m_previous;
+    tracer::scoped_ring() = m_previous_ring;
+}
+
+tracer* current_tracer()
+{
+    return active_tracer;
+}
+
+}  // namespace lisp
@@ -1,6 +1,11 @@
 #include "lisp/value.hpp"
 
+#include <array>
 #include <iomanip>
+#include <utility>
+
+#include "lisp/inline_cache.hpp"
+#include "lisp/memory.hpp"
 
 #include "lisp/utils/type_traits.hpp"
 
@@ -17,7 +22,7 @@ category to_category()
     {
         return category::null;
     }
-    else if constexpr (std::is_same_v<T, value::string_type>)
+    else if constexpr (std::is_same_v<T, std::shared_ptr<const value::string_type>>)
     {
         return category::string;
     }
@@ -37,7 +42,7 @@ category to_category()
     {
         return category::boolean;
     }
-    else if constexpr (std::is_same_v<T, value::array_type>)
+    else if constexpr (std::is_same_v<T, std::shared_ptr<const value::array_type>>)
     {
         return category::array;
     }
@@ -60,69 +65,109 @@ std::string build_message(category expected, category actual)
     return str("accessing: ", expected, ", actual: ", actual);
 };
 
+template <class Variant>
+category category_of(const Variant& variant)
+{
+    return std::visit([](const auto& v) { return to_category<std::decay_t<decltype(v)>>(); }, variant);
+}
+
+template <class T, class Variant>
+[[noreturn, gnu::cold, gnu::noinline]] void bad_access(const Variant& variant)
+{
+    throw std::runtime_error{ build_message(to_category<T>(), category_of(variant)) };
+}
+
+// The category is only worked out for the message, once the access has failed.
 template <class T, class Variant>
-const T& get_value(const Variant& variant, category actual)
+const T& get_value(const Variant& variant)
 {
     const auto ptr = std::get_if<T>(&variant);
     if (!ptr)
     {
-        throw std::runtime_error{ build_message(to_category<T>(), actual) };
+        bad_access<T>(variant);
     }
     return *ptr;
 }
 
+void count_value()
+{
+    ++thread_stats().values;
+}
+
+template <class T>
+void count_storage(std::uint64_t runtime_stats::*counter, const std::shared_ptr<const T>& storage)
+{
+    runtime_stats& stats = thread_stats();
+    ++stats.values;
+    ++(stats.*counter);
+    stats.payload_bytes += payload_bytes(*storage);
+}
+
 }  // namespace
 
 value::value() : m_data{ null_type{} }
 {
+    count_value();
 }
 
 value::value(null_type v) : m_data{ std::move(v) }
 {
+    count_value();
 }
 
-value::value(string_type v) : m_data{ std::move(v) }
+value::value(string_type v) : m_data{ make_shared_storage(std::move(v)) }
 {
+    count_storage(&runtime_stats::strings, std::get<std::shared_ptr<const string_type>>(m_data));
 }
 
 value::value(symbol_type v) : m_data{ std::move(v) }
 {
+    count_value();
 }
 
 value::value(integer_type v) : m_data{ std::move(v) }
 {
+    count_value();
 }
 
 value::value(floating_point_type v) : m_data{ std::move(v) }
 {
+    count_value();
 }
 
 value::value(boolean_type v) : m_data{ std::move(v) }
 {
+    count_value();
 }
 
-value::value(array_type v) : m_data{ std::move(v) }
+value::value(array_type v) : m_data{ make_shared_storage(array_storage{ std::move(v) }) }
 {
+    count_storage(&runtime_stats::arrays, std::get<std::shared_ptr<const array_type>>(m_data));
 }
 
 value::value(callable_type v) : m_data{ std::move(v) }
 {
+    count_value();
 }
 
 value::value(lambda_type v) : m_data{ std::move(v) }
 {
+    count_value();
 }
 
 value& value::operator=(const value& other)
 {
+    ++thread_stats().value_copies;
     std::visit(
         overload{ [&](const value::null_type v) { this->m_data.emplace<null_type>(v); },
-                  [&](const value::string_type& v) { this->m_data.emplace<string_type>(v); },
+                  [&](const std::shared_ptr<const value::string_type>& v)
+                  { this->m_data.emplace<std::shared_ptr<const string_type>>(v); },
                   [&](const value::symbol_type& v) { this->m_data.emplace<symbol_type>(v); },
                   [&](const value::integer_type& v) { this->m_data.emplace<integer_type>(v); },
                   [&](const value::floating_point_type& v) { this->m_data.emplace<floating_point_type>(v); },
                   [&](const value::boolean_type& v) { this->m_data.emplace<boolean_type>(v); },
-                  [&](const value::array_type& v) { this->m_data.emplace<array_type>(v); },
+                  [&](const std::shared_ptr<const value::array_type>& v)
+                  { this->m_data.emplace<std::shared_ptr<const array_type>>(v); },
                   [&](const value::callable_type& v) { this->m_data.emplace<callable_type>(v); },
                   [&](const box<value::lambda_type>& v) { this->m_data.emplace<box<lambda_type>>(v); } },
         other.m_data);
@@ -138,12 +183,12 @@ category value::get_category() const
 {
     return std::visit(
         overload{ [](const null_type&) { return category::null; },
-                  [](const string_type&) { return category::string; },
+                  [](const std::shared_ptr<const string_type>&) { return category::string; },
                   [](const symbol_type&) { return category::symbol; },
                   [](const integer_type&) { return category::integer; },
                   [](const floating_point_type&) { return category::floating_point; },
                   [](const boolean_type&) { return category::boolean; },
-                  [](const array_type&) { return category::array; },
+                  [](const std::shared_ptr<const array_type>&) { return category::array; },
                   [](const callable_type&) { return category::callable; },
                   [](const box<lambda_type>&) { return category::lambda; } },
         m_data);
@@ -156,7 +201,7 @@ bool value::is_null() const
 
 bool value::is_string() const
 {
-    return std::holds_alternative<string_type>(m_data);
+    return std::holds_alternative<std::shared_ptr<const string_type>>(m_data);
 }
 
 bool value::is_symbol() const
@@ -181,7 +226,7 @@ bool value::is_floating_point() const
 
 bool value::is_array() const
 {
-    return std::holds_alternative<array_type>(m_data);
+    return std::holds_alternative<std::shared_ptr<const array_type>>(m_data);
 }
 
 bool value::is_callable() const
@@ -196,65 +241,65 @@ bool value::is_lambda() const
 
 const value::null_type& value::as_null() const
 {
-    return get_value<value::null_type>(m_data, get_category());
+    return get_value<value::null_type>(m_data);
 }
 
 const value::string_type& value::as_string() const
 {
-    return get_value<value::string_type>(m_data, get_category());
+    return *get_value<std::shared_ptr<const string_type>>(m_data);
 }
 
 const value::symbol_type& value::as_symbol() const
 {
-    return get_value<value::symbol_type>(m_data, get_category());
+    return get_value<value::symbol_type>(m_data);
 }
 
 const value::integer_type& value::as_integer() const
 {
-    return get_value<value::integer_type>(m_data, get_category());
+    return get_value<value::integer_type>(m_data);
 }
 
 const value::boolean_type& value::as_boolean() const
 {
-    return get_value<value::boolean_type>(m_data, get_category());
+    return get_value<value::boolean_type>(m_data);
 }
 
 const value::floating_point_type& value::as_floating_point() const
 {
-    return get_value<value::floating_point_type>(m_data, get_category());
+    return get_value<value::floating_point_type>(m_data);
 }
 
 const value::array_type& value::as_array() const
 {
-    return get_value<value::array_type>(m_data, get_category());
+    return *get_value<std::shared_ptr<const array_type>>(m_data);
 }
 
 const value::callable_type& value::as_callable() const
 {
-    return get_value<value::callable_type>(m_data, get_category());
+    return get_value<value::callable_type>(m_data);
 }
 
 const value::lambda_type& value::as_lambda() const
 {
-    return *get_value<box<lambda_type>>(m_data, get_category());
+    return *get_value<box<lambda_type>>(m_data);
 }
 
 std::ostream& operator<<(std::ostream& os, const value& item)
 {
     std::visit(
         overload{ [&](const value::null_type& v) { os << "null"; },
-                  [&](const value::string_type& v) { os << v; },
+                  [&](const std::shared_ptr<const value::string_type>& v) { os << *v; },
                   [&](const value::symbol_type& v) { os << v; },
                   [&](const value::integer_type& v) { os << v; },
                   [&](const value::floating_point_type& v) { os << std::fixed << std::setprecision(1) << v; },
                   [&](const value::boolean_type& v) { os << std::boolalpha << v; },
-                  [&](const value::array_type& v) { os << "(" << delimit(v, " ") << ")"; },
+                  [&](const std::shared_ptr<const value::array_type>& v) { os << "(" << delimit(*v, " ") << ")"; },
                   [&](const value::callable_type& v)
                   {
-                      os << v.name;
-                      if (!v.bound_args.empty())
+                      os << v.name();
+                      if (!v.bound_args().empty())
                       {
-                          os << ", bound_args=[" << delimit(v.bound_args, ", ") << "]";
+                          os << ", bound_args=[" << delimit(v.bound_args(), ", ") << "]";
                       }
                   },
                   [&](const box<value::lambda_type>& v) { os << "lambda " << (*v).params << " " << (*v).body; } },
@@ -262,46 +307,125 @@ std::ostream& operator<<(std::ostream& os, const value& item)
     return os;
 }
 
-template <class BinaryOp>
-value op(const value& lhs, const value& rhs, BinaryOp op, std::string_view op_name)
+struct value_access
 {
-    if (lhs.is_integer() && rhs.is_integer())
-    {
-        return op(lhs.as_integer(), rhs.as_integer());
-    }
-    else if (lhs.is_integer() && rhs.is_floating_point())
+    using variant_type = value::variant_type;
+
+    template <std::size_t I>
+    using alternative = std::variant_alternative_t<I, variant_type>;
+
+    static std::size_t index(const value& v)
     {
-        return op(lhs.as_integer(), rhs.as_floating_point());
+        return v.m_data.index();
     }
-    else if (lhs.is_floating_point() && rhs.is_integer())
+
+    // The payload of alternative I, with strings unwrapped from their shared storage.
+    template <std::size_t I>
+    static const auto& get(const value& v)
     {
-        return op(lhs.as_floating_point(), rhs.as_integer());
+        const auto& item = *std::get_if<I>(&v.m_data);
+        if constexpr (std::is_same_v<alternative<I>, std::shared_ptr<const value::string_type>>)
+        {
+            return *item;
+        }
+        else
+        {
+            return item;
+        }
     }
+};
+
+namespace
+{
+
+template <class T, class... Ts>
+constexpr bool is_one_of = (std::is_same_v<T, Ts> || ...);
+
+// Numbers mix; two floating point operands are not supported.
+struct arithmetic_operands
+{
+    template <class L, class R>
+    static constexpr bool defined = is_one_of<L, value::integer_type, value::floating_point_type>
+                                    && is_one_of<R, value::integer_type, value::floating_point_type>
+                                    && !(std::is_same_v<L, value::floating_point_type> && std::is_same_v<L, R>);
+};
+
+struct integer_operands
+{
+    template <class L, class R>
+    static constexpr bool defined = std::is_same_v<L, value::integer_type> && std::is_same_v<R, value::integer_type>;
+};
+
+// Numbers as for arithmetic, and strings with each other.
+struct comparable_operands
+{
+    template <class L, class R>
+    static constexpr bool defined
+        = arithmetic_operands::defined<L, R>
+          || (std::is_same_v<L, std::shared_ptr<const value::string_type>> && std::is_same_v<L, R>);
+};
+
+[[noreturn, gnu::cold, gnu::noinline]] void unsupported(std::string_view op_name, const value& lhs, const value& rhs)
+{
     throw std::runtime_error{ str("Cannot ", op_name, " ", lhs.get_category(), " and ", rhs.get_category()) };
 }
 
-template <class BinaryOp>
-bool cmp(const value& lhs, const value& rhs, BinaryOp op)
+// A table of kernels indexed by the alternatives of both operands, each applying `Op` to one pair of types; the pairs
+// `Operands` does not define go to the error path.
+template <class Result, class Op, class Operands>
+struct binary_dispatch
 {
-    if (lhs.is_integer() && rhs.is_integer())
+    static constexpr std::size_t size = std::variant_size_v<value_access::variant_type>;
+
+    using kernel = Result (*)(const value&, const value&, std::string_view);
+
+    template <std::size_t L, std::size_t R>
+    static Result apply(const value& lhs, const value& rhs, std::string_view op_name)
     {
-        return op(lhs.as_integer(), rhs.as_integer());
+        if constexpr (Operands::template defined<value_access::alternative<L>, value_access::alternative<R>>)
+        {
+            return Op{}(value_access::get<L>(lhs), value_access::get<R>(rhs));
+        }
+        else
+        {
+            unsupported(op_name, lhs, rhs);
+        }
     }
-    else if (lhs.is_integer() && rhs.is_floating_point())
+
+    template <std::size_t L, std::size_t... R>
+    static constexpr std::array<kernel, size> row(std::index_sequence<R...>)
     {
-        return op(lhs.as_integer(), rhs.as_floating_point());
+        return { &apply<L, R>... };
     }
-    else if (lhs.is_floating_point() && rhs.is_integer())
+
+    template <std::size_t... L>
+    static constexpr std::array<std::array<kernel, size>, size> matrix(std::index_sequence<L...>)
     {
-        return op(lhs.as_floating_point(), rhs.as_integer());
+        return { row<L>(std::make_index_sequence<size>{})... };
     }
-    else if (lhs.is_string() && rhs.is_string())
+
+    static constexpr std::array<std::array<kernel, size>, size> table = matrix(std::make_index_sequence<size>{});
+
+    static Result call(const value& lhs, const value& rhs, std::string_view op_name)
     {
-        return op(lhs.as_string(), rhs.as_string());
+        return table[value_access::index(lhs)][value_access::index(rhs)](lhs, rhs, op_name);
     }
-    throw std::runtime_error{ str("Cannot compare ", lhs.get_category(), " and ", rhs.get_category()) };
+};
+
+template <class BinaryOp>
+value op(const value& lhs, const value& rhs, BinaryOp, std::string_view op_name)
+{
+    return binary_dispatch<value, BinaryOp, arithmetic_operands>::call(lhs, rhs, op_name);
+}
+
+template <class BinaryOp>
+bool cmp(const value& lhs, const value& rhs, BinaryOp)
+{
+    return binary_dispatch<bool, BinaryOp, comparable_operands>::call(lhs, rhs, "compare");
 }
 
+}  // namespace
+
 value operator+(const value& lhs, const value& rhs)
 {
     return op(lhs, rhs, std::plus{}, "add");
@@ -324,16 +448,12 @@ value operator/(const value& lhs, const value& rhs)
 
 value operator%(const value& lhs, const value& rhs)
 {
-    if (lhs.is_integer() && rhs.is_integer())
-    {
-        return lhs.as_integer() % rhs.as_integer();
-    }
-    throw std::runtime_error{ str("Cannot mod ", lhs.get_category(), " and ", rhs.get_category()) };
+    return binary_dispatch<value, std::modulus<>, integer_operands>::call(lhs, rhs, "mod");
 }
 
 bool operator==(const value& lhs, const value& rhs)
 {
-    if (lhs.get_category() != rhs.get_category())
+    if (value_access::index(lhs) != value_access::index(rhs))
     {
         return false;
     }
@@ -343,7 +463,7 @@ bool operator==(const value& lhs, const value& rhs)
     }
     else if (lhs.is_string())
     {
-        return lhs.as_string() == rhs.as_string();
+        return &lhs.as_string() == &rhs.as_string() || lhs.as_string() == rhs.as_string();
     }
     else if (lhs.is_symbol())
     {
@@ -363,7 +483,7 @@ bool operator==(const value& lhs, const value& rhs)
     }
     else if (lhs.is_array())
     {
-        return lhs.as_array() == rhs.as_array();
+        return &lhs.as_array() == &rhs.as_array() || lhs.as_array() == rhs.as_array();
     }
 
     return false;
@@ -6,6 +6,7 @@
 #include <lisp/utils/ansi.hpp>
 #include <lisp/utils/pipeline.hpp>
 #include <lisp/utils/std_ostream.hpp>
+#include <csignal>
 #include <sstream>
 
 template <class... Args>
@@ -87,25 +88,140 @@ auto join_lines(const std::vector<std::string>& lines) -> std::string
     return ss.str();
 }
 
+auto load_program(const std::string& file_name) -> lisp::value
+{
+    return file_name             //
+        |= fn(&load_file)        //
+        |= fn(&split_lines)      //
+        |= fn(&filter_comments)  //
+        |= fn(&join_lines)       //
+        |= fn(&lisp::parse);
+}
+
+lisp::server* active_server = nullptr;
+
+// lisp --serve <socket> [module...]
+int serve(const std::string& socket_path, const std::vector<std::string>& modules)
+{
+    lisp::stack_type globals = lisp::default_stack();
+    for (const auto& module : modules)
+    {
+        lisp::evaluate(load_program(module), &globals);
+    }
+
+    lisp::server server{ &globals, socket_path };
+    active_server = &server;
+    const auto on_signal = [](int) { active_server->stop(); };
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    server.run();
+    active_server = nullptr;
+    return 0;
+}
+
+// lisp --client <socket> <file>
+int client(const std::string& socket_path, const std::string& file_name)
+{
+    const auto code = file_name |= fn(&load_file) |= fn(&split_lines) |= fn(&filter_comments) |= fn(&join_lines);
+    const auto response = lisp::request(socket_path, code);
+    (response.ok ? std::cout : std::cerr) << response.text << "\n";
+    return response.ok ? 0 : 1;
+}
+
+// lisp --profile <folded stacks output> <file>
+int profile(const std::string& folded_path, const std::string& file_name)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::profiler profiler{ true };
+    if (!profiler.hardware_counters())
+    {
+        std::cerr << "Hardware counters unavailable (" << profiler.hardware_counters_error() << "); timing only.\n";
+    }
+    {
+        const lisp::profiler_scope scope{ profiler };
+        std::cout << lisp::evaluate(load_program(file_name), &stack) << "\n";
+    }
+    profiler.write_report(std::cerr);
+    std::ofstream folded{ folded_path };
+    if (!folded)
+    {
+        throw std::runtime_error{ str("Cannot write to ", folded_path, ".") };
+    }
+    profiler.write_folded(folded);
+    return 0;
+}
+
+// lisp --compile <C++ output> <file> [entry]
+// Without an entry name, the output has a main() that prints the program's result.
+int compile(const std::string& cpp_path, const std::string& file_name, const std::optional<std::string>& entry)
+{
+    lisp::compile_options options;
+    options.entry = entry.value_or(options.entry);
+    options.main = !entry;
+    const std::string code = lisp::compile_to_cpp(load_program(file_name), options);
+    std::ofstream cpp{ cpp_path };
+    if (!cpp)
+    {
+        throw std::runtime_error{ str("Cannot write to ", cpp_path, ".") };
+    }
+    cpp << code;
+    return 0;
+}
+
+// lisp --trace <trace JSON output> <file>
+int trace(const std::string& json_path, const std::string& file_name)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::tracer tracer{ {}, 256 * 1024 };
+    {
+        const lisp::tracer_scope scope{ tracer };
+        std::cout << lisp::evaluate(load_program(file_name), &stack) << "\n";
+    }
+    std::ofstream json{ json_path };
+    if (!json)
+    {
+        throw std::runtime_error{ str("Cannot write to ", json_path, ".") };
+    }
+    tracer.write_json(json);
+    return 0;
+}
+
 int run(int argc, char* argv[])
 {
+    const auto args = std::vector<std::string>(argv + 1, argv + argc);
+    if (args.size() >= 2 && args[0] == "--serve")
+    {
+        return serve(args[1], std::vector<std::string>(args.begin() + 2, args.end()));
+    }
+    if (args.size() == 3 && args[0] == "--client")
+    {
+        return client(args[1], args[2]);
+    }
+    if (args.size() == 3 && args[0] == "--profile")
+    {
+        return profile(args[1], args[2]);
+    }
+    if ((args.size() == 3 || args.size() == 4) && args[0] == "--compile")
+    {
+        return compile(args[1], args[2], args.size() == 4 ? std::optional<std::string>{ args[3] } : std::nullopt);
+    }
+    if (args.size() == 3 && args[0] == "--trace")
+    {
+        return trace(args[1], args[2]);
+    }
+
     lisp::stack_type stack = lisp::default_stack();
 
     const auto file_name = argc >= 2  //
                                ? std::string{ argv[1] }
                                : std::string{ "../src/input.lisp" };
 
-    const auto val = file_name   //
-        |= fn(&load_file)        //
-        |= fn(&split_lines)      //
-        |= fn(&filter_comments)  //
-        |= fn(&join_lines)       //
-        |= fn(&lisp::parse);
+    const auto val = load_program(file_name);
 
     std::cout << ansi::fg(ansi::color::dark_blue) << val << ansi::reset << "\n";
 
     std::cout << ansi::fg(ansi::color::yellow);
-    const auto result = lisp::evaluate(val, &stack);
+    const auto result = lisp::evaluate(lisp::optimize(val, stack), &stack);
     std::cout << ansi::reset;
 
     std::cout << ansi::fg(ansi::color::dark_green) << result << ansi::reset << "\n";
@@ -1,8 +1,25 @@
 #include <gmock/gmock.h>
 
+#include <lisp/arena.hpp>
+#include <lisp/batch.hpp>
+#include <lisp/channel.hpp>
+#include <lisp/closure.hpp>
+#include <lisp/compiler.hpp>
 #include <lisp/default_stack.hpp>
 #include <lisp/evaluate.hpp>
+#include <lisp/memory.hpp>
+#include <lisp/optimize.hpp>
 #include <lisp/parser.hpp>
+#include <lisp/prepare.hpp>
+#include <lisp/profiler.hpp>
+#include <lisp/server.hpp>
+#include <lisp/stats.hpp>
+#include <lisp/tracer.hpp>
+#include <lisp/utils/flat_map.hpp>
+#include <lisp/utils/small_vector.hpp>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
 
 lisp::value eval(std::string_view code)
 {
@@ -70,3 +87,1168 @@ TEST(expr, comparison)
     EXPECT_THAT(eval("(>= 3 5)"), false);
     EXPECT_THAT(eval("(>= 5 3)"), true);
 }
+
+TEST(stack, prelude_is_shared)
+{
+    lisp::stack_type a = lisp::default_stack();
+    lisp::stack_type b = lisp::default_stack();
+    EXPECT_EQ(a.outer, &lisp::prelude());
+    EXPECT_EQ(b.outer, &lisp::prelude());
+    EXPECT_TRUE(a.frame.empty());
+
+    lisp::evaluate(lisp::parse("(let + -)"), &a);
+    EXPECT_THAT(lisp::evaluate(lisp::parse("(+ 5 3)"), &a), 2);
+    EXPECT_THAT(lisp::evaluate(lisp::parse("(+ 5 3)"), &b), 8);
+}
+
+TEST(tasks, spawn_await)
+{
+    EXPECT_THAT(
+        eval(R"((begin
+            (defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+            ((lambda (a b) (begin (yield) (+ (await a) (await b)))) (spawn fib 15) (spawn fib 16))))"),
+        1597);
+    EXPECT_THAT(
+        eval(R"((begin
+            (defun sq (n) (* n n))
+            (seq.map await (seq.map (partial spawn sq) '(1 2 3 4)))))"),
+        (lisp::array{ 1, 4, 9, 16 }));
+    EXPECT_THROW(eval("(await (spawn car 5))"), std::runtime_error);
+    EXPECT_THROW(eval("(await car)"), std::runtime_error);
+}
+
+TEST(tasks, closures_called_from_two_threads)
+{
+    // rec keeps the frame of the call it is made in, which goes on binding names while rec runs on this thread and on
+    // another one; ThreadSanitizer reports any access to that frame they share.
+    EXPECT_THAT(
+        eval(R"((begin
+            (defun run (n)
+                (begin
+                    (defun rec (k) (if (< k 1) 0 (+ 1 (rec (- k 1)))))
+                    (let task (spawn rec n))
+                    (let here (rec n))
+                    (let a 1) (let b 2) (let c 3) (let d 4) (let e 5) (let f 6) (let g 7) (let h 8)
+                    (+ here (await task))))
+            (seq.map run '(50 100 150 200))))"),
+        (lisp::array{ 100, 200, 300, 400 }));
+    EXPECT_THAT(
+        eval(R"((begin
+            (defun run (n)
+                (begin
+                    (defun rec (k) (if (< k 1) 0 (+ 1 (rec (- k 1)))))
+                    (let ch (chan.make 1))
+                    (let stage (isolate '(lambda (ch n) ((chan.recv ch) n)) ch n))
+                    (chan.send ch rec)
+                    (let here (rec n))
+                    (let a 1) (let b 2) (let c 3) (let d 4) (let e 5) (let f 6) (let g 7) (let h 8)
+                    (+ here (await stage))))
+            (seq.map run '(50 100 150 200))))"),
+        (lisp::array{ 100, 200, 300, 400 }));
+    // Both threads call the closure a task returns, and the task lets go of it as they do.
+    EXPECT_THAT(
+        eval(R"((begin
+            (defun mk (x) (begin (defun rec (k) (if (< k 1) x (rec (- k 1)))) rec))
+            ((lambda (task) ((lambda (other) (+ ((await task) 30) (await other))) (spawn (lambda (t) ((await t) 30)) task)))
+             (spawn mk 7))))"),
+        14);
+}
+
+TEST(channels, values_are_shared_not_copied)
+{
+    lisp::channel chan{ 1 };
+    const lisp::value sent = lisp::array{ 1, 2, 3 };
+    chan.send(sent);
+    const lisp::value received = *chan.recv();
+    EXPECT_EQ(&sent.as_array(), &received.as_array());
+    chan.close();
+    EXPECT_FALSE(chan.recv());
+    EXPECT_THROW(chan.send(5), std::runtime_error);
+}
+
+TEST(channels, isolate_pipeline)
+{
+    EXPECT_THAT(
+        eval(R"((begin
+            (let in (chan.make 2))
+            (let out (chan.make 2))
+            (let stage (isolate
+                '(lambda (in out)
+                    (begin
+                        (defun pump ()
+                            (begin
+                                (let x (chan.recv in))
+                                (if (== x null)
+                                    (chan.close out)
+                                    (begin (chan.send out (* x x)) (pump)))))
+                        (pump)))
+                in
+                out))
+            (chan.send in 1)
+            (chan.send in 2)
+            (chan.send in 3)
+            (chan.close in)
+            (let result (list (chan.recv out) (chan.recv out) (chan.recv out) (chan.recv out)))
+            (await stage)
+            result))"),
+        (lisp::array{ 1, 4, 9, lisp::null }));
+    EXPECT_THROW(eval("(await (isolate '(lambda () undefined_symbol)))"), std::runtime_error);
+}
+
+TEST(channels, exit_wakes_isolates_blocked_on_recv)
+{
+    // The child runs this test alone, so no isolates of other tests are about.
+    GTEST_FLAG_SET(death_test_style, "threadsafe");
+    EXPECT_EXIT(
+        {
+            // The isolate waits for a value nobody sends, then starts another one as the process exits.
+            eval(R"(
+                (begin
+                    (let ready (chan.make 1))
+                    (let never (chan.make 1))
+                    (isolate '(lambda (ready never)
+                                  (begin
+                                      (chan.send ready 1)
+                                      (chan.recv never)
+                                      (await (isolate '(lambda () 1)))))
+                             ready never)
+                    (chan.recv ready)))");
+            std::exit(0);
+        },
+        testing::ExitedWithCode(0),
+        "");
+}
+
+TEST(channels, recv_ok_tells_a_sent_null_from_the_end)
+{
+    EXPECT_EQ(
+        eval("(begin (let ch (chan.make 2)) (chan.send ch null) (chan.close ch) "
+             "(list (chan.recv-ok ch) (chan.recv-ok ch)))"),
+        (lisp::array{ lisp::array{ true, lisp::null }, lisp::array{ false, lisp::null } }));
+}
+
+TEST(prepared, binds_parameters)
+{
+    using namespace lisp::literals;
+    const auto score = lisp::prepare(lisp::parse("(+ x (* y 2))"), { "x"_s, "y"_s });
+    EXPECT_THAT(score(1, 2), 5);
+    EXPECT_THAT(score(10, 20), 50);
+    EXPECT_THROW(score(1), std::runtime_error);
+
+    const auto shadowing = lisp::prepare(lisp::parse("(begin (let tmp (car list)) (+ tmp 1))"), { "list"_s });
+    EXPECT_THAT(shadowing(lisp::array{ 4, 5 }), 5);
+    EXPECT_THAT(shadowing(lisp::array{ 7 }), 8);
+}
+
+TEST(prepared, resolves_globals_once)
+{
+    using namespace lisp::literals;
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::evaluate(lisp::parse("(begin (let k 10) (let ks '(1 2)) (defun twice (n) (* n 2)))"), &stack);
+    const auto expr = lisp::prepare(lisp::parse("(+ (twice x) (+ k (car ks)))"), { "x"_s }, &stack);
+    EXPECT_THAT(expr(4), 19);
+    lisp::evaluate(lisp::parse("(let k 100)"), &stack);
+    EXPECT_THAT(expr(4), 19);
+}
+
+TEST(prepared, closures_outlive_the_call)
+{
+    using namespace lisp::literals;
+    const auto make = lisp::prepare(lisp::parse("(lambda () x)"), { "x"_s });
+    const lisp::value first = make(1);
+    const lisp::value second = make(2);
+    EXPECT_EQ(first.as_callable()(lisp::arg_list{}), 1);
+    EXPECT_EQ(second.as_callable()(lisp::arg_list{}), 2);
+
+    // Made by a call nested in another, and over a name bound by let.
+    const auto outer = lisp::prepare(lisp::parse("(f 3)"), { "f"_s });
+    const lisp::value nested = outer(lisp::callable{ [&](const lisp::arg_list& args) { return make(args[0]); }, "f", 1 });
+    EXPECT_EQ(nested.as_callable()(lisp::arg_list{}), 3);
+    const auto counter = lisp::prepare(lisp::parse("(begin (let y (+ x 1)) (lambda () y))"), { "x"_s });
+    const lisp::value third = counter(4);
+    counter(7);
+    EXPECT_EQ(third.as_callable()(lisp::arg_list{}), 5);
+}
+
+TEST(prepared, concurrent_calls)
+{
+    using namespace lisp::literals;
+    const auto expr = lisp::prepare(lisp::parse("(begin (let sq (* x x)) (+ sq 1))"), { "x"_s });
+    std::vector<std::thread> threads;
+    std::vector<int> failures(4, 0);
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back(
+            [&, t]()
+            {
+                for (int i = 0; i < 1000; ++i)
+                {
+                    failures[t] += expr(i) != lisp::value{ i * i + 1 };
+                }
+            });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_THAT(failures, testing::Each(0));
+}
+
+TEST(batch, matches_row_by_row_evaluation)
+{
+    using namespace lisp::literals;
+    const auto expr = lisp::parse(R"(
+        (if (> x 2)
+            (* (+ x y) 2)
+            (cond ((== y 0) -1)
+                  ((< y 0) (* y 1.5))
+                  (true (str.cat "small " x)))))");
+    const auto xs = lisp::array{ 1, 2, 3, 4, 0, 5 };
+    const auto ys = lisp::array{ 0, -2, 1, -1, 7, 10 };
+    const auto result
+        = lisp::evaluate_batch(expr, { "x"_s, "y"_s }, { lisp::column::from_values(xs), lisp::column::from_values(ys) });
+
+    const auto row = lisp::prepare(expr, { "x"_s, "y"_s });
+    ASSERT_EQ(result.size(), xs.size());
+    for (std::size_t i = 0; i < xs.size(); ++i)
+    {
+        EXPECT_THAT(result.at(i), row(xs[i], ys[i])) << "row " << i;
+    }
+}
+
+TEST(batch, typed_kernels)
+{
+    using namespace lisp::literals;
+    const auto sum = lisp::evaluate_batch(
+        lisp::parse("(+ (* x 2) 1)"), { "x"_s }, { lisp::column{ lisp::column::integer_vector{ 1, 2, 3 } } });
+    EXPECT_THAT(std::get<lisp::column::integer_vector>(sum.data()), testing::ElementsAre(3, 5, 7));
+
+    const auto mask = lisp::evaluate_batch(
+        lisp::parse("(== x 2)"), { "x"_s }, { lisp::column{ lisp::column::integer_vector{ 1, 2, 3 } } });
+    EXPECT_THAT(std::get<lisp::column::boolean_vector>(mask.data()), testing::ElementsAre(0, 1, 0));
+
+    const auto constant = lisp::evaluate_batch(
+        lisp::parse("(+ 1 2)"), { "x"_s }, { lisp::column{ lisp::column::integer_vector{ 1, 2, 3 } } });
+    EXPECT_THAT(constant.to_array(), (lisp::array{ 3, 3, 3 }));
+
+    const auto mixed = lisp::evaluate_batch(
+        lisp::parse("(== x 2)"), { "x"_s }, { lisp::column{ lisp::column::floating_point_vector{ 2.0 } } });
+    EXPECT_THAT(mixed.to_array(), (lisp::array{ false }));
+}
+
+TEST(server, answers_requests)
+{
+    lisp::stack_type globals = lisp::default_stack();
+    lisp::evaluate(lisp::parse("(defun sq (n) (* n n))"), &globals);
+
+    const std::string path = "/tmp/lisp_test_" + std::to_string(::getpid()) + ".sock";
+    lisp::server server{ &globals, path };
+    std::thread loop{ [&]() { server.run(); } };
+
+    const auto ok = lisp::request(path, "(sq 7)");
+    EXPECT_TRUE(ok.ok);
+    EXPECT_EQ(ok.text, "49");
+
+    const auto isolated = lisp::request(path, "(begin (let sq 5) sq)");
+    EXPECT_EQ(isolated.text, "5");
+    EXPECT_EQ(lisp::request(path, "(sq 3)").text, "9");
+
+    const auto failed = lisp::request(path, "(undefined 1)");
+    EXPECT_FALSE(failed.ok);
+    EXPECT_THAT(failed.text, testing::HasSubstr("undefined"));
+
+    server.stop();
+    loop.join();
+}
+
+TEST(arena, scoped_to_evaluation)
+{
+    EXPECT_EQ(lisp::current_resource(), std::pmr::get_default_resource());
+    {
+        const lisp::arena_scope outer;
+        const auto resource = lisp::current_resource();
+        EXPECT_NE(resource, std::pmr::get_default_resource());
+        {
+            const lisp::arena_scope inner;
+            EXPECT_EQ(lisp::current_resource(), resource);
+        }
+        EXPECT_EQ(lisp::current_resource(), resource);
+    }
+    EXPECT_EQ(lisp::current_resource(), std::pmr::get_default_resource());
+
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::evaluate(lisp::parse("(begin (defun pair (a b) (list a b)) (let add3 (+ 3)) (let p (pair 1 2)))"), &stack);
+    EXPECT_THAT(lisp::evaluate(lisp::parse("p"), &stack), (lisp::array{ 1, 2 }));
+    EXPECT_THAT(lisp::evaluate(lisp::parse("(add3 4)"), &stack), 7);
+}
+
+TEST(memory, accounts_values)
+{
+    const auto account = std::make_shared<lisp::memory_account>();
+    lisp::stack_type stack = lisp::default_stack();
+    {
+        const lisp::memory_scope scope{ account };
+        lisp::evaluate(lisp::parse("(let xs (list \"some long string that does not fit inline\" 2 3))"), &stack);
+    }
+    EXPECT_GT(account->live(), 3 * sizeof(lisp::value));
+    EXPECT_GE(account->peak(), account->live());
+    stack.frame.clear();
+    EXPECT_EQ(account->live(), 0u);
+}
+
+TEST(memory, values_may_be_released_on_other_threads)
+{
+    const auto account = std::make_shared<lisp::memory_account>();
+    std::vector<lisp::value> values;
+    {
+        const lisp::memory_scope scope{ account };
+        for (int i = 0; i < 64; ++i)
+        {
+            values.push_back(lisp::array{ i, i + 1 });
+        }
+    }
+    EXPECT_GT(account->live(), 0u);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < 4; ++t)
+    {
+        threads.emplace_back(
+            [part = std::vector<lisp::value>(values.begin() + t * 16, values.begin() + (t + 1) * 16)]() mutable
+            { part.clear(); });
+    }
+    values.clear();
+    for (std::thread& t : threads)
+    {
+        t.join();
+    }
+    EXPECT_EQ(account->live(), 0u);
+}
+
+TEST(memory, quota_stops_runaway_allocation)
+{
+    const auto account = std::make_shared<lisp::memory_account>(256 * 1024);
+    lisp::stack_type stack = lisp::default_stack();
+    const lisp::memory_scope scope{ account };
+    lisp::evaluate(lisp::parse("(defun grow (lst) (grow (cons 1 lst)))"), &stack);
+    const auto live = account->live();
+    EXPECT_THROW(lisp::evaluate(lisp::parse("(grow '())"), &stack), lisp::memory_limit_exceeded);
+    EXPECT_LE(account->peak(), 256u * 1024);
+    EXPECT_EQ(account->live(), live);
+    EXPECT_THAT(lisp::evaluate(lisp::parse("(+ 1 2)"), &stack), 3);
+}
+
+TEST(memory, quota_counts_the_frames_closures_keep)
+{
+    const auto account = std::make_shared<lisp::memory_account>(64 * 1024);
+    lisp::stack_type stack = lisp::default_stack();
+    const lisp::memory_scope scope{ account };
+    // Each closure keeps a frame with the one before; only frames are allocated. The budget stops the loop otherwise.
+    for (const char* code : { "(loop ((f null)) (recur (lambda () f)))",
+                              "(loop ((f null)) (recur ((lambda (h) (begin (let g h) (lambda () g))) f)))" })
+    {
+        lisp::budget limits{ 1000 };
+        EXPECT_THROW(lisp::evaluate(lisp::parse(code), &stack, limits), lisp::memory_limit_exceeded);
+    }
+    EXPECT_LE(account->peak(), 64u * 1024);
+    // Globals are charged too, and refunded when they go away.
+    const auto live = account->live();
+    {
+        lisp::stack_type globals = lisp::default_stack();
+        lisp::evaluate(lisp::parse("(dotimes (i 8) (let g (lambda () i)))"), &globals);
+        lisp::evaluate(lisp::parse("(begin (let a 1) (let b 2) (let c 3) (let d 4) (let e 5))"), &globals);
+        EXPECT_GT(account->live(), live);
+    }
+    EXPECT_EQ(account->live(), live);
+}
+
+TEST(budget, counts_calls)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::budget limits{ 100 };
+    EXPECT_THAT(lisp::evaluate(lisp::parse("(+ (* 2 3) 4)"), &stack, limits), 10);
+    EXPECT_EQ(limits.used(), 2u);
+    EXPECT_EQ(limits.remaining(), 98u);
+
+    lisp::budget exact{ 2 };
+    EXPECT_THAT(lisp::evaluate(lisp::parse("(+ (* 2 3) 4)"), &stack, exact), 10);
+    EXPECT_EQ(exact.remaining(), 0u);
+    EXPECT_THROW(lisp::evaluate(lisp::parse("(+ 1 1)"), &stack, exact), lisp::budget_exceeded);
+}
+
+TEST(budget, stops_runaway_evaluation)
+{
+    using namespace std::chrono_literals;
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::evaluate(lisp::parse("(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"), &stack);
+
+    lisp::budget fuel{ 5000 };
+    EXPECT_THROW(lisp::evaluate(lisp::parse("(fib 25)"), &stack, fuel), lisp::budget_exceeded);
+    EXPECT_EQ(fuel.remaining(), 0u);
+
+    lisp::budget deadline{ {}, 5ms };
+    EXPECT_THROW(lisp::evaluate(lisp::parse("(fib 40)"), &stack, deadline), lisp::budget_exceeded);
+    EXPECT_FALSE(deadline.remaining());
+
+    EXPECT_THAT(lisp::evaluate(lisp::parse("(fib 10)"), &stack), 55);
+}
+
+TEST(small_vector, spills_past_inline_capacity)
+{
+    std::array<std::byte, 1024> buffer;
+    std::pmr::monotonic_buffer_resource resource{ buffer.data(), buffer.size(), std::pmr::null_memory_resource() };
+    small_vector<std::string, 2> v(&resource);
+    v.push_back("a");
+    v.push_back("b");
+    EXPECT_EQ(v.capacity(), 2u);
+    v.push_back(v.front());
+    EXPECT_GT(v.capacity(), 2u);
+    v.insert(v.begin() + 1, "c");
+    EXPECT_THAT(v, testing::ElementsAre("a", "c", "b", "a"));
+    v.erase(v.begin());
+    EXPECT_THAT(v, testing::ElementsAre("c", "b", "a"));
+
+    const small_vector<std::string, 2> copy = v;
+    EXPECT_EQ(copy.get_allocator().resource(), std::pmr::get_default_resource());
+    small_vector<std::string, 2> moved = std::move(v);
+    EXPECT_EQ(moved.get_allocator().resource(), &resource);
+    EXPECT_THAT(moved, testing::ElementsAre("c", "b", "a"));
+    EXPECT_TRUE(v.empty());
+}
+
+TEST(flat_map, keeps_keys_sorted)
+{
+    flat_map<int, std::string, small_vector<std::pair<int, std::string>, 2>> m{ { 3, "c" }, { 1, "a" }, { 3, "x" } };
+    EXPECT_EQ(m.size(), 2u);
+    EXPECT_EQ(m.find(3)->second, "c");
+    EXPECT_FALSE(m.emplace(1, "y").second);
+    m.insert_or_assign(1, "y");
+    m[2] = "b";
+    EXPECT_THAT(m, testing::ElementsAre(testing::Pair(1, "y"), testing::Pair(2, "b"), testing::Pair(3, "c")));
+    EXPECT_EQ(m.find(4), m.end());
+}
+
+TEST(callable, shared_between_copies)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    const lisp::value fn = lisp::evaluate(lisp::parse("(lambda (a b) (+ a b))"), &stack);
+    const lisp::value copy = fn;
+    EXPECT_EQ(&copy.as_callable().fn(), &fn.as_callable().fn());
+    EXPECT_EQ(str(fn), "lambda [2]");
+
+    const lisp::value bound = fn.as_callable()(lisp::arg_list{ 1 });
+    EXPECT_EQ(&bound.as_callable().fn(), &fn.as_callable().fn());
+    EXPECT_EQ(str(bound), "lambda [2], bound_args=[1]");
+    EXPECT_THAT(bound.as_callable()(lisp::arg_list{ 2 }), 3);
+}
+
+TEST(callable, partial)
+{
+    EXPECT_THAT(eval("((partial + 1) 2)"), 3);
+    EXPECT_THAT(eval("((partial (partial list 1) 2) 3)"), (lisp::array{ 1, 2, 3 }));
+    EXPECT_THAT(eval("(seq.map (partial * 2) '(1 2 3))"), (lisp::array{ 2, 4, 6 }));
+}
+
+TEST(profiler, counts_calls_per_function)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::evaluate(lisp::parse("(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"), &stack);
+
+    lisp::profiler profiler;
+    {
+        const lisp::profiler_scope scope{ profiler };
+        EXPECT_THAT(lisp::evaluate(lisp::parse("(seq.map fib '(15 16))"), &stack), (lisp::array{ 610, 987 }));
+    }
+    EXPECT_THAT(lisp::evaluate(lisp::parse("(fib 5)"), &stack), 5);
+
+    std::map<std::string, lisp::profiler::function_stats> stats;
+    for (const auto& s : profiler.stats())
+    {
+        stats.emplace(s.name, s);
+    }
+    EXPECT_EQ(stats.at("fib").calls, 1973u + 3193u);
+    EXPECT_EQ(stats.at("seq.map").calls, 1u);
+    EXPECT_EQ(stats.at("less").calls, 1973u + 3193u);
+    EXPECT_GE(stats.at("seq.map").inclusive, stats.at("fib").inclusive);
+    EXPECT_LE(stats.at("fib").exclusive, stats.at("fib").inclusive);
+
+    std::stringstream folded;
+    profiler.write_folded(folded);
+    EXPECT_THAT(folded.str(), testing::HasSubstr("seq.map;fib;fib"));
+}
+
+TEST(profiler, merges_closures_of_one_lambda)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::evaluate(lisp::parse("(defun adder (n) (lambda (x) (+ x n)))"), &stack);
+
+    // Each call makes a new closure; they are one function, and the profiler does not keep them all alive.
+    lisp::profiler profiler;
+    {
+        const lisp::profiler_scope scope{ profiler };
+        EXPECT_THAT(lisp::evaluate(lisp::parse("(begin (let s 0) (dotimes (i 10000) (let s ((adder i) s))) s)"), &stack),
+                    49995000);
+    }
+
+    std::size_t lambdas = 0;
+    for (const auto& s : profiler.stats())
+    {
+        if (s.name.rfind("lambda", 0) == 0)
+        {
+            ++lambdas;
+            EXPECT_EQ(s.calls, 10000u);
+        }
+    }
+    EXPECT_EQ(lambdas, 1u);
+}
+
+TEST(profiler, hardware_counts_per_function)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::profiler profiler{ true };
+    {
+        const lisp::profiler_scope scope{ profiler };
+        EXPECT_THAT(
+            lisp::evaluate(
+                lisp::parse("(begin (defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))) (fib 15))"),
+                &stack),
+            610);
+    }
+
+    std::map<std::string, lisp::profiler::function_stats> stats;
+    for (const auto& s : profiler.stats())
+    {
+        stats.emplace(s.name, s);
+    }
+    // Top-level forms are reported by their first two elements.
+    EXPECT_EQ(stats.at("(fib 15)").calls, 1u);
+    EXPECT_EQ(stats.at("(defun fib ...)").calls, 1u);
+    EXPECT_GE(stats.at("(fib 15)").inclusive, stats.at("fib").inclusive);
+
+    // Counters are often unavailable in containers and VMs; then the profiler says why and only measures time.
+    const lisp::hardware_counts& fib = stats.at("fib").inclusive_counts;
+    if (profiler.hardware_counters())
+    {
+        EXPECT_TRUE(profiler.hardware_counters_error().empty());
+        EXPECT_GT(fib.cycles, 0u);
+        EXPECT_GT(fib.instructions, 0u);
+        EXPECT_LE(stats.at("fib").exclusive_counts.instructions, fib.instructions);
+    }
+    else
+    {
+        EXPECT_FALSE(profiler.hardware_counters_error().empty());
+        EXPECT_EQ(fib.cycles, 0u);
+        EXPECT_EQ(fib.instructions, 0u);
+    }
+}
+
+TEST(stats, counts_work_on_this_thread)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::evaluate(lisp::parse("(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"), &stack);
+    const lisp::value program = lisp::parse("(fib 10)");
+
+    const lisp::runtime_stats before = lisp::stats_snapshot();
+    EXPECT_THAT(lisp::evaluate(program, &stack), 55);
+    const lisp::runtime_stats used = lisp::stats_snapshot() - before;
+    EXPECT_EQ(used.frames, 177u);
+    EXPECT_EQ(used.calls, 177u * 2 + 88u * 3);
+    EXPECT_EQ(used.strings, 0u);
+    EXPECT_EQ(used.arrays, 0u);
+
+    const lisp::value text = std::string(100, 'x');
+    const lisp::runtime_stats before_copy = lisp::stats_snapshot();
+    const lisp::value copy = text;
+    const lisp::runtime_stats copied = lisp::stats_snapshot() - before_copy;
+    EXPECT_EQ(copied.value_copies, 1u);
+    EXPECT_EQ(copied.strings, 0u);
+    EXPECT_EQ(copied.payload_bytes, 0u);
+}
+
+TEST(stats, sys_stats_builtin)
+{
+    const lisp::value result = eval("(begin (str.cat \"a\" \"b\") (sys.stats))");
+    ASSERT_TRUE(result.is_array());
+    std::map<std::string, lisp::value> counters;
+    for (const lisp::value& pair : result.as_array())
+    {
+        counters.emplace(str(pair.as_array().at(0)), pair.as_array().at(1));
+    }
+    EXPECT_THAT(
+        counters,
+        testing::ElementsAre(
+            testing::Key("arrays"),
+            testing::Key("cached_lookups"),
+            testing::Key("calls"),
+            testing::Key("frames"),
+            testing::Key("lookups"),
+            testing::Key("payload_bytes"),
+            testing::Key("strings"),
+            testing::Key("value_copies"),
+            testing::Key("values")));
+    EXPECT_GE(counters.at("calls").as_integer(), 2);
+    EXPECT_GE(counters.at("strings").as_integer(), 1);
+}
+
+TEST(tracer, records_spans_above_threshold)
+{
+    using namespace std::chrono_literals;
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::tracer everything;
+    lisp::tracer slow{ 1h };
+    {
+        const lisp::tracer_scope outer{ slow };
+        const lisp::tracer_scope scope{ everything };
+        lisp::evaluate(lisp::parse("(begin (defun sq (x) (* x x)) ((pipe sq (partial + 1)) 3))"), &stack);
+    }
+    {
+        const lisp::tracer_scope scope{ slow };
+        lisp::evaluate(lisp::parse("(sq 2)"), &stack);
+    }
+
+    std::stringstream all;
+    everything.write_json(all);
+    EXPECT_THAT(all.str(), testing::StartsWith("{\"traceEvents\":["));
+    EXPECT_THAT(all.str(), testing::HasSubstr("{\"name\":\"(defun sq ...)\",\"cat\":\"eval\",\"ph\":\"X\""));
+    EXPECT_THAT(all.str(), testing::HasSubstr("{\"name\":\"pipe\",\"cat\":\"call\""));
+    EXPECT_THAT(all.str(), testing::HasSubstr("{\"name\":\"sq\",\"cat\":\"call\""));
+    EXPECT_THAT(all.str(), testing::HasSubstr("{\"name\":\"multiplies\",\"cat\":\"call\""));
+
+    // Calls under the threshold are dropped; top-level forms are always kept.
+    std::stringstream filtered;
+    slow.write_json(filtered);
+    EXPECT_THAT(filtered.str(), testing::HasSubstr("\"name\":\"(sq 2)\""));
+    EXPECT_THAT(filtered.str(), testing::Not(testing::HasSubstr("\"cat\":\"call\"")));
+}
+
+TEST(tracer, ring_keeps_latest_spans)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::tracer tracer{ {}, 4 };
+    {
+        const lisp::tracer_scope scope{ tracer };
+        for (int i = 0; i < 10; ++i)
+        {
+            lisp::evaluate(lisp::parse(str("(quote ", i, ")")), &stack);
+        }
+    }
+    std::stringstream json;
+    tracer.write_json(json);
+    EXPECT_THAT(json.str(), testing::Not(testing::HasSubstr("(quote 5)")));
+    EXPECT_THAT(json.str(), testing::HasSubstr("(quote 6)"));
+    EXPECT_THAT(json.str(), testing::HasSubstr("(quote 9)"));
+}
+
+TEST(tracer, nested_scopes_keep_one_ring_per_thread)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::tracer first;
+    lisp::tracer second;
+    {
+        const lisp::tracer_scope outer{ first };
+        for (int i = 0; i < 3; ++i)
+        {
+            lisp::evaluate(lisp::parse("(quote a)"), &stack);
+            const lisp::tracer_scope inner{ second };
+            lisp::evaluate(lisp::parse("(quote b)"), &stack);
+        }
+        lisp::evaluate(lisp::parse("(quote c)"), &stack);
+    }
+
+    // Switching between the tracers leaves each with the one thread it was used on.
+    std::stringstream json;
+    first.write_json(json);
+    EXPECT_THAT(json.str(), testing::HasSubstr("(quote c)"));
+    EXPECT_THAT(json.str(), testing::Not(testing::HasSubstr("(quote b)")));
+    EXPECT_THAT(json.str(), testing::Not(testing::HasSubstr("\"tid\":2")));
+    std::stringstream other;
+    second.write_json(other);
+    EXPECT_THAT(other.str(), testing::Not(testing::HasSubstr("(quote a)")));
+    EXPECT_THAT(other.str(), testing::Not(testing::HasSubstr("\"tid\":2")));
+}
+
+TEST(bench, reports_timing_and_allocations)
+{
+    const lisp::value result = eval("(bench (str.cat \"a\" \"b\") 10)");
+    std::map<std::string, lisp::value> report;
+    for (const lisp::value& pair : result.as_array())
+    {
+        report.emplace(str(pair.as_array().at(0)), pair.as_array().at(1));
+    }
+    EXPECT_GE(report.at("samples").as_floating_point(), 30.0);
+    EXPECT_GE(report.at("runs").as_floating_point(), report.at("samples").as_floating_point());
+    EXPECT_GT(report.at("median").as_floating_point(), 0.0);
+    EXPECT_LE(report.at("min").as_floating_point(), report.at("median").as_floating_point());
+    EXPECT_LE(report.at("median").as_floating_point(), report.at("p99").as_floating_point());
+    EXPECT_DOUBLE_EQ(report.at("allocations").as_floating_point(), 1.0);
+    EXPECT_THROW(eval("(bench)"), std::runtime_error);
+}
+
+TEST(bench, time_returns_the_value)
+{
+    const lisp::value result = eval("(time (+ 1 2))");
+    ASSERT_EQ(result.as_array().size(), 3u);
+    EXPECT_THAT(result.as_array().at(0), (lisp::array{ lisp::symbol{ "value" }, 3 }));
+    EXPECT_GE(result.as_array().at(1).as_array().at(1).as_floating_point(), 0.0);
+    EXPECT_GE(result.as_array().at(2).as_array().at(1).as_floating_point(), 0.0);
+}
+
+TEST(bench, runs_are_budget_steps)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::budget limits{ 100 };
+    EXPECT_THROW(lisp::evaluate(lisp::parse("(bench 1)"), &stack, limits), lisp::budget_exceeded);
+}
+
+// Defined by compiled_program.cpp, which lisp --compile generates from compiled_program.lisp.
+lisp::value compiled_test_program(lisp::stack_type& globals);
+
+TEST(compiler, compiled_program_matches_interpreter)
+{
+    std::ifstream file{ LISP_COMPILED_PROGRAM };
+    const std::string text{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+    lisp::stack_type interpreted = lisp::default_stack();
+    const lisp::value expected = lisp::evaluate(lisp::parse(text), &interpreted);
+
+    lisp::stack_type compiled = lisp::default_stack();
+    EXPECT_EQ(compiled_test_program(compiled), expected);
+    // Compiled functions are bound in the globals as well.
+    EXPECT_EQ(lisp::evaluate(lisp::parse("(fib 10)"), &compiled), 55);
+    EXPECT_THROW(lisp::evaluate(lisp::parse("(fib 1.5)"), &compiled), std::runtime_error);
+}
+
+TEST(compiler, unboxes_and_calls_known_functions_directly)
+{
+    const std::string code = lisp::compile_to_cpp(
+        lisp::parse("(begin (defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))) (fib 20))"));
+    EXPECT_THAT(code, testing::HasSubstr("std::int32_t fn_fib_0(lisp::stack_type& globals, std::int32_t p_n_0)"));
+    EXPECT_THAT(code, testing::HasSubstr("fn_fib_0(globals, (p_n_0 - 1))"));
+    EXPECT_THAT(code, testing::Not(testing::HasSubstr("call_dynamic")));
+}
+
+TEST(compiler, boxes_functions_passed_as_values)
+{
+    const std::string code
+        = lisp::compile_to_cpp(lisp::parse("(begin (defun inc (x) (+ x 1)) (seq.map inc '(1 2)) (inc 2))"));
+    EXPECT_THAT(code, testing::HasSubstr("lisp::value fn_inc_0(lisp::stack_type& globals, const lisp::value& p_x_0)"));
+}
+
+TEST(compiler, keeps_frames_of_functions_that_return_closures)
+{
+    const std::string code
+        = lisp::compile_to_cpp(lisp::parse("(begin (defun adder (n) (lambda (x) (+ x n))) ((adder 1) 2))"));
+    EXPECT_THAT(code, testing::HasSubstr("const lisp::function_frame frame{ globals, n"));
+    EXPECT_THAT(code, testing::HasSubstr(", *frame, { { s"));
+}
+
+lisp::value optimized(std::string_view code)
+{
+    return lisp::optimize(lisp::parse(code));
+}
+
+TEST(optimize, folds_constants_and_prunes_branches)
+{
+    EXPECT_EQ(optimized("(+ 2 (* 3 4))"), 14);
+    EXPECT_EQ(optimized("(if (< 1 2) \"yes\" (undefined))"), lisp::value{ std::string{ "yes" } });
+    EXPECT_EQ(optimized("(cond ((== 1 2) a) (true b) (c d))"), lisp::symbol{ "b" });
+    EXPECT_EQ(optimized("(cond (x a) (false b) (true c) (y d))"), lisp::parse("(cond (x a) (true c))"));
+    EXPECT_EQ(optimized("(begin 1 (begin x 2) (begin y))"), lisp::parse("(begin x y)"));
+    EXPECT_EQ(optimized("(car '(1 2))"), 1);
+    EXPECT_EQ(optimized("(cdr '(1 2))"), lisp::parse("(quote (2))"));
+    // Integer division by zero is left for the evaluation; other errors are raised here (see optimize.checks_calls).
+    EXPECT_EQ(optimized("(/ 1 0)").as_array().size(), 3u);
+    EXPECT_THROW(eval("(car 1)"), std::exception);
+    EXPECT_THROW(optimized("(car 1)"), std::runtime_error);
+}
+
+TEST(optimize, inlines_builtins_unless_rebound)
+{
+    const lisp::value call = optimized("(+ x 1)");
+    EXPECT_TRUE(call.as_array().at(0).is_callable());
+    const lisp::value shadowed = optimized("(begin (let + -) (+ 1 2))");
+    EXPECT_EQ(shadowed.as_array().at(2).as_array().at(0), lisp::symbol{ "+" });
+    lisp::stack_type stack = lisp::default_stack();
+    EXPECT_EQ(lisp::evaluate(shadowed, &stack), -1);
+    // Names bound in the globals rather than the prelude are left to be looked up.
+    lisp::stack_type globals{ {}, &stack };
+    globals.insert(lisp::symbol{ "+" }, *stack.find(lisp::symbol{ "-" }));
+    EXPECT_EQ(lisp::optimize(lisp::parse("(+ 1 2)"), globals).as_array().at(0), lisp::symbol{ "+" });
+}
+
+TEST(optimize, beta_reduces_small_lambdas)
+{
+    const lisp::value calls = optimized("(begin (defun sq (x) (* x x)) (list (sq 5) (sq y)))").as_array().at(2);
+    EXPECT_EQ(calls.as_array().at(1), 25);
+    EXPECT_TRUE(calls.as_array().at(2).as_array().at(0).is_callable());
+    EXPECT_EQ(optimized("((lambda (a b) (- a b)) 7 2)"), 5);
+    // Recursive functions, arguments that must be evaluated once and calls before the definition are kept.
+    const lisp::value kept = optimized(
+        "(begin (f 1) (defun f (n) (if (< n 2) n (f (- n 1)))) (defun g (x) (+ x x)) (f 3) (g (f 2)))");
+    EXPECT_EQ(kept.as_array().at(1).as_array().at(0), lisp::symbol{ "f" });
+    EXPECT_EQ(kept.as_array().at(4).as_array().at(0), lisp::symbol{ "f" });
+    EXPECT_EQ(kept.as_array().at(5).as_array().at(0), lisp::symbol{ "g" });
+}
+
+TEST(optimize, preserves_results)
+{
+    for (const char* code : {
+             "(begin (defun sq (x) (* x x)) (defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))) "
+             "(list (sq 7) (fib 15) (sq (fib 6))))",
+             "(begin (let x 3) (defun add (a) (+ a x)) (let x 10) (add 1))",
+             "(begin (defun twice (f v) (f (f v))) (twice (lambda (n) (* n 3)) 2))",
+             "(begin (let k 5) (defun scale (x) (* x k)) (defun f (k) (scale k)) (f 2))",
+             "(cond ((< 2 1) 1) ((== 1 1) (str.cat \"a\" \"b\")) (true 3))",
+             // Functions rebound below the top level are not inlined.
+             "(begin (defun f () 1) (let c true) (if c (let f (lambda () 2)) 0) (f))",
+         })
+    {
+        lisp::stack_type plain = lisp::default_stack();
+        lisp::stack_type stack = lisp::default_stack();
+        const lisp::value program = lisp::parse(code);
+        EXPECT_EQ(lisp::evaluate(lisp::optimize(program, stack), &stack), lisp::evaluate(program, &plain)) << code;
+    }
+    // dotimes leaves its variable bound to a number, which cannot be called.
+    lisp::stack_type stack = lisp::default_stack();
+    EXPECT_THROW(
+        lisp::evaluate(lisp::optimize(lisp::parse("(begin (defun f () 1) (dotimes (f 3) 0) (f))"), stack), &stack),
+        std::runtime_error);
+}
+
+TEST(inline_cache, repeated_calls_skip_lookups)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::evaluate(lisp::parse("(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"), &stack);
+    const lisp::runtime_stats before = lisp::stats_snapshot();
+    EXPECT_EQ(lisp::evaluate(lisp::parse("(fib 15)"), &stack), 610);
+    const lisp::runtime_stats used = lisp::stats_snapshot() - before;
+    // Only the parameter, which is in a new frame on every call, and each name's first lookup go through the frames.
+    EXPECT_GT(used.cached_lookups, used.lookups);
+}
+
+TEST(inline_cache, sees_rebound_and_hidden_names)
+{
+    EXPECT_EQ(eval("(begin (defun f () 1) (defun g () (f)) (let a (g)) (defun f () 2) (list a (g)))"), lisp::parse("(1 2)"));
+    EXPECT_EQ(eval("(begin (defun h (x) (+ x 1)) (let a (h 1)) (let + -) (list a (h 1)))"), lisp::parse("(2 0)"));
+    EXPECT_EQ(
+        eval("(begin (let y 100) (defun f (flag) (begin (cond (flag (let y 1)) (true 0)) ((lambda () (+ y 0))))) "
+             "(list (f false) (f true) (f false)))"),
+        lisp::parse("(100 1 100)"));
+
+    const lisp::value program = lisp::parse("(begin (f) (f))");
+    for (int n : { 1, 2 })
+    {
+        lisp::stack_type stack = lisp::default_stack();
+        lisp::evaluate(lisp::parse(str("(defun f () ", n, ")")), &stack);
+        EXPECT_EQ(lisp::evaluate(program, &stack), n);
+        lisp::stack_type local{ {}, &stack };
+        local.insert(lisp::symbol{ "f" }, *stack.find(lisp::symbol{ "list" }));
+        EXPECT_EQ(lisp::evaluate(program, &local), lisp::array{});
+    }
+}
+
+TEST(inline_cache, survives_other_interpreters)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    const lisp::value call = lisp::parse("(+ 1 2)");
+    lisp::evaluate(call, &stack);
+    std::thread{ []()
+                 {
+                     for (int i = 0; i < 10; ++i)
+                     {
+                         lisp::stack_type other = lisp::default_stack();
+                         lisp::evaluate(lisp::parse("(let g 1)"), &other);
+                     }
+                 } }
+        .join();
+    const lisp::runtime_stats before = lisp::stats_snapshot();
+    EXPECT_EQ(lisp::evaluate(call, &stack), 3);
+    const lisp::runtime_stats used = lisp::stats_snapshot() - before;
+    EXPECT_EQ(used.lookups, 0u);
+    EXPECT_EQ(used.cached_lookups, 1u);
+}
+
+TEST(value, binary_operators_by_operand_types)
+{
+    using lisp::value;
+    using namespace std::string_literals;
+    EXPECT_EQ(value{ 7 } + value{ 2 }, 9);
+    EXPECT_THAT(value{ 7 } / value{ 2.0 }, Approx(3.5));
+    EXPECT_THAT(value{ 1.5 } * value{ 2 }, Approx(3.0));
+    EXPECT_EQ(value{ 7 } % value{ 3 }, 1);
+    EXPECT_TRUE(value{ 2 } < value{ 2.5 });
+    EXPECT_TRUE(value{ "abc"s } < value{ "abd"s });
+    EXPECT_FALSE(value{ 1 } == value{ 1.0 });
+
+    const auto message = [](auto f)
+    {
+        try
+        {
+            f();
+        }
+        catch (const std::runtime_error& ex)
+        {
+            return std::string{ ex.what() };
+        }
+        return std::string{};
+    };
+    EXPECT_EQ(message([] { return value{ "a"s } + value{ 1 }; }), "Cannot add string and integer");
+    EXPECT_EQ(message([] { return value{ 1.5 } % value{ 1 }; }), "Cannot mod floating_point and integer");
+    EXPECT_EQ(message([] { return value{ "a"s } <= value{ 1 }; }), "Cannot compare string and integer");
+    EXPECT_EQ(message([] { return value{ true }.as_integer(); }), "accessing: integer, actual: boolean");
+}
+
+TEST(macros, defmacro_rewrites_calls)
+{
+    EXPECT_EQ(eval("(begin (defmacro unless (c a b) (list (quote if) c b a)) (unless (< 1 2) 10 20))"), 20);
+    EXPECT_EQ(
+        eval("(begin (defmacro my_defun (name x body) (list (quote let) name (list (quote lambda) (list x) body))) "
+             "(my_defun inc n (+ n 1)) (inc 41))"),
+        42);
+
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::evaluate(lisp::parse("(defmacro sq (x) (list (quote *) x x))"), &stack);
+    EXPECT_TRUE(lisp::is_macro(*stack.find(lisp::symbol{ "sq" })));
+    // Bound in the frame, the macro applies to later expressions as well.
+    EXPECT_EQ(lisp::evaluate(lisp::parse("(begin (defun f (n) (sq (+ n 1))) (f 2))"), &stack), 9);
+    EXPECT_EQ(lisp::expand(lisp::parse("(g (sq y))"), stack), lisp::parse("(g (* y y))"));
+
+    EXPECT_THROW(eval("(defmacro m (x))"), std::runtime_error);
+    EXPECT_THROW(eval("(begin (defmacro m (x) x) (m 1 2))"), std::runtime_error);
+}
+
+TEST(macros, bound_names_hide_macros)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::evaluate(lisp::parse("(defmacro sq (x) (list (quote *) x x))"), &stack);
+    // Parameters and loop variables are not calls, and calls through them are not expanded.
+    EXPECT_EQ(lisp::expand(lisp::parse("(lambda (sq y) (sq y))"), stack), lisp::parse("(lambda (sq y) (sq y))"));
+    EXPECT_EQ(lisp::evaluate(lisp::parse("(begin (defun g (sq y) (sq y)) (g (lambda (v) (+ v 1)) 2))"), &stack), 3);
+    EXPECT_EQ(lisp::expand(lisp::parse("(loop ((n (sq 2)) (sq car)) (sq (list n)))"), stack),
+              lisp::parse("(loop ((n (* 2 2)) (sq car)) (sq (list n)))"));
+    EXPECT_EQ(lisp::expand(lisp::parse("(dotimes (sq (sq 2)) (sq 1))"), stack),
+              lisp::parse("(dotimes (sq (* 2 2)) (sq 1))"));
+    // Outside their scope the macro applies again.
+    EXPECT_EQ(lisp::expand(lisp::parse("(list (lambda (sq) sq) (sq 3))"), stack),
+              lisp::parse("(list (lambda (sq) sq) (* 3 3))"));
+}
+
+TEST(macros, programs_are_expanded_once)
+{
+    const lisp::value plain = lisp::parse("(begin (let a (list 1 2)) (car a))");
+    EXPECT_EQ(&lisp::expand(plain).as_array(), &plain.as_array());
+
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::evaluate(lisp::parse("(begin (defmacro sq (x) (list (quote *) x x)) (defun f (n) (sq n)))"), &stack);
+    const lisp::runtime_stats before = lisp::stats_snapshot();
+    EXPECT_EQ(lisp::evaluate(lisp::parse("(f 3)"), &stack), 9);
+    // f and *; the body of f was expanded when f was defined.
+    EXPECT_EQ((lisp::stats_snapshot() - before).calls, 2u);
+}
+
+TEST(closures, capture_the_free_variables_of_their_body)
+{
+    const lisp::value form = lisp::parse("(lambda (x) (begin (let y (quote z)) (+ x y (lambda (w) (list w v)))))");
+    const lisp::closure_info& info = lisp::closure_info::of(form);
+    EXPECT_EQ(
+        info.free,
+        (std::vector<lisp::symbol>{
+            lisp::symbol{ "+" }, lisp::symbol{ "list" }, lisp::symbol{ "v" }, lisp::symbol{ "y" } }));
+    EXPECT_EQ(info.assigned, std::vector<lisp::symbol>{ lisp::symbol{ "y" } });
+    EXPECT_EQ(&lisp::closure_info::of(form), &info);
+}
+
+TEST(closures, outlive_the_frames_they_were_made_in)
+{
+    EXPECT_EQ(
+        eval("(begin (defun adder (n) (lambda (x) (+ x n))) (defun compose (f g) (lambda (x) (f (g x)))) "
+             "(let add2 (adder 2)) (let add7 (compose add2 (adder 5))) (list (add2 1) (add7 1)))"),
+        lisp::parse("(3 8)"));
+}
+
+TEST(closures, see_names_bound_later_in_their_frame)
+{
+    EXPECT_EQ(
+        eval("(begin (defun count (n) (begin (let down (lambda (k) (if (== k 0) 0 (+ 1 (down (- k 1)))))) (down n))) "
+             "(count 5))"),
+        5);
+    EXPECT_EQ(eval("(begin (defun f (n) (begin (let g (lambda () n)) (let n 2) (g))) (f 1))"), 2);
+}
+
+TEST(closures, keep_frames_that_bind_their_names_later)
+{
+    EXPECT_FALSE(lisp::closure_info::of(lisp::parse("(lambda (n) (lambda (x) (+ x n)))")).shared);
+    EXPECT_TRUE(lisp::closure_info::of(lisp::parse("(lambda (n) (begin (let m n) (lambda () m)))")).shared);
+    EXPECT_TRUE(
+        lisp::closure_info::of(lisp::parse("(lambda (n) ((lambda () (begin (let m n) (lambda () m)))))")).shared);
+
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::evaluate(lisp::parse("(defun mk (n) (begin (let m (+ n 1)) (lambda () m)))"), &stack);
+    lisp::evaluate(lisp::parse("(defun counter () (begin (let down (lambda (k) (if (== k 0) 0 (+ 1 (down (- k 1)))))) "
+                               "(lambda (n) (down n))))"),
+                   &stack);
+    lisp::evaluate(lisp::parse("(defun in-place (n) ((lambda (x) (begin (let y (+ x n)) (lambda () y))) 1))"), &stack);
+    lisp::evaluate(lisp::parse("(defun in-loop (n) (loop ((i 0)) (begin (let j (* i 10)) "
+                               "(if (< i n) (recur (+ i 1)) (lambda () j)))))"),
+                   &stack);
+    const lisp::value made = lisp::evaluate(lisp::parse("(list (mk 1) (counter) (in-place 2) (in-loop 3))"), &stack);
+    // Calls in between reuse the memory the frames were in, were they on the stack.
+    EXPECT_EQ(lisp::evaluate(lisp::parse("(list ((mk 5)) ((counter) 7) ((in-place 4)) ((in-loop 1)))"), &stack),
+              lisp::parse("(6 7 5 10)"));
+    const lisp::array& fns = made.as_array();
+    EXPECT_EQ(fns[0].as_callable()(lisp::arg_list{}), 2);
+    EXPECT_EQ(fns[1].as_callable()(lisp::arg_list{ 5 }), 5);
+    EXPECT_EQ(fns[2].as_callable()(lisp::arg_list{}), 3);
+    EXPECT_EQ(fns[3].as_callable()(lisp::arg_list{}), 30);
+    EXPECT_EQ(eval("(begin (defun mk (n) (begin (let m (+ n 1)) (lambda () m))) ((mk 1)))"), 2);
+}
+
+TEST(closures, returned_local_functions_free_their_frames)
+{
+    // Each frame binds a copy of `probe`, so its count tells whether the frames went away.
+    lisp::stack_type stack = lisp::default_stack();
+    const lisp::callable probe{ [](const lisp::arg_list&) { return lisp::value{ 1 }; }, "probe", 0 };
+    stack.insert(lisp::symbol{ "probe" }, probe);
+    const long before = probe.use_count();
+    EXPECT_EQ(
+        lisp::evaluate(
+            lisp::parse("(begin (defun mk (x) (begin (let p probe) (defun rec (n) (if (< n 1) x (rec (- n 1)))) rec)) "
+                        "(defun mk2 (x) (begin (let p probe) (defun ev (n) (if (< n 1) x (od (- n 1)))) "
+                        "(defun od (n) (ev n)) (let also ev) ev)) "
+                        "(dotimes (i 10) (list ((mk i) 3) ((mk2 i) 2))) (list ((mk 4) 1) ((mk2 5) 1)))"),
+            &stack),
+        lisp::parse("(4 5)"));
+    EXPECT_EQ(probe.use_count(), before);
+    // Frames that closures made in lambdas applied in them only pass through, as loops do.
+    EXPECT_EQ(
+        lisp::evaluate(
+            lisp::parse("(begin (defun chain (k) (loop ((f probe) (i 0) (p probe)) (if (< i k) "
+                        "(recur ((lambda (h) (begin (let g h) (lambda () g))) f) (+ i 1) p) f))) "
+                        "(dotimes (i 10) (chain i)) ((((chain 2)))))"),
+            &stack),
+        1);
+    EXPECT_EQ(probe.use_count(), before);
+    // Nor do closures that only a callable binding arguments to them holds.
+    EXPECT_EQ(lisp::evaluate(lisp::parse("(list ((partial (mk 7) 2)) ((partial (mk2 8) 1)))"), &stack),
+              lisp::parse("(7 8)"));
+    EXPECT_EQ(probe.use_count(), before);
+    const lisp::value kept = lisp::evaluate(lisp::parse("(mk 6)"), &stack);
+    EXPECT_EQ(probe.use_count(), before + 1);
+    EXPECT_EQ(kept.as_callable()(lisp::arg_list{ 2 }), 6);
+}
+
+TEST(closures, transfer_copies_the_frames_closures_keep)
+{
+    // The frame of mk binds a copy of `probe`, as does each copy of the frame.
+    lisp::stack_type stack = lisp::default_stack();
+    const lisp::callable probe{ [](const lisp::arg_list&) { return lisp::value{ 1 }; }, "probe", 0 };
+    stack.insert(lisp::symbol{ "probe" }, probe);
+    const lisp::value made = lisp::evaluate(
+        lisp::parse("(begin (defun mk (x) (begin (let p probe) (defun rec (n) (if (< n 1) x (rec (- n 1)))) "
+                    "(list rec (lambda (n) (rec n)) (partial rec 2)))) (mk 4))"),
+        &stack);
+    const long before = probe.use_count();
+    {
+        const lisp::value copy = lisp::transfer(made);
+        ASSERT_NE(&copy.as_array(), &made.as_array());
+        EXPECT_EQ(probe.use_count(), before + 1);
+        for (std::size_t i = 0; i < 3; ++i)
+        {
+            EXPECT_NE(&copy.as_array()[i].as_callable().fn(), &made.as_array()[i].as_callable().fn());
+        }
+        EXPECT_EQ(copy.as_array()[0].as_callable()(lisp::arg_list{ 3 }), 4);
+        EXPECT_EQ(copy.as_array()[1].as_callable()(lisp::arg_list{ 3 }), 4);
+        EXPECT_EQ(copy.as_array()[2].as_callable()(lisp::arg_list{}), 4);
+    }
+    EXPECT_EQ(probe.use_count(), before);
+    // Values without closures that keep frames are shared.
+    const lisp::value data = lisp::array{ 1, lisp::array{ 2, 3 }, probe };
+    EXPECT_EQ(&lisp::transfer(data).as_array(), &data.as_array());
+    const lisp::value sq = lisp::evaluate(lisp::parse("(lambda (n) (* n n))"), &stack);
+    EXPECT_EQ(&lisp::transfer(sq).as_callable().fn(), &sq.as_callable().fn());
+}
+
+TEST(closures, applied_lambdas_make_no_closure)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::evaluate(lisp::parse("(defun f (n) ((lambda (x y) (* x y)) n (+ n 1)))"), &stack);
+    EXPECT_EQ(lisp::evaluate(lisp::parse("(f 3)"), &stack), 12);
+    EXPECT_TRUE(lisp::evaluate(lisp::parse("((lambda (x y) (+ x y)) 1)"), &stack).is_callable());
+    EXPECT_EQ(lisp::evaluate(lisp::parse("(((lambda (x y) (+ x y)) 1) 2)"), &stack), 3);
+}
+
+TEST(iteration, loop_recurs_in_one_frame)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::evaluate(
+        lisp::parse("(defun sum-to (n) (loop ((i 0) (acc 0)) (if (> i n) acc (recur (+ i 1) (+ acc i)))))"), &stack);
+    const lisp::runtime_stats before = lisp::stats_snapshot();
+    EXPECT_EQ(lisp::evaluate(lisp::parse("(sum-to 2000)"), &stack), 2001000);
+    // The frame of sum-to and the one of the loop, however deep the recursion would have been.
+    EXPECT_EQ((lisp::stats_snapshot() - before).frames, 2u);
+
+    EXPECT_EQ(eval("(loop ((i 3) (j (* i 2))) (cond ((== i 0) j) (true (begin (recur (- i 1) (+ j 1))))))"), 9);
+    EXPECT_EQ(eval("(loop ((i 3) (out (list))) (if (== i 0) out (recur (- i 1) (cons i out))))"), lisp::parse("(1 2 3)"));
+    EXPECT_THROW(eval("(loop ((i 0)) (if (== i 0) (recur 1 2) i))"), std::runtime_error);
+    EXPECT_THROW(eval("(loop (i 0) i)"), std::runtime_error);
+}
+
+TEST(iteration, while_dotimes_and_doseq_update_the_current_frame)
+{
+    EXPECT_EQ(eval("(begin (let i 0) (let acc 1) (while (< i 10) (let acc (* acc 2)) (let i (+ i 1))) acc)"), 1024);
+    EXPECT_EQ(eval("(begin (defun f (n) (begin (let acc 0) (dotimes (i n) (let acc (+ acc i))) acc)) (f 10))"), 45);
+    EXPECT_EQ(eval("(begin (let acc (list)) (doseq (x (list 1 2 3)) (let acc (cons (* x x) acc))) acc)"),
+              lisp::parse("(9 4 1)"));
+    EXPECT_TRUE(eval("(dotimes (i 3) i)").is_null());
+    EXPECT_THROW(eval("(dotimes i 3)"), std::runtime_error);
+}
+
+TEST(iteration, repetitions_are_budget_steps)
+{
+    lisp::stack_type stack = lisp::default_stack();
+    lisp::budget limits{ 1000 };
+    EXPECT_THROW(lisp::evaluate(lisp::parse("(while true 1)"), &stack, limits), lisp::budget_exceeded);
+    lisp::budget more{ 1000 };
+    EXPECT_THROW(lisp::evaluate(lisp::parse("(loop ((i 0)) (recur i))"), &stack, more), lisp::budget_exceeded);
+}
+
+TEST(optimize, checks_calls)
+{
+    const auto error = [](const char* code) -> std::string
+    {
+        try
+        {
+            optimized(code);
+        }
+        catch (const std::exception& ex)
+        {
+            return ex.what();
+        }
+        return {};
+    };
+    EXPECT_EQ(error("(begin (defun f (a b) (+ a b)) (f 1 2 3))"), "On calling f: Expected 2 arguments, got 3");
+    EXPECT_EQ(error("(car x y)"), "On calling car: Expected 1 arguments, got 2");
+    EXPECT_EQ(error("((lambda (x) x) 1 2)"), "On calling lambda [1]: Expected 1 arguments, got 2");
+    EXPECT_EQ(error("(seq.map (list x) y)"), "On calling seq.map: accessing: callable, actual: array");
+    EXPECT_EQ(error("(str.has_prefix x (< y 1))"), "On calling str.has_prefix: accessing: string, actual: boolean");
+    // Partial application, names bound more than once and unknown categories are fine.
+    EXPECT_EQ(error("(begin (defun f (a b) a) (let f list) (f 1 2 3))"), "");
+    EXPECT_EQ(error("(begin (let h (seq.at 1)) (car (h x)) (cdr (+ x 1)))"), "");
+    // Calls that may never be evaluated, in branches, loop bodies and functions, are left for the evaluation.
+    EXPECT_EQ(error("(begin (defun f (a b) (+ a b)) (defun g () (f 1 2 3)))"), "");
+    EXPECT_EQ(error("(begin (defun bad () (car 5)) 1)"), "");
+    EXPECT_EQ(error("(if x (car (quote ())) 1)"), "");
+    EXPECT_EQ(error("(cond (x 1) ((car 5) 2))"), "");
+    EXPECT_EQ(error("(dotimes (i 0) (car 5))"), "");
+    EXPECT_EQ(error("(cond ((car 5) 1))"), "On calling car: accessing: array, actual: integer");
+    lisp::stack_type stack = lisp::default_stack();
+    EXPECT_EQ(lisp::evaluate(lisp::optimize(lisp::parse("(begin (let x 1) (if (== x 1) 1 (car 5)))"), stack), &stack), 1);
+    EXPECT_EQ(lisp::evaluate(lisp::optimize(lisp::parse("(begin (defun bad () (car 5)) 1)"), stack), &stack), 1);
+}
+
+TEST(optimize, proven_calls_skip_the_arity_check)
+{
+    EXPECT_TRUE(optimized("(+ x 1)").as_array().at(0).as_callable().is_unchecked());
+    EXPECT_FALSE(optimized("(+ x)").as_array().at(0).as_callable().is_unchecked());
+    EXPECT_FALSE(optimized("(list x)").as_array().at(0).as_callable().is_unchecked());
+    lisp::stack_type stack = lisp::default_stack();
+    EXPECT_EQ(lisp::evaluate(lisp::optimize(lisp::parse("(begin (let x 4) (list (+ x 1) ((+ x) 2)))"), stack), &stack),
+              lisp::parse("(5 6)"));
+}
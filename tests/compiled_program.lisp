@@ -0,0 +1,25 @@
+(begin
+    (defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+    (defun half (x) (/ x 2.0))
+    (defun sign (x) (cond ((< x 0) "negative") ((== x 0) "zero") (true "positive")))
+    (defun is_even (n) (== (% n 2) 0))
+    (defun scale_all (k xs) (seq.map (lambda (x) (* k x)) xs))
+    (defun sum_to (n acc) (if (< n 1) acc (sum_to (- n 1) (+ acc n))))
+    (defun greet (name) (begin (let greeting (str.cat "hello " name)) (str.cat greeting "!")))
+    (let offset 100)
+    (defun shifted (x) (+ x offset))
+    (defun adder (n) (lambda (x) (+ x n)))
+    (let add2 (adder 2))
+    (list
+        (fib 20)
+        (half 5)
+        (sign -3)
+        (sign 0)
+        (sign 7)
+        (seq.filter is_even '(1 2 3 4))
+        (scale_all 3 '(1 2 3))
+        (sum_to 100 0)
+        (greet "lisp")
+        (shifted 1)
+        (if (is_even 3) (quote even) (quote odd))
+        (add2 3)))